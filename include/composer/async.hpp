@@ -0,0 +1,342 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef COMPOSER__ASYNC_HPP
+#define COMPOSER__ASYNC_HPP
+
+#if __cplusplus < 202002L
+#error "composer/async.hpp needs C++20, link against composer-async"
+#endif
+
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <composer/result.hpp>
+#include <composer/worker_pool.hpp>
+#include <composer/xtea.hpp>
+
+namespace Composer {
+    namespace Detail {
+        /**
+         * Resumes whoever awaited the finished task
+         */
+        struct FinalAwaiter {
+            std::coroutine_handle<> continuation;
+
+            bool await_ready() noexcept {
+                return false;
+            }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<>) noexcept {
+                return this->continuation ? this->continuation : std::noop_coroutine();
+            }
+            void await_resume() noexcept {}
+        };
+
+        struct TaskPromiseBase {
+            std::coroutine_handle<> continuation;
+            std::exception_ptr exception;
+
+            std::suspend_always initial_suspend() noexcept {
+                return {};
+            }
+            FinalAwaiter final_suspend() noexcept {
+                return { this->continuation };
+            }
+            void unhandled_exception() noexcept {
+                this->exception = std::current_exception();
+            }
+        };
+    }
+
+    /**
+     * Lazily started coroutine returning T; starts when awaited
+     */
+    template<typename T = void>
+    class [[nodiscard]] Task {
+    public:
+        struct promise_type : Detail::TaskPromiseBase {
+            std::optional<T> value;
+
+            Task get_return_object() noexcept {
+                return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+            }
+            template<typename Value>
+            void return_value(Value &&value) {
+                this->value.emplace(std::forward<Value>(value));
+            }
+        };
+
+        Task(Task &&other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+        Task &operator=(Task &&other) noexcept {
+            std::swap(this->handle, other.handle);
+            return *this;
+        }
+        ~Task() {
+            if(this->handle) {
+                this->handle.destroy();
+            }
+        }
+
+        bool await_ready() const noexcept {
+            return false;
+        }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> continuation) noexcept {
+            this->handle.promise().continuation = continuation;
+            return this->handle;
+        }
+        T await_resume() {
+            auto &promise = this->handle.promise();
+            if(promise.exception) {
+                std::rethrow_exception(promise.exception);
+            }
+            return std::move(*promise.value);
+        }
+
+    private:
+        explicit Task(std::coroutine_handle<promise_type> handle) noexcept : handle(handle) {}
+
+        std::coroutine_handle<promise_type> handle;
+    };
+
+    template<>
+    class [[nodiscard]] Task<void> {
+    public:
+        struct promise_type : Detail::TaskPromiseBase {
+            Task get_return_object() noexcept {
+                return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+            }
+            void return_void() noexcept {}
+        };
+
+        Task(Task &&other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+        Task &operator=(Task &&other) noexcept {
+            std::swap(this->handle, other.handle);
+            return *this;
+        }
+        ~Task() {
+            if(this->handle) {
+                this->handle.destroy();
+            }
+        }
+
+        bool await_ready() const noexcept {
+            return false;
+        }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> continuation) noexcept {
+            this->handle.promise().continuation = continuation;
+            return this->handle;
+        }
+        void await_resume() {
+            if(this->handle.promise().exception) {
+                std::rethrow_exception(this->handle.promise().exception);
+            }
+        }
+
+    private:
+        explicit Task(std::coroutine_handle<promise_type> handle) noexcept : handle(handle) {}
+
+        std::coroutine_handle<promise_type> handle;
+    };
+
+    /**
+     * Single-threaded executor: coroutines spawned on it, and every coroutine resumed after an
+     * async operation, run on the thread calling run()
+     */
+    class EventLoop {
+    public:
+        EventLoop() noexcept = default;
+        EventLoop(EventLoop const &) = delete;
+        EventLoop &operator=(EventLoop const &) = delete;
+
+        /**
+         * Queue a coroutine to be resumed by run(); can be called from any thread
+         * @param handle    coroutine to resume
+         */
+        void post(std::coroutine_handle<> handle);
+
+        /**
+         * Resume queued coroutines until every spawned task has finished
+         */
+        void run();
+
+        /**
+         * Start a task on the loop; it runs once run() is called
+         * @param task  task to run, exceptions thrown by it terminate the program
+         */
+        void spawn(Task<void> task) {
+            this->task_started();
+            EventLoop::detach(*this, std::move(task));
+        }
+
+        /**
+         * Run a task and everything spawned so far to completion
+         * @param task  task to run
+         * @return      value returned by the task
+         */
+        template<typename Value>
+        Value run(Task<Value> task) {
+            std::exception_ptr exception;
+            if constexpr(std::is_void_v<Value>) {
+                this->spawn(EventLoop::capture(std::move(task), exception));
+                this->run();
+                if(exception) {
+                    std::rethrow_exception(exception);
+                }
+            }
+            else {
+                std::optional<Value> value;
+                this->spawn(EventLoop::capture(std::move(task), value, exception));
+                this->run();
+                if(exception) {
+                    std::rethrow_exception(exception);
+                }
+                return std::move(*value);
+            }
+        }
+
+    private:
+        /**
+         * Coroutine owning a spawned task; frees itself when done
+         */
+        struct Detached {
+            struct promise_type {
+                EventLoop *loop = nullptr;
+
+                Detached get_return_object() noexcept {
+                    return { std::coroutine_handle<promise_type>::from_promise(*this) };
+                }
+                std::suspend_always initial_suspend() noexcept {
+                    return {};
+                }
+                std::suspend_never final_suspend() noexcept {
+                    return {};
+                }
+                void return_void() noexcept {}
+                void unhandled_exception() noexcept {
+                    std::terminate();
+                }
+            };
+
+            std::coroutine_handle<promise_type> handle;
+        };
+
+        static void detach(EventLoop &loop, Task<void> task) {
+            auto detached = [](EventLoop &loop, Task<void> task) -> Detached {
+                co_await std::move(task);
+                loop.task_finished();
+            }(loop, std::move(task));
+            loop.post(detached.handle);
+        }
+
+        template<typename Value>
+        static Task<void> capture(Task<Value> task, std::optional<Value> &value, std::exception_ptr &exception) {
+            try {
+                value.emplace(co_await std::move(task));
+            }
+            catch(...) {
+                exception = std::current_exception();
+            }
+        }
+
+        static Task<void> capture(Task<void> task, std::exception_ptr &exception) {
+            try {
+                co_await std::move(task);
+            }
+            catch(...) {
+                exception = std::current_exception();
+            }
+        }
+
+        void task_started();
+        void task_finished();
+
+        std::deque<std::coroutine_handle<>> ready;
+        std::size_t tasks = 0;
+        std::mutex mutex;
+        std::condition_variable wake;
+    };
+
+    /**
+     * Awaitable running a function on a worker pool and resuming the awaiting coroutine on an event loop
+     */
+    template<typename Function>
+    class Offload {
+    public:
+        using Value = decltype(std::declval<Function &>()());
+
+        Offload(EventLoop &loop, WorkerPool &pool, Function function) : loop(loop), pool(pool), function(std::move(function)) {}
+
+        bool await_ready() const noexcept {
+            return false;
+        }
+        void await_suspend(std::coroutine_handle<> continuation) {
+            this->pool.submit([this, continuation]() {
+                this->value.emplace(this->function());
+                this->loop.post(continuation);
+            });
+        }
+        Value await_resume() {
+            return std::move(*this->value);
+        }
+
+    private:
+        EventLoop &loop;
+        WorkerPool &pool;
+        Function function;
+        std::optional<Value> value;
+    };
+
+    /**
+     * Run a function returning a value on a worker pool
+     * @param loop      loop resuming the awaiting coroutine
+     * @param pool      pool running the function
+     * @param function  function to run, must not throw
+     * @return          awaitable returning what the function returns
+     */
+    template<typename Function>
+    Offload<Function> offload(EventLoop &loop, WorkerPool &pool, Function function) {
+        return Offload<Function>(loop, pool, std::move(function));
+    }
+
+    /**
+     * Decrypt Halo's shader file without blocking the loop thread
+     * @param loop          loop resuming the awaiting coroutine
+     * @param pool          pool doing the reading, decryption and writing
+     * @param input_file    path to encrypted shader file
+     * @param output_file   path to output decrypted file
+     * @param key           key
+     * @return              awaitable returning the result of the operation
+     */
+    Task<Result> decrypt_shader_file_async(EventLoop &loop, WorkerPool &pool, std::filesystem::path input_file, std::filesystem::path output_file, Key key = default_key);
+
+    /**
+     * Encrypt Halo's shader file without blocking the loop thread
+     * @param loop          loop resuming the awaiting coroutine
+     * @param pool          pool doing the reading, encryption and writing
+     * @param input_file    path to shader file
+     * @param output_file   path to output encrypted file
+     * @param key           key
+     * @return              awaitable returning the result of the operation
+     */
+    Task<Result> encrypt_shader_file_async(EventLoop &loop, WorkerPool &pool, std::filesystem::path input_file, std::filesystem::path output_file, Key key = default_key);
+
+    /**
+     * Read and decrypt Halo's shader file into memory without blocking the loop thread
+     * @param loop          loop resuming the awaiting coroutine
+     * @param pool          pool doing the reading and decryption
+     * @param input_file    path to encrypted shader file
+     * @param shader_data   set to the shader data on success
+     * @param key           key
+     * @return              awaitable returning the result of the operation
+     */
+    Task<Result> load_shader_file_async(EventLoop &loop, WorkerPool &pool, std::filesystem::path input_file, std::vector<char> &shader_data, Key key = default_key);
+}
+
+#endif
@@ -0,0 +1,127 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef COMPOSER__BATCH_HPP
+#define COMPOSER__BATCH_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <composer/result.hpp>
+
+/*
+ * Batch report, one per shard, tab separated text:
+ *
+ *   # composer-batch report 1
+ *   shard  <index>/<count>
+ *   tree   <MD5 of the whole listing>  <number of files in the tree>
+ *   <status code>  <size>  <path relative to the tree>     one line per processed file
+ *
+ * Backslashes, tabs and newlines in paths are escaped as \\, \t and \n.
+ */
+
+namespace Composer {
+    /**
+     * File of a batch
+     */
+    struct BatchFile {
+        /** Path relative to the batch root, with / separators */
+        std::string path;
+
+        /** Size in bytes */
+        std::uint64_t size;
+    };
+
+    /**
+     * Outcome of one file of a batch
+     */
+    struct BatchRecord {
+        /** Path relative to the batch root, with / separators */
+        std::string path;
+
+        /** Size of the input in bytes */
+        std::uint64_t size;
+
+        /** Status of the operation */
+        Status status;
+    };
+
+    /**
+     * What a shard did, see the layout above
+     */
+    struct BatchReport {
+        std::size_t shard_index = 0;
+        std::size_t shard_count = 1;
+
+        /** Identifies the listing the shards were computed from */
+        std::string tree_hash;
+
+        /** Number of files in the whole tree */
+        std::uint64_t tree_files = 0;
+
+        std::vector<BatchRecord> records;
+    };
+
+    /**
+     * List the regular files of a directory tree in a deterministic order (sorted by path)
+     * @param directory     root of the tree
+     * @param files         set to the files
+     * @return              result of the operation
+     */
+    Result list_batch_files(std::filesystem::path const &directory, std::vector<BatchFile> &files) noexcept;
+
+    /**
+     * Get a hash identifying a listing, so shards computed from different trees can be told apart
+     * @param files     listing from list_batch_files
+     * @return          32 hex characters
+     */
+    std::string batch_tree_hash(std::vector<BatchFile> const &files);
+
+    /**
+     * Parse a shard specification "index/count", index counted from 0
+     * @param text      specification
+     * @param index     set to the shard index
+     * @param count     set to the number of shards
+     * @return          true if valid
+     */
+    bool parse_shard(std::string const &text, std::size_t &index, std::size_t &count) noexcept;
+
+    /**
+     * Split files into shards of about the same number of bytes: largest files first, each one to
+     * the shard with the fewest bytes so far (longest processing time first). Only depends on the
+     * listing, so every node computes the same split.
+     * @param files         listing from list_batch_files
+     * @param shard_count   number of shards
+     * @return              shard index of each file
+     */
+    std::vector<std::size_t> assign_shards(std::vector<BatchFile> const &files, std::size_t shard_count);
+
+    /**
+     * Write a batch report
+     * @param filepath  path to the report
+     * @param report    report
+     * @return          result of the operation
+     */
+    Result write_batch_report(std::filesystem::path const &filepath, BatchReport const &report) noexcept;
+
+    /**
+     * Read a batch report
+     * @param filepath  path to the report
+     * @param report    set to the report
+     * @return          result of the operation, invalid_report if malformed
+     */
+    Result read_batch_report(std::filesystem::path const &filepath, BatchReport &report) noexcept;
+
+    /**
+     * Combine the reports of every shard of a batch, checking that they come from the same tree
+     * and cover each file exactly once
+     * @param reports   shard reports
+     * @param merged    set to the combined report, records sorted by path
+     * @param problems  set to a description of each coverage problem
+     * @return          true if the reports cover the whole tree and no file failed
+     */
+    bool merge_batch_reports(std::vector<BatchReport> const &reports, BatchReport &merged, std::vector<std::string> &problems);
+}
+
+#endif
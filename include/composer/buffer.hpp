@@ -0,0 +1,109 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef COMPOSER__BUFFER_HPP
+#define COMPOSER__BUFFER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace Composer {
+    /**
+     * How the library allocates its large buffers
+     */
+    enum class AllocationPolicy : std::uint8_t {
+        /** Regular heap allocation, pages are faulted in on first touch */
+        standard = 0,
+
+        /** Anonymous mapping populated up front (MAP_POPULATE) */
+        prefault,
+
+        /** Huge-page aligned mapping with MADV_HUGEPAGE, populated up front */
+        transparent_huge_pages,
+
+        /** Reserved huge pages (MAP_HUGETLB), falls back to transparent_huge_pages if none are available */
+        huge_pages
+    };
+
+    /**
+     * Buffers smaller than this always use the standard policy
+     */
+    constexpr std::size_t large_buffer_size = 1 << 20;
+
+    /**
+     * Set the allocation policy used by buffers allocated from now on
+     * @param policy    allocation policy
+     */
+    void set_allocation_policy(AllocationPolicy policy) noexcept;
+
+    /**
+     * Get the current allocation policy
+     * @return  allocation policy
+     */
+    AllocationPolicy allocation_policy() noexcept;
+
+    /**
+     * Parse an allocation policy name: standard, prefault, thp or hugetlb
+     * @param name      policy name
+     * @param policy    set to the parsed policy
+     * @return          true if the name is valid
+     */
+    bool parse_allocation_policy(std::string const &name, AllocationPolicy &policy) noexcept;
+
+    /**
+     * Get the name of an allocation policy, as accepted by parse_allocation_policy
+     * @param policy    allocation policy
+     * @return          name
+     */
+    const char *allocation_policy_name(AllocationPolicy policy) noexcept;
+
+    /**
+     * Move-only byte buffer allocated according to the allocation policy
+     */
+    class Buffer {
+    public:
+        Buffer() noexcept = default;
+        Buffer(Buffer &&other) noexcept;
+        Buffer &operator=(Buffer &&other) noexcept;
+        Buffer(Buffer const &) = delete;
+        Buffer &operator=(Buffer const &) = delete;
+        ~Buffer();
+
+        /**
+         * Replace the contents with an uninitialized buffer
+         * @param size  size in bytes
+         * @return      false if out of memory
+         */
+        bool allocate(std::size_t size) noexcept;
+
+        /**
+         * Make sure the buffer holds at least `size` bytes, keeping the current one (and its
+         * contents) if it is large enough
+         * @param size  size in bytes
+         * @return      false if out of memory
+         */
+        bool reserve(std::size_t size) noexcept;
+
+        /**
+         * Free the buffer
+         */
+        void release() noexcept;
+
+        char *data() const noexcept {
+            return this->memory;
+        }
+
+        std::size_t size() const noexcept {
+            return this->length;
+        }
+
+    private:
+        char *memory = nullptr;
+        std::size_t length = 0;
+
+        /** Length of the mapping if the buffer was mapped, 0 if it is on the heap */
+        std::size_t mapped_length = 0;
+    };
+}
+
+#endif
@@ -0,0 +1,119 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef COMPOSER__CACHE_HPP
+#define COMPOSER__CACHE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <composer/result.hpp>
+#include <composer/xtea.hpp>
+
+namespace Composer {
+    /**
+     * Decrypted shader data shared between the cache and its users; never modified
+     */
+    using SharedShader = std::shared_ptr<std::vector<char> const>;
+
+    /**
+     * Counters of a shader cache
+     */
+    struct CacheStats {
+        std::uint64_t hits = 0;
+        std::uint64_t misses = 0;
+        std::uint64_t evictions = 0;
+
+        /** Entries and bytes of shader data currently cached */
+        std::uint64_t entries = 0;
+        std::uint64_t bytes = 0;
+    };
+
+    /**
+     * Thread-safe LRU cache of decrypted shader data with a byte budget.
+     *
+     * Encrypted data is looked up by a fast hash of the whole ciphertext, files by path, size and
+     * modification time, so an unchanged file is neither read nor decrypted again. Entries are
+     * spread over independently locked shards, each with its share of the budget; data larger than
+     * a shard's budget is decrypted but not kept.
+     */
+    class ShaderCache {
+    public:
+        /**
+         * Create an empty cache
+         * @param byte_budget   maximum bytes of shader data kept
+         * @param shard_count   number of shards, at least 1
+         */
+        explicit ShaderCache(std::size_t byte_budget, std::size_t shard_count = 16);
+
+        ShaderCache(ShaderCache const &) = delete;
+        ShaderCache &operator=(ShaderCache const &) = delete;
+
+        /**
+         * Decrypt Halo's shader data, or get it from the cache
+         * @param encrypted_shader_data     encrypted shader data
+         * @param size                      size of the encrypted shader data
+         * @param shader                    set to the shader data
+         * @param key                       key
+         * @return                          result of the operation
+         */
+        Result decrypt(char const *encrypted_shader_data, std::size_t size, SharedShader &shader, Key const &key = default_key) noexcept;
+
+        /**
+         * Read and decrypt Halo's shader file, or get it from the cache
+         * @param input_file    path to encrypted shader file
+         * @param shader        set to the shader data
+         * @param key           key
+         * @return              result of the operation
+         */
+        Result decrypt_file(std::filesystem::path const &input_file, SharedShader &shader, Key const &key = default_key) noexcept;
+
+        /**
+         * Get the counters, summed over the shards
+         * @return  counters
+         */
+        CacheStats stats() const noexcept;
+
+        /**
+         * Drop every entry; shader data still held by users stays valid
+         */
+        void clear() noexcept;
+
+    private:
+        struct Entry {
+            std::uint64_t hash;
+
+            /** Exact identity: end of the ciphertext, or path, size and time of the file */
+            std::string identity;
+
+            SharedShader shader;
+        };
+
+        struct Shard {
+            mutable std::mutex mutex;
+
+            /** Most recently used first */
+            std::list<Entry> entries;
+            std::unordered_multimap<std::uint64_t, std::list<Entry>::iterator> index;
+
+            std::size_t bytes = 0;
+            CacheStats stats;
+        };
+
+        template<typename Load>
+        Result lookup(std::uint64_t hash, std::string const &identity, SharedShader &shader, Load &&load) noexcept;
+
+        bool find(Shard &shard, std::uint64_t hash, std::string const &identity, SharedShader &shader);
+        void insert(Shard &shard, std::uint64_t hash, std::string const &identity, SharedShader const &shader);
+
+        std::size_t shard_budget;
+        std::vector<std::unique_ptr<Shard>> shards;
+    };
+}
+
+#endif
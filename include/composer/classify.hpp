@@ -0,0 +1,95 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef COMPOSER__CLASSIFY_HPP
+#define COMPOSER__CLASSIFY_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <composer/result.hpp>
+#include <composer/xtea.hpp>
+
+namespace Composer {
+    /**
+     * What a file looks like
+     */
+    enum class ShaderKind : std::uint8_t {
+        /** Neither, e.g. encrypted with another key, compressed or too small */
+        unknown = 0,
+
+        /** Not encrypted: shader bytecode or other low entropy data */
+        plaintext,
+
+        /** Encrypted shader data with a valid trailer */
+        encrypted
+    };
+
+    /**
+     * Outcome of classify_shader
+     */
+    struct ShaderClassification {
+        ShaderKind kind = ShaderKind::unknown;
+
+        /** Index of the key decrypting the trailer, for encrypted data */
+        std::size_t key_index = 0;
+
+        /** Shannon entropy of the sampled bytes in bits per byte */
+        double entropy = 0;
+
+        /** A Direct3D shader version token was found in the samples */
+        bool bytecode = false;
+    };
+
+    /**
+     * Guess whether data is encrypted shader data, plaintext or neither, without a full pass.
+     *
+     * Only the trailer blocks and about 7 KiB of samples (the head and three windows spread over
+     * the data) are looked at. A trailer that decrypts into a well formed one under a key means
+     * encrypted; otherwise a D3D shader version token or a clearly non-random byte distribution
+     * means plaintext.
+     *
+     * @param data      data
+     * @param size      size of the data
+     * @param keys      candidate keys
+     * @param key_count number of candidate keys
+     * @return          classification
+     */
+    ShaderClassification classify_shader(char const *data, std::size_t size, Key const *keys, std::size_t key_count) noexcept;
+
+    /**
+     * Guess whether data is encrypted shader data, plaintext or neither, see above
+     * @param data      data
+     * @param size      size of the data
+     * @param key       key
+     * @return          classification
+     */
+    ShaderClassification classify_shader(char const *data, std::size_t size, Key const &key = default_key) noexcept;
+
+    /**
+     * Classify a file, reading only the sampled parts, see classify_shader
+     * @param input_file        path to the file
+     * @param classification    set to the classification
+     * @param keys              candidate keys
+     * @param key_count         number of candidate keys
+     * @return                  result of the operation
+     */
+    Result try_classify_shader_file(std::filesystem::path const &input_file, ShaderClassification &classification, Key const *keys, std::size_t key_count) noexcept;
+
+    /**
+     * Classify a file, reading only the sampled parts, see classify_shader
+     * @param input_file        path to the file
+     * @param classification    set to the classification
+     * @param key               key
+     * @return                  result of the operation
+     */
+    Result try_classify_shader_file(std::filesystem::path const &input_file, ShaderClassification &classification, Key const &key = default_key) noexcept;
+
+    /**
+     * Get the name of a kind: unknown, plaintext or encrypted
+     * @param kind  kind
+     * @return      name
+     */
+    const char *shader_kind_name(ShaderKind kind) noexcept;
+}
+
+#endif
@@ -0,0 +1,62 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef COMPOSER__DEDUP_HPP
+#define COMPOSER__DEDUP_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+#include <composer/result.hpp>
+#include <composer/worker_pool.hpp>
+
+namespace Composer {
+    /**
+     * How clone_file made the copy
+     */
+    enum class CloneMethod : std::uint8_t {
+        /** Copy-on-write clone sharing the extents (FICLONE) */
+        reflink = 0,
+
+        /** Hard link to the same inode */
+        hardlink,
+
+        /** Plain copy of the bytes */
+        copy
+    };
+
+    /**
+     * Find byte-identical files.
+     *
+     * Only files sharing their size with another one are read; those are hashed on the pool and
+     * files with equal hashes are compared byte for byte. Files that can't be read count as unique.
+     *
+     * @param files     files
+     * @param sizes     size of each file
+     * @param pool      pool hashing and comparing the files
+     * @return          for each file, the index of the first file identical to it (its own if none)
+     */
+    std::vector<std::size_t> find_duplicate_files(std::vector<std::filesystem::path> const &files, std::vector<std::uint64_t> const &sizes, WorkerPool &pool);
+
+    /**
+     * Make output_file a copy of input_file as cheaply as the filesystem allows: a reflink, else a
+     * hard link, else a plain copy. An existing output_file is replaced atomically.
+     *
+     * Hard links share the inode, so writing to one of the files changes the other.
+     *
+     * @param input_file    file to copy
+     * @param output_file   copy to make
+     * @param method        set to the method used
+     * @return              result of the operation
+     */
+    Result clone_file(std::filesystem::path const &input_file, std::filesystem::path const &output_file, CloneMethod &method) noexcept;
+
+    /**
+     * Get the name of a clone method: reflink, hardlink or copy
+     * @param method    method
+     * @return          name
+     */
+    const char *clone_method_name(CloneMethod method) noexcept;
+}
+
+#endif
@@ -0,0 +1,48 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef COMPOSER__DIFF_HPP
+#define COMPOSER__DIFF_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+#include <composer/result.hpp>
+
+namespace Composer {
+    /**
+     * Range of shader data bytes
+     */
+    struct ByteRange {
+        std::uint64_t offset;
+        std::uint64_t size;
+    };
+
+    /**
+     * Find which shader data bytes differ between two encrypted shaders without decrypting them.
+     *
+     * Blocks are encrypted independently with the same key, so a ciphertext block differs exactly
+     * when its plaintext block does. The ranges are block granular and conservative at the end: the
+     * last whole block and the overlapped tail block are compared as a unit, blocks shared with the
+     * checksum trailer are reported if anything in them changed, and when the sizes differ
+     * everything past the shorter data is reported. Both shaders must use the same key.
+     *
+     * @param a         encrypted shader data
+     * @param a_size    size of a, at least trailer_size
+     * @param b         encrypted shader data
+     * @param b_size    size of b, at least trailer_size
+     * @param ranges    set to the changed ranges of shader data, sorted and not adjacent
+     */
+    void diff_encrypted_shaders(char const *a, std::size_t a_size, char const *b, std::size_t b_size, std::vector<ByteRange> &ranges);
+
+    /**
+     * Find which shader data bytes differ between two encrypted shader files, see diff_encrypted_shaders
+     * @param a_file    path to encrypted shader file
+     * @param b_file    path to encrypted shader file
+     * @param ranges    set to the changed ranges of shader data
+     * @return          result of the operation
+     */
+    Result try_diff_encrypted_shader_files(std::filesystem::path const &a_file, std::filesystem::path const &b_file, std::vector<ByteRange> &ranges) noexcept;
+}
+
+#endif
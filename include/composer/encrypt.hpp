@@ -3,22 +3,149 @@
 #ifndef COMPOSER__ENCRYPT_HPP
 #define COMPOSER__ENCRYPT_HPP
 
+#include <cstddef>
+#include <functional>
 #include <vector>
+#include <composer/result.hpp>
+#include <composer/xtea.hpp>
 
 namespace Composer {
+    class WorkerPool;
+
+    /**
+     * Size of the MD5 checksum and terminator appended to encrypted shader data
+     */
+    constexpr std::size_t trailer_size = 33;
+
     /**
      * Decrypt Halo's shader data
      * @param encrypted_shader_data     encrypted shader data
+     * @param key                       key
      * @return                          shader data
      */
-    std::vector<char> decrypt_shader(std::vector<char> const &encrypted_shader_data);
+    std::vector<char> decrypt_shader(std::vector<char> const &encrypted_shader_data, Key const &key = default_key);
 
     /**
      * Encrypt Halo's shader data
      * @param shader_data   shader data
+     * @param key           key
      * @return              encrypted shader data
      */
-    std::vector<char> encrypt_shader(std::vector<char> const &shader_data);
+    std::vector<char> encrypt_shader(std::vector<char> const &shader_data, Key const &key = default_key);
+
+    /**
+     * Decrypt Halo's shader data without throwing or allocating
+     * @param encrypted_shader_data     encrypted shader data
+     * @param size                      size of the encrypted shader data
+     * @param output                    buffer of at least `size` bytes, may be the input buffer
+     * @param output_size               set to the shader data size on success
+     * @param key                       key
+     * @return                          result of the operation
+     */
+    Result try_decrypt_shader(char const *encrypted_shader_data, std::size_t size, char *output, std::size_t &output_size, Key const &key = default_key) noexcept;
+
+    /**
+     * Encrypt Halo's shader data without throwing or allocating
+     * @param shader_data   shader data
+     * @param size          size of the shader data
+     * @param output        buffer of at least `size + trailer_size` bytes, may be the input buffer
+     * @param output_size   set to the encrypted shader data size on success
+     * @param key           key
+     * @return              result of the operation
+     */
+    Result try_encrypt_shader(char const *shader_data, std::size_t size, char *output, std::size_t &output_size, Key const &key = default_key) noexcept;
+
+    /**
+     * Re-encrypt Halo's shader data with another key
+     * @param encrypted_shader_data     encrypted shader data
+     * @param from_key                  key the data is encrypted with
+     * @param to_key                    key to encrypt the data with
+     * @return                          encrypted shader data
+     */
+    std::vector<char> transcode_shader(std::vector<char> const &encrypted_shader_data, Key const &from_key, Key const &to_key);
+
+    /**
+     * Re-encrypt Halo's shader data with another key without throwing or allocating. Each block is
+     * decrypted, hashed and encrypted again while it's in cache; the checksum trailer is kept.
+     * @param encrypted_shader_data     encrypted shader data
+     * @param size                      size of the encrypted shader data, also the size of the output
+     * @param output                    buffer of at least `size` bytes, may be the input buffer
+     * @param from_key                  key the data is encrypted with
+     * @param to_key                    key to encrypt the data with
+     * @return                          result of the operation; on failure the output is garbage
+     */
+    Result try_transcode_shader(char const *encrypted_shader_data, std::size_t size, char *output, Key const &from_key, Key const &to_key) noexcept;
+
+    /**
+     * Get the MD5 hash of the shader data stored in encrypted shader data; only the blocks holding
+     * the checksum trailer are decrypted, so the cost doesn't depend on the size
+     * @param encrypted_shader_data     encrypted shader data
+     * @param size                      size of the encrypted shader data
+     * @param fingerprint               set to the raw MD5 hash of the shader data
+     * @param key                       key
+     * @return                          result of the operation, checksum_failed if the trailer isn't a hash
+     */
+    Result try_shader_fingerprint(char const *encrypted_shader_data, std::size_t size, unsigned char fingerprint[16], Key const &key = default_key) noexcept;
+
+    /**
+     * Find which of several keys the shader data was encrypted with; only the blocks holding the
+     * checksum trailer are decrypted, several candidates at once
+     * @param encrypted_shader_data     encrypted shader data
+     * @param size                      size of the encrypted shader data
+     * @param keys                      candidate keys
+     * @param key_count                 number of candidate keys
+     * @param key_index                 set to the index of the matching key
+     * @return                          true if a key matched
+     */
+    bool detect_shader_key(char const *encrypted_shader_data, std::size_t size, Key const *keys, std::size_t key_count, std::size_t &key_index) noexcept;
+
+    /**
+     * Shader data of a batch processed by encrypt_many or decrypt_many
+     */
+    struct ShaderJob {
+        char const *input = nullptr;
+        std::size_t size = 0;
+
+        /** Buffer of at least `size + trailer_size` bytes to encrypt, `size` to decrypt; may be the input */
+        char *output = nullptr;
+
+        /** Set to the size of the output on success */
+        std::size_t output_size = 0;
+
+        /** Set once the job ran */
+        Result result;
+    };
+
+    /**
+     * Called as each job of a batch finishes, from the thread that ran it, so possibly from
+     * several threads at once; must not throw
+     */
+    using JobCallback = std::function<void(std::size_t index, Result const &result)>;
+
+    /**
+     * Decrypt many shaders in parallel, see try_decrypt_shader. Small jobs are grouped so each
+     * thread gets about a megabyte at a time; the calling thread works too.
+     * @param jobs      jobs, each result and output_size is set
+     * @param count     number of jobs
+     * @param pool      pool to run on, nullptr for shared_worker_pool; if that can't start its
+     *                  threads, every job fails with thread_failed
+     * @param callback  called as each job finishes, may be empty
+     * @param key       key
+     * @return          true if every job succeeded
+     */
+    bool decrypt_many(ShaderJob *jobs, std::size_t count, WorkerPool *pool = nullptr, JobCallback const &callback = JobCallback(), Key const &key = default_key);
+
+    /**
+     * Encrypt many shaders in parallel, see try_encrypt_shader and decrypt_many
+     * @param jobs      jobs, each result and output_size is set
+     * @param count     number of jobs
+     * @param pool      pool to run on, nullptr for shared_worker_pool; if that can't start its
+     *                  threads, every job fails with thread_failed
+     * @param callback  called as each job finishes, may be empty
+     * @param key       key
+     * @return          true if every job succeeded
+     */
+    bool encrypt_many(ShaderJob *jobs, std::size_t count, WorkerPool *pool = nullptr, JobCallback const &callback = JobCallback(), Key const &key = default_key);
 }
 
 #endif
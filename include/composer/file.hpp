@@ -3,22 +3,208 @@
 #ifndef COMPOSER__FILE_HPP
 #define COMPOSER__FILE_HPP
 
+#include <cstddef>
 #include <filesystem>
+#include <composer/buffer.hpp>
+#include <composer/encrypt.hpp>
+#include <composer/result.hpp>
+#include <composer/xtea.hpp>
 
 namespace Composer {
     /**
-     * Decrypt Halo's shader file
+     * Settings of the pipelined file mode, where a reader thread, the cipher and a writer thread
+     * pass fixed-size chunks around so disk I/O overlaps the computation
+     */
+    struct PipelineOptions {
+        /** Size of each chunk in bytes, rounded up to a multiple of 64 */
+        std::size_t chunk_size = 1 << 20;
+
+        /** Number of chunks in flight, at least 2 */
+        std::size_t chunk_count = 4;
+    };
+
+    /**
+     * Decrypt Halo's shader file; the machine profile is read on first use and large files go
+     * through the pipelined mode if it says so. Its other settings are not applied, so cipher,
+     * MD5 and allocation choices made by the caller stay (see composer/profile.hpp)
+     * @param input_file    path to encrypted shader file
+     * @param output_file   path to output decrypted file
+     * @param key           key
+     */
+    void decrypt_shader_file(std::filesystem::path input_file, std::filesystem::path output_file, Key const &key = default_key);
+
+    /**
+     * Encrypt Halo's shader file; the machine profile is read on first use and large files go
+     * through the pipelined mode if it says so. Its other settings are not applied, so cipher,
+     * MD5 and allocation choices made by the caller stay (see composer/profile.hpp)
+     * @param input_file    path to shader file
+     * @param output_file   path to output encrypted file
+     * @param key           key
+     */
+    void encrypt_shader_file(std::filesystem::path input_file, std::filesystem::path output_file, Key const &key = default_key);
+
+    /**
+     * Decrypt Halo's shader file without throwing
+     * @param input_file    path to encrypted shader file
+     * @param output_file   path to output decrypted file
+     * @param key           key
+     * @return              result of the operation
+     */
+    Result try_decrypt_shader_file(std::filesystem::path const &input_file, std::filesystem::path const &output_file, Key const &key = default_key) noexcept;
+
+    /**
+     * Encrypt Halo's shader file without throwing
+     * @param input_file    path to shader file
+     * @param output_file   path to output encrypted file
+     * @param key           key
+     * @return              result of the operation
+     */
+    Result try_encrypt_shader_file(std::filesystem::path const &input_file, std::filesystem::path const &output_file, Key const &key = default_key) noexcept;
+
+    /**
+     * Decrypt Halo's shader file without throwing, reusing a scratch buffer across calls
      * @param input_file    path to encrypted shader file
      * @param output_file   path to output decrypted file
+     * @param buffer        scratch buffer, grown if too small
+     * @param key           key
+     * @return              result of the operation
+     */
+    Result try_decrypt_shader_file(std::filesystem::path const &input_file, std::filesystem::path const &output_file, Buffer &buffer, Key const &key = default_key) noexcept;
+
+    /**
+     * Encrypt Halo's shader file without throwing, reusing a scratch buffer across calls
+     * @param input_file    path to shader file
+     * @param output_file   path to output encrypted file
+     * @param buffer        scratch buffer, grown if too small
+     * @param key           key
+     * @return              result of the operation
+     */
+    Result try_encrypt_shader_file(std::filesystem::path const &input_file, std::filesystem::path const &output_file, Buffer &buffer, Key const &key = default_key) noexcept;
+
+    /**
+     * Decrypt Halo's shader file with the pipelined mode
+     * @param input_file    path to encrypted shader file
+     * @param output_file   path to output decrypted file, not written if the checksum fails
+     * @param options       pipeline settings
+     * @param key           key
+     */
+    void decrypt_shader_file(std::filesystem::path input_file, std::filesystem::path output_file, PipelineOptions const &options, Key const &key = default_key);
+
+    /**
+     * Encrypt Halo's shader file with the pipelined mode
+     * @param input_file    path to shader file
+     * @param output_file   path to output encrypted file
+     * @param options       pipeline settings
+     * @param key           key
      */
-    void decrypt_shader_file(std::filesystem::path input_file, std::filesystem::path output_file);
+    void encrypt_shader_file(std::filesystem::path input_file, std::filesystem::path output_file, PipelineOptions const &options, Key const &key = default_key);
 
     /**
-     * Encrypt Halo's shader file
+     * Decrypt Halo's shader file with the pipelined mode without throwing
+     * @param input_file    path to encrypted shader file
+     * @param output_file   path to output decrypted file, not written if the checksum fails
+     * @param options       pipeline settings
+     * @param key           key
+     * @return              result of the operation
+     */
+    Result try_decrypt_shader_file(std::filesystem::path const &input_file, std::filesystem::path const &output_file, PipelineOptions const &options, Key const &key = default_key) noexcept;
+
+    /**
+     * Encrypt Halo's shader file with the pipelined mode without throwing
      * @param input_file    path to shader file
      * @param output_file   path to output encrypted file
+     * @param options       pipeline settings
+     * @param key           key
+     * @return              result of the operation
+     */
+    Result try_encrypt_shader_file(std::filesystem::path const &input_file, std::filesystem::path const &output_file, PipelineOptions const &options, Key const &key = default_key) noexcept;
+
+    /**
+     * Re-encrypt Halo's shader file with another key, streaming it in chunks
+     * @param input_file    path to encrypted shader file
+     * @param output_file   path to output encrypted file
+     * @param from_key      key the input is encrypted with
+     * @param to_key        key to encrypt the output with
+     */
+    void transcode_shader_file(std::filesystem::path input_file, std::filesystem::path output_file, Key const &from_key, Key const &to_key);
+
+    /**
+     * Re-encrypt Halo's shader file with another key without throwing
+     * @param input_file    path to encrypted shader file
+     * @param output_file   path to output encrypted file, not written if the checksum fails
+     * @param from_key      key the input is encrypted with
+     * @param to_key        key to encrypt the output with
+     * @return              result of the operation
+     */
+    Result try_transcode_shader_file(std::filesystem::path const &input_file, std::filesystem::path const &output_file, Key const &from_key, Key const &to_key) noexcept;
+
+    /**
+     * Get the MD5 hash of the shader data stored in an encrypted shader file, reading only the end of the file
+     * @param input_file    path to encrypted shader file
+     * @param fingerprint   set to the raw MD5 hash of the shader data
+     * @param key           key
+     * @return              result of the operation, checksum_failed if the trailer isn't a hash
+     */
+    Result try_shader_file_fingerprint(std::filesystem::path const &input_file, unsigned char fingerprint[16], Key const &key = default_key) noexcept;
+
+    /**
+     * Find which of several keys a shader file was encrypted with, reading only the end of the file
+     * @param input_file    path to encrypted shader file
+     * @param keys          candidate keys
+     * @param key_count     number of candidate keys
+     * @param key_index     set to the index of the matching key
+     * @return              result of the operation, key_not_found if no key matched
+     */
+    Result try_detect_shader_file_key(std::filesystem::path const &input_file, Key const *keys, std::size_t key_count, std::size_t &key_index) noexcept;
+
+    /**
+     * Make the output files written so far durable.
+     *
+     * Outputs are written to a temporary file renamed into place, so other processes never see a
+     * partial one, but they are not flushed one by one: until this returns, a crash can leave an
+     * empty or partial output where the rename reached the disk before the data. This flushes
+     * them all at once, with one syncfs per filesystem written to (a plain sync outside Linux).
+     *
+     * @return  result of the operation
+     */
+    Result sync_outputs() noexcept;
+
+    /**
+     * File of a batch processed by encrypt_many or decrypt_many
+     */
+    struct ShaderFileJob {
+        std::filesystem::path input_file;
+        std::filesystem::path output_file;
+
+        /** Set once the job ran */
+        Result result;
+    };
+
+    /**
+     * Decrypt many shader files in parallel, see try_decrypt_shader_file. Files are started
+     * largest first, and each thread reuses one buffer for all the files it handles; the calling
+     * thread works too. The buffers are freed before returning.
+     * @param jobs      jobs, each result is set
+     * @param count     number of jobs
+     * @param pool      pool to run on, nullptr for shared_worker_pool; if that can't start its
+     *                  threads, every job fails with thread_failed
+     * @param callback  called as each job finishes, may be empty
+     * @param key       key
+     * @return          true if every job succeeded
+     */
+    bool decrypt_many(ShaderFileJob *jobs, std::size_t count, WorkerPool *pool = nullptr, JobCallback const &callback = JobCallback(), Key const &key = default_key);
+
+    /**
+     * Encrypt many shader files in parallel, see try_encrypt_shader_file and decrypt_many
+     * @param jobs      jobs, each result is set
+     * @param count     number of jobs
+     * @param pool      pool to run on, nullptr for shared_worker_pool; if that can't start its
+     *                  threads, every job fails with thread_failed
+     * @param callback  called as each job finishes, may be empty
+     * @param key       key
+     * @return          true if every job succeeded
      */
-    void encrypt_shader_file(std::filesystem::path input_file, std::filesystem::path output_file);
+    bool encrypt_many(ShaderFileJob *jobs, std::size_t count, WorkerPool *pool = nullptr, JobCallback const &callback = JobCallback(), Key const &key = default_key);
 }
 
 #endif
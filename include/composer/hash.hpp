@@ -0,0 +1,20 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef COMPOSER__HASH_HPP
+#define COMPOSER__HASH_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Composer {
+    /**
+     * Fast non-cryptographic 64-bit hash (the xxHash64 algorithm), for cache keys and the like
+     * @param data  data
+     * @param size  size of the data
+     * @param seed  seed
+     * @return      hash
+     */
+    std::uint64_t fast_hash64(void const *data, std::size_t size, std::uint64_t seed = 0) noexcept;
+}
+
+#endif
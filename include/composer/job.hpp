@@ -0,0 +1,113 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef COMPOSER__JOB_HPP
+#define COMPOSER__JOB_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <composer/result.hpp>
+#include <composer/xtea.hpp>
+#include <hash-library/md5.h>
+
+namespace Composer {
+    /**
+     * How much work one step of a job may do; the first limit reached ends the step
+     */
+    struct StepBudget {
+        /** Most 8 byte blocks to decrypt, 0 for no limit */
+        std::size_t max_blocks = 0;
+
+        /** Most time to spend, 0 for no limit; a step overshoots by at most one slice (1 KiB) */
+        std::chrono::microseconds max_time = std::chrono::microseconds(0);
+    };
+
+    /**
+     * Decryption of Halo's shader data spread over many calls, e.g. one step per frame.
+     *
+     * Each step decrypts a bounded number of blocks and hashes the data made final so far, so the
+     * cipher and MD5 state carry over between calls and the checksum is ready when the last block
+     * is. A job can be cancelled from any thread and can be given a deadline.
+     */
+    class DecryptJob {
+    public:
+        /**
+         * Start a job; nothing is done until the first step
+         * @param encrypted_shader_data     encrypted shader data, kept alive until the job finishes
+         * @param size                      size of the encrypted shader data
+         * @param output                    buffer of at least size bytes, may be encrypted_shader_data
+         * @param key                       key
+         */
+        DecryptJob(char const *encrypted_shader_data, std::size_t size, char *output, Key const &key = default_key) noexcept;
+
+        DecryptJob(DecryptJob const &) = delete;
+        DecryptJob &operator=(DecryptJob const &) = delete;
+
+        /**
+         * Do some more work
+         * @param budget    limits of this step
+         * @return          true once the job is finished, see result()
+         */
+        bool step(StepBudget const &budget) noexcept;
+
+        /**
+         * Stop the job at its next step with Status::cancelled; callable from any thread
+         */
+        void cancel() noexcept;
+
+        /**
+         * Fail the job with Status::deadline_exceeded if it isn't finished by then
+         * @param deadline  point in time
+         */
+        void set_deadline(std::chrono::steady_clock::time_point deadline) noexcept;
+
+        /**
+         * Check if the job is finished, successfully or not
+         * @return  true if finished
+         */
+        bool finished() const noexcept;
+
+        /**
+         * Get the outcome of a finished job
+         * @return  result, ok while the job runs
+         */
+        Result result() const noexcept;
+
+        /**
+         * Get the size of the decrypted shader data in the output, once the job succeeded
+         * @return  size in bytes
+         */
+        std::size_t output_size() const noexcept;
+
+        /**
+         * Get how much of the data was decrypted, also after a cancellation or a deadline
+         * @return  fraction from 0 to 1
+         */
+        double progress() const noexcept;
+
+    private:
+        char const *input;
+        char *output;
+        std::size_t size;
+        Key key;
+        MD5 md5;
+
+        /** Next full block to decrypt */
+        std::size_t next_block = 0;
+
+        /** Bytes of shader data hashed so far */
+        std::size_t hashed = 0;
+
+        bool tail_done = false;
+        bool done = false;
+        Result outcome;
+
+        std::atomic<bool> cancelled{false};
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+
+        void finish(Result result) noexcept;
+        void check_trailer() noexcept;
+    };
+}
+
+#endif
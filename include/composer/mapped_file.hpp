@@ -0,0 +1,53 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef COMPOSER__MAPPED_FILE_HPP
+#define COMPOSER__MAPPED_FILE_HPP
+
+#include <cstddef>
+#include <filesystem>
+#include <composer/buffer.hpp>
+#include <composer/result.hpp>
+
+namespace Composer {
+    /**
+     * Read-only view of a whole file, memory mapped where the platform supports it
+     */
+    class MappedFile {
+    public:
+        MappedFile() noexcept = default;
+        MappedFile(MappedFile &&other) noexcept;
+        MappedFile &operator=(MappedFile &&other) noexcept;
+        MappedFile(MappedFile const &) = delete;
+        MappedFile &operator=(MappedFile const &) = delete;
+        ~MappedFile();
+
+        /**
+         * Map a file, replacing the current one
+         * @param filepath  path to the file
+         * @return          result of the operation
+         */
+        Result open(std::filesystem::path const &filepath) noexcept;
+
+        /**
+         * Unmap the file
+         */
+        void close() noexcept;
+
+        char const *data() const noexcept {
+            return this->memory;
+        }
+
+        std::size_t size() const noexcept {
+            return this->length;
+        }
+
+    private:
+        char const *memory = nullptr;
+        std::size_t length = 0;
+
+        /** Fallback storage where files can't be mapped */
+        Buffer buffer;
+    };
+}
+
+#endif
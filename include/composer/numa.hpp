@@ -0,0 +1,90 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef COMPOSER__NUMA_HPP
+#define COMPOSER__NUMA_HPP
+
+#include <cstddef>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <composer/result.hpp>
+
+namespace Composer {
+    /**
+     * NUMA node and the CPUs on it
+     */
+    struct NumaNode {
+        /** Node number, as the kernel knows it */
+        std::size_t id = 0;
+
+        std::vector<unsigned> cpus;
+    };
+
+    /**
+     * NUMA layout of the machine
+     */
+    struct NumaTopology {
+        std::vector<NumaNode> nodes;
+
+        /**
+         * Check if there is more than one node, so placement matters
+         * @return  true if there are several nodes
+         */
+        bool is_numa() const noexcept {
+            return this->nodes.size() > 1;
+        }
+    };
+
+    /** Node of a thread that isn't bound to one */
+    constexpr const std::size_t no_numa_node = static_cast<std::size_t>(-1);
+
+    /**
+     * Parse a Linux CPU list such as "0-3,8-11"
+     * @param text  CPU list
+     * @param cpus  set to the CPUs
+     * @return      true if valid
+     */
+    bool parse_cpu_list(std::string const &text, std::vector<unsigned> &cpus) noexcept;
+
+    /**
+     * Parse a topology written as the CPU lists of nodes 0, 1... separated by '/', e.g.
+     * "0-3/4-7" for two nodes of four CPUs
+     * @param text      topology
+     * @param topology  set to the topology
+     * @return          true if valid
+     */
+    bool parse_numa_topology(std::string const &text, NumaTopology &topology) noexcept;
+
+    /**
+     * Read the topology from sysfs; nodes without CPUs are left out
+     * @param topology  set to the topology
+     * @param root      node directory, with a nodeN/cpulist file per node
+     * @return          result of the operation
+     */
+    Result read_numa_topology(NumaTopology &topology, std::filesystem::path const &root = "/sys/devices/system/node") noexcept;
+
+    /**
+     * Get the topology of the machine, read once.
+     *
+     * The COMPOSER_NUMA_TOPOLOGY environment variable replaces it with a fake one in the
+     * parse_numa_topology format, or disables NUMA placement if set to "off".
+     *
+     * @return  topology, a single node (or none) on machines without NUMA
+     */
+    NumaTopology const &system_numa_topology();
+
+    /**
+     * Pin the calling thread to the CPUs of a node, and have the memory it faults in allocated there
+     * @param node  node
+     * @return      true if the thread was pinned; the node is remembered either way
+     */
+    bool bind_thread_to_numa_node(NumaNode const &node) noexcept;
+
+    /**
+     * Get the node the calling thread was bound to
+     * @return  node number, or no_numa_node
+     */
+    std::size_t current_numa_node() noexcept;
+}
+
+#endif
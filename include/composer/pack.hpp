@@ -0,0 +1,164 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef COMPOSER__PACK_HPP
+#define COMPOSER__PACK_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <composer/mapped_file.hpp>
+#include <composer/result.hpp>
+
+/*
+ * Shader pack layout, all integers little endian:
+ *
+ *   header     magic "CMPK", u32 version, u32 entry count, u32 reserved,
+ *              u64 index offset, u64 names offset
+ *   data       entries in encrypt_shader format, back to back
+ *   index      per entry, sorted by name: u32 name offset, u32 name size,
+ *              u64 data offset, u64 data size, 16 bytes plaintext MD5
+ *   names      entry names, not null terminated
+ */
+
+namespace Composer {
+    /**
+     * Entry of a shader pack
+     */
+    struct PackEntry {
+        /** Entry name, points into the pack */
+        std::string_view name;
+
+        /** Offset of the encrypted data from the start of the pack */
+        std::uint64_t offset;
+
+        /** Size of the encrypted data */
+        std::uint64_t size;
+
+        /** Raw MD5 hash of the shader data */
+        unsigned char checksum[16];
+    };
+
+    /**
+     * Builds a shader pack file
+     */
+    class PackWriter {
+    public:
+        /**
+         * Create the pack file
+         * @param filepath  path to the pack file
+         * @return          result of the operation
+         */
+        Result open(std::filesystem::path const &filepath) noexcept;
+
+        /**
+         * Encrypt shader data and add it to the pack
+         * @param name          entry name
+         * @param shader_data   shader data
+         * @param size          size of the shader data
+         * @return              result of the operation
+         */
+        Result add_shader(std::string const &name, char const *shader_data, std::size_t size) noexcept;
+
+        /**
+         * Validate already encrypted shader data and add it to the pack
+         * @param name                      entry name
+         * @param encrypted_shader_data     encrypted shader data
+         * @param size                      size of the encrypted shader data
+         * @return                          result of the operation
+         */
+        Result add_encrypted_shader(std::string const &name, char const *encrypted_shader_data, std::size_t size) noexcept;
+
+        /**
+         * Write the index and close the pack file
+         * @return  result of the operation
+         */
+        Result finish() noexcept;
+
+    private:
+        struct Entry {
+            std::string name;
+            std::uint64_t offset;
+            std::uint64_t size;
+            unsigned char checksum[16];
+        };
+
+        Result add_entry(std::string const &name, char const *encrypted_shader_data, std::size_t size, char const *trailer) noexcept;
+
+        std::ofstream file;
+        std::uint64_t offset = 0;
+        std::vector<Entry> entries;
+    };
+
+    /**
+     * Reads a memory mapped shader pack
+     */
+    class PackReader {
+    public:
+        /**
+         * Map a pack file and validate its index
+         * @param filepath  path to the pack file
+         * @return          result of the operation
+         */
+        Result open(std::filesystem::path const &filepath) noexcept;
+
+        /**
+         * Get the number of entries
+         */
+        std::size_t entry_count() const noexcept {
+            return this->count;
+        }
+
+        /**
+         * Get an entry by position, entries are sorted by name
+         * @param index     entry position
+         * @return          entry
+         */
+        PackEntry entry(std::size_t index) const noexcept;
+
+        /**
+         * Look up an entry by name
+         * @param name      entry name
+         * @param entry     set to the entry if found
+         * @return          true if found
+         */
+        bool find(std::string_view name, PackEntry &entry) const noexcept;
+
+        /**
+         * Get the encrypted data of an entry
+         * @param entry     entry
+         * @return          pointer into the mapped pack
+         */
+        char const *data(PackEntry const &entry) const noexcept {
+            return this->file.data() + entry.offset;
+        }
+
+        /**
+         * Decrypt an entry without throwing
+         * @param entry         entry
+         * @param output        buffer of at least `entry.size` bytes
+         * @param output_size   set to the shader data size on success
+         * @return              result of the operation
+         */
+        Result try_decrypt(PackEntry const &entry, char *output, std::size_t &output_size) const noexcept;
+
+        /**
+         * Decrypt an entry by name
+         * @param name  entry name
+         * @return      shader data
+         */
+        std::vector<char> decrypt(std::string_view name) const;
+
+    private:
+        MappedFile file;
+        char const *index = nullptr;
+        char const *names = nullptr;
+        std::size_t names_size = 0;
+        std::size_t count = 0;
+    };
+}
+
+#endif
@@ -0,0 +1,120 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef COMPOSER__PROFILE_HPP
+#define COMPOSER__PROFILE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <composer/buffer.hpp>
+#include <composer/file.hpp>
+#include <composer/result.hpp>
+#include <composer/xtea.hpp>
+#include <hash-library/md5.h>
+
+/*
+ * Machine profile written by composer-tune, tab separated text:
+ *
+ *   # composer profile 1
+ *   cipher              <cipher backend name>
+ *   md5                 <MD5 kernel name>
+ *   alloc               <allocation policy name>
+ *   pipeline-threshold  <file size from which the pipelined mode is used, 0 for never>
+ *   chunk-size          <pipeline chunk size>
+ *   chunk-count         <pipeline chunks in flight>
+ *   threads             <worker threads, 0 for one per hardware thread>
+ *
+ * Lines may come in any order and missing ones keep their default, so older profiles still load.
+ */
+
+namespace Composer {
+    /**
+     * Fastest configuration measured on a machine
+     */
+    struct Profile {
+        CipherBackend cipher_backend = CipherBackend::automatic;
+        MD5::Kernel md5_kernel = MD5::Auto;
+        AllocationPolicy allocation_policy = AllocationPolicy::standard;
+
+        /** Files at least this large are processed with the pipelined mode, 0 to never use it */
+        std::uint64_t pipeline_threshold = 0;
+
+        PipelineOptions pipeline;
+
+        /** Worker threads of the pools, 0 for one per hardware thread */
+        std::size_t thread_count = 0;
+    };
+
+    /**
+     * Get the path of the machine profile: $COMPOSER_PROFILE if set, else composer/profile in
+     * $XDG_CONFIG_HOME or ~/.config
+     * @return  path, empty if there is none (e.g. COMPOSER_PROFILE set to an empty string)
+     */
+    std::filesystem::path default_profile_path();
+
+    /**
+     * Read a profile file, see the layout above
+     * @param filepath  path to the profile
+     * @param profile   set to the profile
+     * @return          result of the operation
+     */
+    Result read_profile(std::filesystem::path const &filepath, Profile &profile) noexcept;
+
+    /**
+     * Write a profile file, see the layout above
+     * @param filepath  path to the profile
+     * @param profile   profile
+     * @return          result of the operation
+     */
+    Result write_profile(std::filesystem::path const &filepath, Profile const &profile) noexcept;
+
+    /**
+     * Make a profile the active one and select its cipher backend, MD5 kernel and allocation
+     * policy for the whole process; settings the CPU doesn't support are left as they are
+     * @param profile   profile
+     */
+    void apply_profile(Profile const &profile) noexcept;
+
+    /**
+     * Get the profile applied last, the defaults if none was
+     * @return  profile
+     */
+    Profile active_profile() noexcept;
+
+    /**
+     * Read the machine profile from default_profile_path() once per process, without applying it;
+     * later calls return the first result and profile without reading it again
+     * @param profile   set to the profile, the defaults if it could not be read
+     * @return          result of the first read, file_not_found if there is no profile
+     */
+    Result read_machine_profile(Profile &profile) noexcept;
+
+    /**
+     * Read and apply the machine profile from default_profile_path(), once per process; later
+     * calls return the first result without applying it again.
+     *
+     * This changes process-wide settings, so it is for tools; the library itself only reads the
+     * pipeline settings of the profile (see encrypt_shader_file).
+     *
+     * @return  result of the first call, file_not_found if there is no profile
+     */
+    Result load_profile() noexcept;
+
+    /**
+     * Get the name of an MD5 kernel: auto, portable, bmi or avx512
+     * @param kernel    kernel
+     * @return          name
+     */
+    const char *md5_kernel_name(MD5::Kernel kernel) noexcept;
+
+    /**
+     * Parse an MD5 kernel name, see md5_kernel_name
+     * @param name      kernel name
+     * @param kernel    set to the parsed kernel
+     * @return          true if the name is valid
+     */
+    bool parse_md5_kernel(std::string const &name, MD5::Kernel &kernel) noexcept;
+}
+
+#endif
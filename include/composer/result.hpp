@@ -0,0 +1,59 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef COMPOSER__RESULT_HPP
+#define COMPOSER__RESULT_HPP
+
+#include <cstdint>
+
+namespace Composer {
+    /**
+     * Status codes reported by the non-throwing API
+     */
+    enum class Status : std::uint8_t {
+        ok = 0,
+        data_too_small,
+        checksum_failed,
+        not_null_terminated,
+        out_of_memory,
+        file_not_found,
+        read_failed,
+        write_failed,
+        invalid_pack,
+        entry_not_found,
+        duplicate_entry,
+        key_not_found,
+        not_supported,
+        invalid_report,
+        invalid_profile,
+        invalid_archive,
+        cancelled,
+        deadline_exceeded,
+        skipped,
+        thread_failed,
+        output_conflict
+    };
+
+    /**
+     * Outcome of a non-throwing operation
+     */
+    struct Result {
+        /** Status code */
+        Status status = Status::ok;
+
+        /** errno value of a failed I/O operation or thread start, 0 otherwise */
+        int error_number = 0;
+
+        constexpr explicit operator bool() const noexcept {
+            return status == Status::ok;
+        }
+    };
+
+    /**
+     * Get a description of a status code
+     * @param status    status code
+     * @return          static null-terminated message
+     */
+    const char *status_message(Status status) noexcept;
+}
+
+#endif
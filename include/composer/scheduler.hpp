@@ -0,0 +1,102 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef COMPOSER__SCHEDULER_HPP
+#define COMPOSER__SCHEDULER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+#include <composer/result.hpp>
+#include <composer/worker_pool.hpp>
+#include <composer/xtea.hpp>
+
+namespace Composer {
+    /**
+     * Operation applied to every file of a batch
+     */
+    enum class Operation : std::uint8_t {
+        encrypt = 0,
+        decrypt
+    };
+
+    /**
+     * Order files of a batch are started in
+     */
+    enum class TaskOrder : std::uint8_t {
+        /** Largest first, best for warm caches and fast storage */
+        largest_first = 0,
+
+        /** As they lie on disk, so cold reads don't seek back and forth */
+        physical
+    };
+
+    /**
+     * One file of a batch
+     */
+    struct ShaderTask {
+        std::filesystem::path input_file;
+        std::filesystem::path output_file;
+
+        /** Size of the input in bytes, used for ordering and memory accounting */
+        std::uint64_t size = 0;
+
+        /** Set once the task ran */
+        Result result;
+    };
+
+    /**
+     * Settings of run_shader_tasks
+     */
+    struct SchedulerOptions {
+        /**
+         * Cap on the file data in memory: the buffers of running tasks, plus those the threads
+         * keep for reuse, which get a quarter of it. A file larger than the rest runs alone.
+         */
+        std::uint64_t max_bytes_in_flight = std::uint64_t(256) << 20;
+
+        /** Files at least this large have their cipher work split over the pool */
+        std::uint64_t split_size = std::uint64_t(16) << 20;
+
+        /** Size of each piece of a split file, rounded up to a multiple of 8 */
+        std::size_t segment_size = 1 << 20;
+
+        /** Order files are started in */
+        TaskOrder order = TaskOrder::largest_first;
+
+        /** Bytes of input asked into the page cache ahead of the workers, 0 to not prefetch */
+        std::uint64_t prefetch_window = 0;
+
+        /** Bytes of input between calls to sync_outputs while running, 0 to not sync */
+        std::uint64_t checkpoint_bytes = 0;
+    };
+
+    /**
+     * Encrypt or decrypt files on a worker pool with bounded memory.
+     *
+     * By default files are started largest first (longest processing time first) so big ones don't finish
+     * last alone, and a file is only started once its buffer fits in max_bytes_in_flight. Threads
+     * keep their buffer for the next small file only while it is within their share of the cap, so
+     * retained and running buffers together stay under it. Files of split_size or more are cut
+     * into segments processed in parallel by the whole pool while the owning thread hashes them
+     * in order.
+     *
+     * With TaskOrder::physical files are started in the order of their first extent on disk (from
+     * FIEMAP, or by inode number where that isn't available) instead. A prefetch_window makes a
+     * thread advise the kernel to read the next files that far ahead of the workers.
+     *
+     * Outputs are replaced atomically but not flushed; with checkpoint_bytes the outputs written
+     * so far are synced every time that much more input was processed. Callers wanting every
+     * output durable call sync_outputs once done.
+     *
+     * @param tasks     files to process, each result is set
+     * @param operation operation
+     * @param pool      pool running the tasks
+     * @param options   settings
+     * @param key       key
+     * @return          true if every task succeeded
+     */
+    bool run_shader_tasks(std::vector<ShaderTask> &tasks, Operation operation, WorkerPool &pool, SchedulerOptions const &options = SchedulerOptions(), Key const &key = default_key);
+}
+
+#endif
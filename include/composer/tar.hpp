@@ -0,0 +1,58 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef COMPOSER__TAR_HPP
+#define COMPOSER__TAR_HPP
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <composer/result.hpp>
+#include <composer/scheduler.hpp>
+#include <composer/worker_pool.hpp>
+#include <composer/xtea.hpp>
+
+namespace Composer {
+    /**
+     * Settings of transform_tar_stream
+     */
+    struct TarStreamOptions {
+        /** Cap on the entry data held in memory at once; a larger entry is processed alone */
+        std::uint64_t max_bytes_in_flight = std::uint64_t(256) << 20;
+    };
+
+    /**
+     * What transform_tar_stream did
+     */
+    struct TarStreamStats {
+        /** Entries copied to the output, extended headers not counted */
+        std::uint64_t entries = 0;
+
+        /** Regular files encrypted or decrypted */
+        std::uint64_t files = 0;
+
+        /** Name of the entry that failed, empty if none did */
+        std::string failed_entry;
+    };
+
+    /**
+     * Encrypt or decrypt every regular file of a tar stream, writing another tar stream.
+     *
+     * Entries keep their order, names and metadata; only the sizes of regular files change
+     * (including pax size records and GNU base-256 sizes). Files are transformed in parallel on
+     * the pool while the stream is read and written in order, holding at most max_bytes_in_flight
+     * of entry data. Nothing is written to disk. The first failing file stops the stream.
+     *
+     * @param input     tar stream (ustar, pax or GNU)
+     * @param output    transformed tar stream
+     * @param operation operation applied to the regular files
+     * @param pool      pool running the transformations
+     * @param options   settings
+     * @param stats     set to what was done
+     * @param key       key
+     * @return          result of the operation; invalid_archive if the input isn't a tar stream
+     */
+    Result transform_tar_stream(std::istream &input, std::ostream &output, Operation operation, WorkerPool &pool, TarStreamOptions const &options, TarStreamStats &stats, Key const &key = default_key);
+}
+
+#endif
@@ -0,0 +1,55 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef COMPOSER__WATCH_HPP
+#define COMPOSER__WATCH_HPP
+
+#include <chrono>
+#include <filesystem>
+#include <unordered_map>
+#include <vector>
+#include <composer/result.hpp>
+
+namespace Composer {
+    /**
+     * Reports files written in a directory tree (inotify, Linux only)
+     */
+    class DirectoryWatcher {
+    public:
+        DirectoryWatcher() noexcept = default;
+        DirectoryWatcher(DirectoryWatcher const &) = delete;
+        DirectoryWatcher &operator=(DirectoryWatcher const &) = delete;
+        ~DirectoryWatcher();
+
+        /**
+         * Start watching a directory and its subdirectories, including ones created later
+         * @param directory     path to the directory
+         * @return              result of the operation, not_supported without inotify
+         */
+        Result open(std::filesystem::path const &directory) noexcept;
+
+        /**
+         * Stop watching
+         */
+        void close() noexcept;
+
+        /**
+         * Block until files are closed after writing or moved into the tree, then keep collecting
+         * until no event arrives for `debounce`, so a burst of writes is reported once. The temporary
+         * files the library writes outputs to before moving them into place are not reported.
+         * @param files     set to the written files still present at the end of the burst, without duplicates
+         * @param debounce  quiet period ending the burst
+         * @return          result of the operation
+         */
+        Result wait(std::vector<std::filesystem::path> &files, std::chrono::milliseconds debounce) noexcept;
+
+    private:
+        bool add_directory(std::filesystem::path const &directory) noexcept;
+
+        int descriptor = -1;
+
+        /** Watched directories by watch descriptor */
+        std::unordered_map<int, std::filesystem::path> directories;
+    };
+}
+
+#endif
@@ -0,0 +1,140 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef COMPOSER__WORKER_POOL_HPP
+#define COMPOSER__WORKER_POOL_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <composer/numa.hpp>
+
+namespace Composer {
+    /**
+     * Fixed set of threads running jobs in submission order.
+     *
+     * On NUMA machines the threads are split over the nodes and pinned to them, each node has its
+     * own queue run in order, and a thread only takes jobs from another node's queue when its own
+     * is empty. The buffers a pinned thread allocates and fills come from its node.
+     */
+    class WorkerPool {
+    public:
+        /**
+         * Start the threads, placed on the NUMA nodes of the machine if it has several
+         * @param thread_count  number of threads, 0 for one per hardware thread
+         * @throws std::system_error if a thread can't be started; those already started are stopped
+         */
+        explicit WorkerPool(std::size_t thread_count = 0);
+
+        /**
+         * Start the threads, placed on the nodes of a topology if it has several
+         * @param thread_count  number of threads, 0 for one per hardware thread
+         * @param topology      topology, e.g. a fake one from parse_numa_topology
+         * @throws std::system_error if a thread can't be started; those already started are stopped
+         */
+        WorkerPool(std::size_t thread_count, NumaTopology const &topology);
+
+        WorkerPool(WorkerPool const &) = delete;
+        WorkerPool &operator=(WorkerPool const &) = delete;
+
+        /**
+         * Finish every submitted job and stop the threads
+         */
+        ~WorkerPool();
+
+        /**
+         * Queue a job; jobs must not throw
+         * @param job   job to run on one of the threads
+         */
+        void submit(std::function<void()> job);
+
+        /**
+         * Queue a job for the threads of a node; jobs must not throw
+         * @param job   job to run on one of the threads
+         * @param node  index of the node in the topology, wrapped around
+         */
+        void submit(std::function<void()> job, std::size_t node);
+
+        /**
+         * Block until every submitted job has finished
+         */
+        void wait();
+
+        /**
+         * Run work(0) to work(count - 1) on the pool and return once they are done.
+         *
+         * The calling thread takes part instead of only waiting, so this also works from a job of
+         * the same pool, and only waits for the items this call started rather than every job.
+         *
+         * @param count     number of items
+         * @param work      work of an item; must not throw
+         */
+        void parallel_for(std::size_t count, std::function<void(std::size_t)> work);
+
+        /**
+         * Get the number of threads
+         * @return  number of threads
+         */
+        std::size_t size() const noexcept {
+            return this->threads.size();
+        }
+
+        /**
+         * Get the number of nodes with their own queue
+         * @return  number of nodes, 1 without NUMA placement
+         */
+        std::size_t node_count() const noexcept {
+            return this->queues.size();
+        }
+
+    private:
+        /**
+         * Jobs and threads of one node
+         */
+        struct NodeQueue {
+            NumaNode node;
+            std::deque<std::function<void()>> jobs;
+            std::condition_variable job_available;
+
+            /** Threads waiting for a job, and wakeups handed to them */
+            std::size_t waiting = 0;
+            std::size_t wakeups = 0;
+        };
+
+        void start(std::size_t thread_count, NumaTopology const &topology);
+
+        /**
+         * Let the threads finish the queued jobs and join them
+         */
+        void stop() noexcept;
+
+        /**
+         * Queue a job, with the mutex held
+         */
+        void enqueue(std::function<void()> job, std::size_t node);
+        void work(std::size_t queue_index);
+
+        std::vector<std::thread> threads;
+        std::deque<NodeQueue> queues;
+        std::size_t queued = 0;
+        std::size_t next_queue = 0;
+        std::size_t running = 0;
+        bool pinned = false;
+        bool stopping = false;
+        std::mutex mutex;
+        std::condition_variable idle;
+    };
+
+    /**
+     * Get the pool library calls use when they aren't given one, started on first use with one
+     * thread per hardware thread
+     * @return  pool
+     * @throws std::system_error if its threads can't be started; the next call tries again
+     */
+    WorkerPool &shared_worker_pool();
+}
+
+#endif
@@ -0,0 +1,122 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef COMPOSER__XTEA_HPP
+#define COMPOSER__XTEA_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace Composer {
+    /**
+     * XTEA key
+     */
+    struct Key {
+        std::uint32_t words[4];
+    };
+
+    /**
+     * Key used by Halo Custom Edition
+     */
+    constexpr Key default_key = {{ 0x3FFFEF, 0xE5, 0x3FFFFFDD, 0x7FC3 }};
+
+    /**
+     * Number of blocks processed side by side by the vector kernels
+     */
+    constexpr std::size_t key_lanes = 8;
+
+    /**
+     * Block cipher implementations
+     */
+    enum class CipherBackend : std::uint8_t {
+        /** Fastest one supported by the CPU */
+        automatic = 0,
+
+        /** One block at a time */
+        scalar,
+
+        /** 8 blocks at a time with portable vector extensions */
+        vector,
+
+        /** 8 blocks at a time in AVX2 registers */
+        avx2
+    };
+
+    /**
+     * Select the block cipher implementation for the whole process
+     * @param backend   implementation
+     * @return          false if the CPU or the compiler doesn't support it
+     */
+    bool set_cipher_backend(CipherBackend backend) noexcept;
+
+    /**
+     * Get the block cipher implementation in use, never automatic
+     * @return  implementation
+     */
+    CipherBackend cipher_backend() noexcept;
+
+    /**
+     * Check if a block cipher implementation can be used
+     * @param backend   implementation
+     * @return          true if supported
+     */
+    bool cipher_backend_supported(CipherBackend backend) noexcept;
+
+    /**
+     * Get the name of a block cipher implementation: automatic, scalar, vector or avx2
+     * @param backend   implementation
+     * @return          name
+     */
+    const char *cipher_backend_name(CipherBackend backend) noexcept;
+
+    /**
+     * Parse a block cipher implementation name, see cipher_backend_name
+     * @param name      implementation name
+     * @param backend   set to the parsed implementation
+     * @return          true if the name is valid
+     */
+    bool parse_cipher_backend(std::string const &name, CipherBackend &backend) noexcept;
+
+    /**
+     * Parse a key written as four hex words separated by colons, e.g. "3fffef:e5:3fffffdd:7fc3"
+     * @param text  key text
+     * @param key   set to the parsed key
+     * @return      true if the text is valid
+     */
+    bool parse_key(std::string const &text, Key &key) noexcept;
+
+    /**
+     * Read a key table: one key per line as accepted by parse_key, empty lines and lines starting with # are skipped
+     * @param filepath  path to the key table
+     * @param keys      set to the keys
+     * @return          false if the file can't be read or a line is invalid
+     */
+    bool read_key_table(std::filesystem::path const &filepath, std::vector<Key> &keys);
+
+    /**
+     * Encrypt consecutive 8-byte blocks in place
+     * @param data          first block
+     * @param block_count   number of blocks
+     * @param key           key
+     */
+    void encrypt_blocks(char *data, std::size_t block_count, Key const &key = default_key) noexcept;
+
+    /**
+     * Decrypt consecutive 8-byte blocks in place
+     * @param data          first block
+     * @param block_count   number of blocks
+     * @param key           key
+     */
+    void decrypt_blocks(char *data, std::size_t block_count, Key const &key = default_key) noexcept;
+
+    /**
+     * Decrypt `key_lanes` consecutive blocks in place, each one with its own key
+     * @param blocks    first block
+     * @param keys      one key per block
+     */
+    void decrypt_blocks_with_keys(char *blocks, Key const *keys) noexcept;
+}
+
+#endif
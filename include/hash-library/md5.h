@@ -59,6 +59,16 @@ public:
   /// restart
   void reset();
 
+  /// implementations of the compression function
+  enum Kernel { Auto, Portable, Bmi, Avx512 };
+
+  /// select compression function for all instances, false if the CPU can't run it
+  static bool setKernel(Kernel kernel);
+  /// compression function currently in use (never Auto)
+  static Kernel getKernel();
+  /// true if the CPU can run this compression function
+  static bool isSupported(Kernel kernel);
+
 private:
   /// process 64 bytes
   void processBlock(const void* data);
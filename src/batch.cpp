@@ -0,0 +1,324 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <filesystem>
+#include <composer/batch.hpp>
+#include <composer/classify.hpp>
+#include <composer/dedup.hpp>
+#include <composer/file.hpp>
+#include <composer/profile.hpp>
+#include <composer/scheduler.hpp>
+#include <composer/worker_pool.hpp>
+#include <composer/xtea.hpp>
+#include <cmdline/cmdline.h>
+
+static void fail(std::string const &message, Composer::Result result) {
+    std::cerr << message << ": " << Composer::status_message(result.status);
+    if(result.error_number) {
+        std::cerr << " (" << std::strerror(result.error_number) << ")";
+    }
+    std::cerr << std::endl;
+    std::exit(1);
+}
+
+static int run_batch(bool encrypt, std::filesystem::path const &input_directory, cmdline::parser const &options) {
+    std::size_t shard_index = 0;
+    std::size_t shard_count = 1;
+    if(options.exist("shard") && !Composer::parse_shard(options.get<std::string>("shard"), shard_index, shard_count)) {
+        std::cout << "invalid shard: " << options.get<std::string>("shard") << std::endl;
+        std::exit(1);
+    }
+
+    Composer::Key key = Composer::default_key;
+    if(options.exist("key") && !Composer::parse_key(options.get<std::string>("key"), key)) {
+        std::cout << "invalid key: " << options.get<std::string>("key") << std::endl;
+        std::exit(1);
+    }
+
+    Composer::TaskOrder order = Composer::TaskOrder::largest_first;
+    if(options.get<std::string>("order") == "physical") {
+        order = Composer::TaskOrder::physical;
+    }
+    else if(options.get<std::string>("order") != "largest") {
+        std::cout << "invalid order: " << options.get<std::string>("order") << std::endl;
+        std::exit(1);
+    }
+
+    std::filesystem::path output_directory = options.get<std::string>("output");
+
+    std::vector<Composer::BatchFile> files;
+    auto result = Composer::list_batch_files(input_directory, files);
+    if(!result) {
+        fail("failed to list " + input_directory.string(), result);
+    }
+
+    Composer::BatchReport report;
+    report.shard_index = shard_index;
+    report.shard_count = shard_count;
+    report.tree_hash = Composer::batch_tree_hash(files);
+    report.tree_files = files.size();
+
+    auto shards = Composer::assign_shards(files, shard_count);
+    for(std::size_t i = 0; i < files.size(); i++) {
+        if(shards[i] == shard_index) {
+            report.records.push_back({ files[i].path, files[i].size, Composer::Status::ok });
+        }
+    }
+
+    // Output directories are made up front so the workers only do file operations
+    for(auto const &record : report.records) {
+        std::error_code ec;
+        std::filesystem::create_directories((output_directory / record.path).parent_path(), ec);
+    }
+
+    std::size_t jobs = static_cast<std::size_t>(std::max(options.get<int>("jobs"), 0));
+    Composer::WorkerPool pool(jobs ? jobs : Composer::active_profile().thread_count);
+
+    // Look at a few blocks of each file and leave out the ones not in the expected form
+    std::vector<char> selected(report.records.size(), true);
+    if(options.exist("classify")) {
+        auto expected = encrypt ? Composer::ShaderKind::plaintext : Composer::ShaderKind::encrypted;
+        for(std::size_t i = 0; i < report.records.size(); i++) {
+            pool.submit([&, i]() {
+                Composer::ShaderClassification classification;
+                auto result = Composer::try_classify_shader_file(input_directory / report.records[i].path, classification, key);
+                selected[i] = !result || classification.kind == expected;
+            });
+        }
+        pool.wait();
+    }
+
+    auto output_path = [&](Composer::BatchRecord const &record) {
+        auto output_file = output_directory / record.path;
+        output_file.replace_extension(encrypt ? ".enc" : ".bin");
+        return output_file;
+    };
+
+    // Inputs that differ only in their extension have the same output; whichever ran last would
+    // silently replace the others, so none of them is written
+    std::size_t failures = 0;
+    std::map<std::filesystem::path, std::vector<std::size_t>> outputs;
+    for(std::size_t i = 0; i < report.records.size(); i++) {
+        if(selected[i]) {
+            outputs[output_path(report.records[i])].push_back(i);
+        }
+    }
+    for(auto const &[output_file, records] : outputs) {
+        if(records.size() < 2) {
+            continue;
+        }
+        for(auto i : records) {
+            report.records[i].status = Composer::Status::output_conflict;
+            std::cerr << "failed to " << (encrypt ? "encrypt " : "decrypt ") << input_directory / report.records[i].path << ": " << Composer::status_message(Composer::Status::output_conflict) << " " << output_file << std::endl;
+            failures++;
+        }
+    }
+
+    std::vector<std::size_t> candidates;
+    for(std::size_t i = 0; i < report.records.size(); i++) {
+        if(!selected[i]) {
+            report.records[i].status = Composer::Status::skipped;
+            continue;
+        }
+        if(report.records[i].status == Composer::Status::output_conflict) {
+            continue;
+        }
+        candidates.push_back(i);
+    }
+
+    // The cipher is deterministic, so identical inputs are processed once and the outputs cloned
+    std::vector<std::size_t> originals(candidates.size());
+    if(options.exist("dedup")) {
+        std::vector<std::filesystem::path> candidate_files(candidates.size());
+        std::vector<std::uint64_t> candidate_sizes(candidates.size());
+        for(std::size_t i = 0; i < candidates.size(); i++) {
+            candidate_files[i] = input_directory / report.records[candidates[i]].path;
+            candidate_sizes[i] = report.records[candidates[i]].size;
+        }
+        originals = Composer::find_duplicate_files(candidate_files, candidate_sizes, pool);
+    }
+    else {
+        for(std::size_t i = 0; i < candidates.size(); i++) {
+            originals[i] = i;
+        }
+    }
+
+    std::vector<Composer::ShaderTask> tasks;
+    std::vector<std::size_t> task_records;
+    std::vector<std::size_t> candidate_tasks(candidates.size());
+    tasks.reserve(candidates.size());
+    for(std::size_t i = 0; i < candidates.size(); i++) {
+        if(originals[i] != i) {
+            continue;
+        }
+
+        auto const &record = report.records[candidates[i]];
+        Composer::ShaderTask task;
+        task.input_file = input_directory / record.path;
+        task.output_file = output_path(record);
+        task.size = record.size;
+        candidate_tasks[i] = tasks.size();
+        tasks.push_back(std::move(task));
+        task_records.push_back(candidates[i]);
+    }
+
+    Composer::SchedulerOptions scheduler_options;
+    scheduler_options.max_bytes_in_flight = static_cast<std::uint64_t>(std::max(options.get<int>("max-memory"), 1)) << 20;
+    scheduler_options.split_size = static_cast<std::uint64_t>(std::max(options.get<int>("split"), 1)) << 20;
+    scheduler_options.order = order;
+    scheduler_options.prefetch_window = static_cast<std::uint64_t>(std::max(options.get<int>("prefetch"), 0)) << 20;
+    scheduler_options.checkpoint_bytes = static_cast<std::uint64_t>(std::max(options.get<int>("checkpoint"), 0)) << 20;
+
+    Composer::run_shader_tasks(tasks, encrypt ? Composer::Operation::encrypt : Composer::Operation::decrypt, pool, scheduler_options, key);
+
+    for(std::size_t i = 0; i < tasks.size(); i++) {
+        report.records[task_records[i]].status = tasks[i].result.status;
+        if(!tasks[i].result) {
+            std::cerr << "failed to " << (encrypt ? "encrypt " : "decrypt ") << tasks[i].input_file << ": " << Composer::status_message(tasks[i].result.status) << std::endl;
+            failures++;
+        }
+    }
+
+    // Duplicates share the outcome of their original
+    std::vector<Composer::Result> clone_results(candidates.size());
+    std::vector<Composer::CloneMethod> clone_methods(candidates.size(), Composer::CloneMethod::copy);
+    for(std::size_t i = 0; i < candidates.size(); i++) {
+        std::size_t task_index = candidate_tasks[originals[i]];
+        if(originals[i] == i || !tasks[task_index].result) {
+            continue;
+        }
+        pool.submit([&, i, task_index]() {
+            clone_results[i] = Composer::clone_file(tasks[task_index].output_file, output_path(report.records[candidates[i]]), clone_methods[i]);
+        });
+    }
+    pool.wait();
+
+    std::size_t clone_counts[3] = {};
+    for(std::size_t i = 0; i < candidates.size(); i++) {
+        if(originals[i] == i) {
+            continue;
+        }
+
+        auto const &original = tasks[candidate_tasks[originals[i]]];
+        auto &record = report.records[candidates[i]];
+        record.status = original.result ? clone_results[i].status : original.result.status;
+        if(original.result && clone_results[i]) {
+            clone_counts[static_cast<std::size_t>(clone_methods[i])]++;
+        }
+        else {
+            std::cerr << "failed to " << (encrypt ? "encrypt " : "decrypt ") << input_directory / record.path << ": " << Composer::status_message(record.status) << std::endl;
+            failures++;
+        }
+    }
+
+    // Outputs are only renamed into place; flush them all at once instead of one by one
+    if(!options.exist("no-sync")) {
+        result = Composer::sync_outputs();
+        if(!result) {
+            fail("failed to sync " + output_directory.string(), result);
+        }
+    }
+
+    if(options.exist("report")) {
+        result = Composer::write_batch_report(options.get<std::string>("report"), report);
+        if(!result) {
+            fail("failed to write " + options.get<std::string>("report"), result);
+        }
+    }
+
+    auto skipped = static_cast<std::size_t>(std::count(selected.begin(), selected.end(), false));
+    std::cout << (encrypt ? "encrypted " : "decrypted ") << report.records.size() - skipped - failures << " of " << report.records.size() << " shader files";
+    if(skipped) {
+        std::cout << ", " << skipped << " skipped";
+    }
+    std::cout << " (shard " << shard_index << "/" << shard_count << ")" << std::endl;
+    if(clone_counts[0] + clone_counts[1] + clone_counts[2]) {
+        std::cout << clone_counts[0] + clone_counts[1] + clone_counts[2] << " duplicates cloned: " << clone_counts[0] << " reflinks, " << clone_counts[1] << " hardlinks, " << clone_counts[2] << " copies" << std::endl;
+    }
+    return failures ? 1 : 0;
+}
+
+static int merge_reports(std::vector<std::string> const &report_files, cmdline::parser const &options) {
+    std::vector<Composer::BatchReport> reports(report_files.size());
+    for(std::size_t i = 0; i < report_files.size(); i++) {
+        auto result = Composer::read_batch_report(report_files[i], reports[i]);
+        if(!result) {
+            fail("failed to read " + report_files[i], result);
+        }
+    }
+
+    Composer::BatchReport merged;
+    std::vector<std::string> problems;
+    bool complete = Composer::merge_batch_reports(reports, merged, problems);
+    for(auto const &problem : problems) {
+        std::cerr << problem << std::endl;
+    }
+
+    if(options.exist("report")) {
+        auto result = Composer::write_batch_report(options.get<std::string>("report"), merged);
+        if(!result) {
+            fail("failed to write " + options.get<std::string>("report"), result);
+        }
+    }
+
+    if(complete) {
+        std::cout << "all " << merged.tree_files << " files processed" << std::endl;
+    }
+    return complete ? 0 : 1;
+}
+
+int main(int argc, char *argv[]) {
+    cmdline::parser options;
+    options.set_program_name("composer-batch");
+    options.add<std::string>("output", 'o', "Output directory for encrypt and decrypt.", false, ".");
+    options.add<std::string>("shard", 's', "Process only shard i of N (i/N, from 0), split by bytes.", false, "0/1");
+    options.add<std::string>("report", 'r', "Write a report of the shard, or of the merged shards.", false);
+    options.add<int>("jobs", 'j', "Number of worker threads, 0 for the machine profile's or one per hardware thread.", false, 0);
+    options.add<int>("max-memory", 'm', "Cap in MiB on the file data held in memory at once.", false, 256);
+    options.add<int>("split", 'S', "Files of at least this many MiB are split over all threads.", false, 16);
+    options.add<std::string>("order", 'O', "Order files are started in: largest (first) or physical (disk layout, for cold caches).", false, "largest");
+    options.add<int>("prefetch", 'p', "MiB of input to read ahead of the workers, 0 for none.", false, 0);
+    options.add<int>("checkpoint", 'C', "Sync the outputs to disk every this many MiB of input, 0 for only at the end.", false, 0);
+    options.add("no-sync", 'n', "Don't sync the outputs to disk at the end (they are still replaced atomically).");
+    options.add("dedup", 'd', "Process identical input files once and clone the output (reflink, hardlink or copy).");
+    options.add("classify", 'c', "Skip files not in the expected form (plaintext to encrypt, encrypted to decrypt).");
+    options.add<std::string>("key", 'k', "XTEA key as four hex words, e.g. 3fffef:e5:3fffffdd:7fc3.", false);
+    options.add("help", 'h', "Print this message.");
+    options.footer("<encrypt|decrypt> <input-directory> | merge <reports...>");
+
+    if(argc == 1) {
+        std::cout << options.usage() << std::endl;
+        std::exit(0);
+    }
+
+    options.parse_check(argc, argv);
+
+    // Machine profile from composer-tune, options given here override it
+    auto profile_result = Composer::load_profile();
+    if(!profile_result && profile_result.status != Composer::Status::file_not_found) {
+        std::cerr << "ignoring machine profile: " << Composer::status_message(profile_result.status) << std::endl;
+    }
+
+    auto rest = options.rest();
+    if(rest.size() < 2) {
+        std::cout << "need option: command and input directory or reports" << std::endl;
+        std::exit(1);
+    }
+
+    auto command = rest[0];
+    if(command == "merge") {
+        return merge_reports(std::vector<std::string>(rest.begin() + 1, rest.end()), options);
+    }
+
+    if(command != "encrypt" && command != "decrypt") {
+        std::cout << "unknown command: " << command << std::endl;
+        std::exit(1);
+    }
+
+    return run_batch(command == "encrypt", rest[1], options);
+}
@@ -0,0 +1,83 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <new>
+#include <composer/async.hpp>
+#include <composer/encrypt.hpp>
+#include <composer/file.hpp>
+#include <composer/mapped_file.hpp>
+
+namespace Composer {
+    void EventLoop::post(std::coroutine_handle<> handle) {
+        // Notify with the lock held: once it is released, run() may resume the last task, return,
+        // and the loop may be destroyed before a worker thread would get to notify
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->ready.push_back(handle);
+        this->wake.notify_one();
+    }
+
+    void EventLoop::run() {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        while(true) {
+            this->wake.wait(lock, [this] { return !this->ready.empty() || this->tasks == 0; });
+            if(this->ready.empty()) {
+                return;
+            }
+
+            auto handle = this->ready.front();
+            this->ready.pop_front();
+
+            lock.unlock();
+            handle.resume();
+            lock.lock();
+        }
+    }
+
+    void EventLoop::task_started() {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->tasks++;
+    }
+
+    void EventLoop::task_finished() {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->tasks--;
+    }
+
+    Task<Result> decrypt_shader_file_async(EventLoop &loop, WorkerPool &pool, std::filesystem::path input_file, std::filesystem::path output_file, Key key) {
+        co_return co_await offload(loop, pool, [&]() {
+            return try_decrypt_shader_file(input_file, output_file, key);
+        });
+    }
+
+    Task<Result> encrypt_shader_file_async(EventLoop &loop, WorkerPool &pool, std::filesystem::path input_file, std::filesystem::path output_file, Key key) {
+        co_return co_await offload(loop, pool, [&]() {
+            return try_encrypt_shader_file(input_file, output_file, key);
+        });
+    }
+
+    Task<Result> load_shader_file_async(EventLoop &loop, WorkerPool &pool, std::filesystem::path input_file, std::vector<char> &shader_data, Key key) {
+        co_return co_await offload(loop, pool, [&]() -> Result {
+            MappedFile file;
+            auto result = file.open(input_file);
+            if(!result) {
+                return result;
+            }
+
+            try {
+                std::vector<char> buffer(file.size());
+                std::size_t size;
+                result = try_decrypt_shader(file.data(), file.size(), buffer.data(), size, key);
+                if(!result) {
+                    return result;
+                }
+
+                buffer.resize(size);
+                shader_data = std::move(buffer);
+            }
+            catch(std::bad_alloc const &) {
+                return { Status::out_of_memory };
+            }
+
+            return {};
+        });
+    }
+}
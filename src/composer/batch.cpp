@@ -0,0 +1,326 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <fstream>
+#include <functional>
+#include <new>
+#include <queue>
+#include <sstream>
+#include <composer/batch.hpp>
+#include <hash-library/md5.h>
+
+namespace Composer {
+    constexpr const char batch_report_magic[] = "# composer-batch report 1";
+
+    static std::string escape_path(std::string const &path) {
+        std::string escaped;
+        escaped.reserve(path.size());
+        for(char c : path) {
+            switch(c) {
+                case '\\':
+                    escaped += "\\\\";
+                    break;
+                case '\t':
+                    escaped += "\\t";
+                    break;
+                case '\n':
+                    escaped += "\\n";
+                    break;
+                default:
+                    escaped += c;
+                    break;
+            }
+        }
+        return escaped;
+    }
+
+    static bool unescape_path(std::string const &escaped, std::string &path) {
+        path.clear();
+        for(std::size_t i = 0; i < escaped.size(); i++) {
+            if(escaped[i] != '\\') {
+                path += escaped[i];
+                continue;
+            }
+            if(++i == escaped.size()) {
+                return false;
+            }
+            switch(escaped[i]) {
+                case '\\':
+                    path += '\\';
+                    break;
+                case 't':
+                    path += '\t';
+                    break;
+                case 'n':
+                    path += '\n';
+                    break;
+                default:
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    template<typename Integer>
+    static bool parse_integer(std::string const &text, Integer &value) noexcept {
+        auto end = text.data() + text.size();
+        auto [position, error] = std::from_chars(text.data(), end, value);
+        return error == std::errc() && position == end && !text.empty();
+    }
+
+    /**
+     * Split a line at tabs
+     */
+    static std::vector<std::string> split_fields(std::string const &line) {
+        std::vector<std::string> fields;
+        std::size_t start = 0;
+        while(true) {
+            auto tab = line.find('\t', start);
+            fields.push_back(line.substr(start, tab - start));
+            if(tab == std::string::npos) {
+                return fields;
+            }
+            start = tab + 1;
+        }
+    }
+
+    Result list_batch_files(std::filesystem::path const &directory, std::vector<BatchFile> &files) noexcept {
+        files.clear();
+
+        std::error_code ec;
+        if(!std::filesystem::is_directory(directory, ec)) {
+            return { Status::file_not_found, ENOENT };
+        }
+
+        try {
+            std::filesystem::recursive_directory_iterator iterator(directory, ec);
+            for(; !ec && iterator != std::filesystem::recursive_directory_iterator(); iterator.increment(ec)) {
+                if(!iterator->is_regular_file(ec)) {
+                    continue;
+                }
+                auto size = iterator->file_size(ec);
+                if(ec) {
+                    break;
+                }
+                files.push_back({ std::filesystem::relative(iterator->path(), directory).generic_string(), size });
+            }
+            if(ec) {
+                return { Status::read_failed, ec.value() };
+            }
+
+            std::sort(files.begin(), files.end(), [](BatchFile const &a, BatchFile const &b) {
+                return a.path < b.path;
+            });
+        }
+        catch(std::bad_alloc const &) {
+            return { Status::out_of_memory };
+        }
+        catch(...) {
+            return { Status::read_failed };
+        }
+
+        return {};
+    }
+
+    std::string batch_tree_hash(std::vector<BatchFile> const &files) {
+        MD5 md5;
+        for(auto const &file : files) {
+            auto line = escape_path(file.path) + "\t" + std::to_string(file.size) + "\n";
+            md5.add(line.data(), line.size());
+        }
+        return md5.getHash();
+    }
+
+    bool parse_shard(std::string const &text, std::size_t &index, std::size_t &count) noexcept {
+        auto slash = text.find('/');
+        if(slash == std::string::npos) {
+            return false;
+        }
+
+        try {
+            return parse_integer(text.substr(0, slash), index) && parse_integer(text.substr(slash + 1), count) && count > 0 && index < count;
+        }
+        catch(...) {
+            return false;
+        }
+    }
+
+    std::vector<std::size_t> assign_shards(std::vector<BatchFile> const &files, std::size_t shard_count) {
+        std::vector<std::size_t> order(files.size());
+        for(std::size_t i = 0; i < order.size(); i++) {
+            order[i] = i;
+        }
+        std::sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) {
+            if(files[a].size != files[b].size) {
+                return files[a].size > files[b].size;
+            }
+            return files[a].path < files[b].path;
+        });
+
+        // Least loaded shard on top, ties go to the lowest index
+        using Load = std::pair<std::uint64_t, std::size_t>;
+        std::priority_queue<Load, std::vector<Load>, std::greater<Load>> loads;
+        for(std::size_t shard = 0; shard < shard_count; shard++) {
+            loads.push({ 0, shard });
+        }
+
+        std::vector<std::size_t> shards(files.size());
+        for(auto file : order) {
+            auto [load, shard] = loads.top();
+            loads.pop();
+            shards[file] = shard;
+            loads.push({ load + files[file].size, shard });
+        }
+
+        return shards;
+    }
+
+    Result write_batch_report(std::filesystem::path const &filepath, BatchReport const &report) noexcept {
+        try {
+            std::ofstream file(filepath, std::ios_base::out | std::ios_base::binary);
+            if(!file) {
+                return { Status::write_failed, errno };
+            }
+
+            file << batch_report_magic << "\n";
+            file << "shard\t" << report.shard_index << "/" << report.shard_count << "\n";
+            file << "tree\t" << report.tree_hash << "\t" << report.tree_files << "\n";
+            for(auto const &record : report.records) {
+                file << static_cast<unsigned>(record.status) << "\t" << record.size << "\t" << escape_path(record.path) << "\n";
+            }
+
+            file.close();
+            if(!file) {
+                return { Status::write_failed, errno };
+            }
+        }
+        catch(std::bad_alloc const &) {
+            return { Status::out_of_memory };
+        }
+        catch(...) {
+            return { Status::write_failed };
+        }
+
+        return {};
+    }
+
+    Result read_batch_report(std::filesystem::path const &filepath, BatchReport &report) noexcept {
+        std::error_code ec;
+        if(!std::filesystem::exists(filepath, ec)) {
+            return { Status::file_not_found, ENOENT };
+        }
+
+        try {
+            std::ifstream file(filepath, std::ios_base::in | std::ios_base::binary);
+            if(!file) {
+                return { Status::read_failed, errno };
+            }
+
+            std::string line;
+            if(!std::getline(file, line) || line != batch_report_magic) {
+                return { Status::invalid_report };
+            }
+
+            if(!std::getline(file, line)) {
+                return { Status::invalid_report };
+            }
+            auto fields = split_fields(line);
+            if(fields.size() != 2 || fields[0] != "shard" || !parse_shard(fields[1], report.shard_index, report.shard_count)) {
+                return { Status::invalid_report };
+            }
+
+            if(!std::getline(file, line)) {
+                return { Status::invalid_report };
+            }
+            fields = split_fields(line);
+            if(fields.size() != 3 || fields[0] != "tree" || !parse_integer(fields[2], report.tree_files)) {
+                return { Status::invalid_report };
+            }
+            report.tree_hash = fields[1];
+
+            report.records.clear();
+            while(std::getline(file, line)) {
+                fields = split_fields(line);
+                BatchRecord record;
+                unsigned status;
+                if(fields.size() != 3 || !parse_integer(fields[0], status) || status > 255 || !parse_integer(fields[1], record.size) || !unescape_path(fields[2], record.path)) {
+                    return { Status::invalid_report };
+                }
+                record.status = static_cast<Status>(status);
+                report.records.push_back(std::move(record));
+            }
+
+            if(file.bad()) {
+                return { Status::read_failed, errno };
+            }
+        }
+        catch(std::bad_alloc const &) {
+            return { Status::out_of_memory };
+        }
+        catch(...) {
+            return { Status::read_failed };
+        }
+
+        return {};
+    }
+
+    bool merge_batch_reports(std::vector<BatchReport> const &reports, BatchReport &merged, std::vector<std::string> &problems) {
+        problems.clear();
+        merged = BatchReport();
+        if(reports.empty()) {
+            problems.push_back("no reports");
+            return false;
+        }
+
+        auto const &first = reports.front();
+        merged.shard_count = 1;
+        merged.tree_hash = first.tree_hash;
+        merged.tree_files = first.tree_files;
+
+        std::vector<bool> seen(first.shard_count, false);
+        for(auto const &report : reports) {
+            std::stringstream name;
+            name << "shard " << report.shard_index << "/" << report.shard_count;
+
+            if(report.shard_count != first.shard_count || report.tree_hash != first.tree_hash || report.tree_files != first.tree_files) {
+                problems.push_back(name.str() + " is from a different batch");
+                continue;
+            }
+            if(seen[report.shard_index]) {
+                problems.push_back(name.str() + " is given more than once");
+                continue;
+            }
+            seen[report.shard_index] = true;
+
+            merged.records.insert(merged.records.end(), report.records.begin(), report.records.end());
+        }
+
+        for(std::size_t shard = 0; shard < seen.size(); shard++) {
+            if(!seen[shard]) {
+                problems.push_back("shard " + std::to_string(shard) + "/" + std::to_string(seen.size()) + " is missing");
+            }
+        }
+
+        std::sort(merged.records.begin(), merged.records.end(), [](BatchRecord const &a, BatchRecord const &b) {
+            return a.path < b.path;
+        });
+
+        for(std::size_t i = 0; i < merged.records.size(); i++) {
+            auto const &record = merged.records[i];
+            if(i > 0 && merged.records[i - 1].path == record.path) {
+                problems.push_back(record.path + ": processed more than once");
+            }
+            if(record.status != Status::ok && record.status != Status::skipped) {
+                problems.push_back(record.path + ": " + status_message(record.status));
+            }
+        }
+
+        if(merged.records.size() != merged.tree_files) {
+            problems.push_back(std::to_string(merged.records.size()) + " of " + std::to_string(merged.tree_files) + " files processed");
+        }
+
+        return problems.empty();
+    }
+}
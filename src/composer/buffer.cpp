@@ -0,0 +1,208 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+#include <composer/buffer.hpp>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace Composer {
+    static std::atomic<AllocationPolicy> current_policy(AllocationPolicy::standard);
+
+    void set_allocation_policy(AllocationPolicy policy) noexcept {
+        current_policy.store(policy, std::memory_order_relaxed);
+    }
+
+    AllocationPolicy allocation_policy() noexcept {
+        return current_policy.load(std::memory_order_relaxed);
+    }
+
+    bool parse_allocation_policy(std::string const &name, AllocationPolicy &policy) noexcept {
+        if(name == "standard") {
+            policy = AllocationPolicy::standard;
+        }
+        else if(name == "prefault") {
+            policy = AllocationPolicy::prefault;
+        }
+        else if(name == "thp") {
+            policy = AllocationPolicy::transparent_huge_pages;
+        }
+        else if(name == "hugetlb") {
+            policy = AllocationPolicy::huge_pages;
+        }
+        else {
+            return false;
+        }
+        return true;
+    }
+
+    const char *allocation_policy_name(AllocationPolicy policy) noexcept {
+        switch(policy) {
+            case AllocationPolicy::standard:
+                return "standard";
+            case AllocationPolicy::prefault:
+                return "prefault";
+            case AllocationPolicy::transparent_huge_pages:
+                return "thp";
+            case AllocationPolicy::huge_pages:
+                return "hugetlb";
+        }
+        return "unknown";
+    }
+
+#ifdef __linux__
+    static std::size_t huge_page_size() noexcept {
+        static const std::size_t size = []() -> std::size_t {
+            std::size_t kilobytes = 2048;
+            if(std::FILE *meminfo = std::fopen("/proc/meminfo", "r")) {
+                char line[128];
+                while(std::fgets(line, sizeof(line), meminfo)) {
+                    if(std::sscanf(line, "Hugepagesize: %zu kB", &kilobytes) == 1) {
+                        break;
+                    }
+                }
+                std::fclose(meminfo);
+            }
+            return kilobytes * 1024;
+        }();
+        return size;
+    }
+
+    static char *map_buffer(std::size_t size, AllocationPolicy policy, std::size_t &mapped_length) noexcept {
+        constexpr int protection = PROT_READ | PROT_WRITE;
+        constexpr int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+        std::size_t page_size = huge_page_size();
+        std::size_t length = (size + page_size - 1) / page_size * page_size;
+
+        if(policy == AllocationPolicy::huge_pages) {
+            void *memory = mmap(nullptr, length, protection, flags | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+            if(memory != MAP_FAILED) {
+                mapped_length = length;
+                return static_cast<char *>(memory);
+            }
+
+            // No reserved huge pages, let the kernel back it transparently instead
+            policy = AllocationPolicy::transparent_huge_pages;
+        }
+
+        if(policy == AllocationPolicy::transparent_huge_pages) {
+            // Over-map so the buffer can start on a huge page boundary, then trim the excess
+            void *raw = mmap(nullptr, length + page_size, protection, flags, -1, 0);
+            if(raw == MAP_FAILED) {
+                return nullptr;
+            }
+
+            auto address = reinterpret_cast<std::uintptr_t>(raw);
+            auto aligned = (address + page_size - 1) / page_size * page_size;
+            if(aligned > address) {
+                munmap(raw, aligned - address);
+            }
+            if(aligned < address + page_size) {
+                munmap(reinterpret_cast<void *>(aligned + length), address + page_size - aligned);
+            }
+
+            auto *memory = reinterpret_cast<char *>(aligned);
+            madvise(memory, length, MADV_HUGEPAGE);
+
+            // Populate after the hint so the faults are served with huge pages
+#ifdef MADV_POPULATE_WRITE
+            if(madvise(memory, length, MADV_POPULATE_WRITE) != 0)
+#endif
+            {
+                long small_page_size = sysconf(_SC_PAGESIZE);
+                for(std::size_t offset = 0; offset < length; offset += small_page_size) {
+                    memory[offset] = 0;
+                }
+            }
+
+            mapped_length = length;
+            return memory;
+        }
+
+        length = (size + 4095) / 4096 * 4096;
+        void *memory = mmap(nullptr, length, protection, flags | MAP_POPULATE, -1, 0);
+        if(memory == MAP_FAILED) {
+            return nullptr;
+        }
+
+        mapped_length = length;
+        return static_cast<char *>(memory);
+    }
+#endif
+
+    Buffer::Buffer(Buffer &&other) noexcept :
+        memory(std::exchange(other.memory, nullptr)),
+        length(std::exchange(other.length, 0)),
+        mapped_length(std::exchange(other.mapped_length, 0)) {}
+
+    Buffer &Buffer::operator=(Buffer &&other) noexcept {
+        if(this != &other) {
+            this->release();
+            this->memory = std::exchange(other.memory, nullptr);
+            this->length = std::exchange(other.length, 0);
+            this->mapped_length = std::exchange(other.mapped_length, 0);
+        }
+        return *this;
+    }
+
+    Buffer::~Buffer() {
+        this->release();
+    }
+
+    bool Buffer::allocate(std::size_t size) noexcept {
+        this->release();
+        if(size == 0) {
+            return true;
+        }
+
+#ifdef __linux__
+        auto policy = allocation_policy();
+        if(policy != AllocationPolicy::standard && size >= large_buffer_size) {
+            this->memory = map_buffer(size, policy, this->mapped_length);
+        }
+#endif
+
+        if(!this->memory) {
+            this->memory = static_cast<char *>(std::malloc(size));
+            if(!this->memory) {
+                return false;
+            }
+        }
+
+        this->length = size;
+        return true;
+    }
+
+    bool Buffer::reserve(std::size_t size) noexcept {
+        if(size <= this->length) {
+            return true;
+        }
+        return this->allocate(size);
+    }
+
+    void Buffer::release() noexcept {
+        if(!this->memory) {
+            return;
+        }
+
+#ifdef __linux__
+        if(this->mapped_length) {
+            munmap(this->memory, this->mapped_length);
+        }
+        else
+#endif
+        {
+            std::free(this->memory);
+        }
+
+        this->memory = nullptr;
+        this->length = 0;
+        this->mapped_length = 0;
+    }
+}
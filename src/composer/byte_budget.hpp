@@ -0,0 +1,49 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef COMPOSER__BYTE_BUDGET_HPP
+#define COMPOSER__BYTE_BUDGET_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+namespace Composer {
+    /**
+     * Counting semaphore over bytes
+     */
+    class ByteBudget {
+    public:
+        explicit ByteBudget(std::uint64_t limit) noexcept : limit(limit) {}
+
+        /**
+         * Block until `bytes` more fit, or nothing else is in flight
+         */
+        void acquire(std::uint64_t bytes) {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->changed.wait(lock, [&] { return this->in_flight == 0 || this->in_flight + bytes <= this->limit; });
+            this->in_flight += bytes;
+        }
+
+        void release(std::uint64_t bytes) {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->in_flight -= bytes;
+            this->changed.notify_all();
+        }
+
+        /**
+         * Block until everything acquired was released
+         */
+        void wait_idle() {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->changed.wait(lock, [&] { return this->in_flight == 0; });
+        }
+
+    private:
+        std::uint64_t limit;
+        std::uint64_t in_flight = 0;
+        std::mutex mutex;
+        std::condition_variable changed;
+    };
+}
+
+#endif
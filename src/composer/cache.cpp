@@ -0,0 +1,192 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <algorithm>
+#include <cerrno>
+#include <new>
+#include <composer/cache.hpp>
+#include <composer/encrypt.hpp>
+#include <composer/hash.hpp>
+#include <composer/mapped_file.hpp>
+
+namespace Composer {
+    static void append_bytes(std::string &identity, void const *data, std::size_t size) {
+        identity.append(static_cast<char const *>(data), size);
+    }
+
+    /**
+     * Decrypt into a new shared buffer
+     */
+    static Result decrypt_shared(char const *encrypted_shader_data, std::size_t size, Key const &key, SharedShader &shader) noexcept {
+        try {
+            auto buffer = std::make_shared<std::vector<char>>(size);
+            std::size_t shader_size;
+            auto result = try_decrypt_shader(encrypted_shader_data, size, buffer->data(), shader_size, key);
+            if(!result) {
+                return result;
+            }
+            buffer->resize(shader_size);
+            buffer->shrink_to_fit();
+            shader = std::move(buffer);
+            return {};
+        }
+        catch(std::bad_alloc const &) {
+            return { Status::out_of_memory };
+        }
+    }
+
+    ShaderCache::ShaderCache(std::size_t byte_budget, std::size_t shard_count) {
+        shard_count = std::max<std::size_t>(shard_count, 1);
+        this->shard_budget = byte_budget / shard_count;
+        for(std::size_t i = 0; i < shard_count; i++) {
+            this->shards.push_back(std::make_unique<Shard>());
+        }
+    }
+
+    bool ShaderCache::find(Shard &shard, std::uint64_t hash, std::string const &identity, SharedShader &shader) {
+        auto range = shard.index.equal_range(hash);
+        for(auto it = range.first; it != range.second; it++) {
+            if(it->second->identity == identity) {
+                shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+                shader = it->second->shader;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void ShaderCache::insert(Shard &shard, std::uint64_t hash, std::string const &identity, SharedShader const &shader) {
+        if(shader->size() > this->shard_budget) {
+            return;
+        }
+
+        // Someone else may have loaded the same data meanwhile
+        SharedShader existing;
+        if(this->find(shard, hash, identity, existing)) {
+            return;
+        }
+
+        shard.entries.push_front({ hash, identity, shader });
+        shard.index.emplace(hash, shard.entries.begin());
+        shard.bytes += shader->size();
+
+        while(shard.bytes > this->shard_budget) {
+            auto &last = shard.entries.back();
+            auto range = shard.index.equal_range(last.hash);
+            for(auto it = range.first; it != range.second; it++) {
+                if(&*it->second == &last) {
+                    shard.index.erase(it);
+                    break;
+                }
+            }
+            shard.bytes -= last.shader->size();
+            shard.entries.pop_back();
+            shard.stats.evictions++;
+        }
+    }
+
+    template<typename Load>
+    Result ShaderCache::lookup(std::uint64_t hash, std::string const &identity, SharedShader &shader, Load &&load) noexcept {
+        auto &shard = *this->shards[hash % this->shards.size()];
+
+        try {
+            {
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                if(this->find(shard, hash, identity, shader)) {
+                    shard.stats.hits++;
+                    return {};
+                }
+                shard.stats.misses++;
+            }
+
+            // Decrypt without holding the lock
+            auto result = load(shader);
+            if(!result) {
+                return result;
+            }
+
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            this->insert(shard, hash, identity, shader);
+        }
+        catch(std::bad_alloc const &) {
+            return { Status::out_of_memory };
+        }
+
+        return {};
+    }
+
+    Result ShaderCache::decrypt(char const *encrypted_shader_data, std::size_t size, SharedShader &shader, Key const &key) noexcept {
+        std::string identity;
+        try {
+            // The tail holds the encrypted checksum, which guards against hash collisions
+            std::uint64_t size64 = size;
+            auto tail = std::min<std::size_t>(size, trailer_size);
+            append_bytes(identity, key.words, sizeof(key.words));
+            append_bytes(identity, &size64, sizeof(size64));
+            append_bytes(identity, encrypted_shader_data + size - tail, tail);
+        }
+        catch(std::bad_alloc const &) {
+            return { Status::out_of_memory };
+        }
+
+        auto hash = fast_hash64(encrypted_shader_data, size, fast_hash64(key.words, sizeof(key.words)));
+        return this->lookup(hash, identity, shader, [&](SharedShader &shader) {
+            return decrypt_shared(encrypted_shader_data, size, key, shader);
+        });
+    }
+
+    Result ShaderCache::decrypt_file(std::filesystem::path const &input_file, SharedShader &shader, Key const &key) noexcept {
+        std::string identity;
+        try {
+            std::error_code ec;
+            auto size = static_cast<std::uint64_t>(std::filesystem::file_size(input_file, ec));
+            if(ec) {
+                return { Status::file_not_found, ec.value() };
+            }
+            auto time = std::filesystem::last_write_time(input_file, ec).time_since_epoch().count();
+            if(ec) {
+                return { Status::read_failed, ec.value() };
+            }
+
+            auto const &path = input_file.native();
+            append_bytes(identity, key.words, sizeof(key.words));
+            append_bytes(identity, &size, sizeof(size));
+            append_bytes(identity, &time, sizeof(time));
+            append_bytes(identity, path.data(), path.size() * sizeof(path[0]));
+        }
+        catch(std::bad_alloc const &) {
+            return { Status::out_of_memory };
+        }
+
+        auto hash = fast_hash64(identity.data(), identity.size());
+        return this->lookup(hash, identity, shader, [&](SharedShader &shader) {
+            MappedFile file;
+            auto result = file.open(input_file);
+            if(!result) {
+                return result;
+            }
+            return decrypt_shared(file.data(), file.size(), key, shader);
+        });
+    }
+
+    CacheStats ShaderCache::stats() const noexcept {
+        CacheStats total;
+        for(auto const &shard : this->shards) {
+            std::lock_guard<std::mutex> lock(shard->mutex);
+            total.hits += shard->stats.hits;
+            total.misses += shard->stats.misses;
+            total.evictions += shard->stats.evictions;
+            total.entries += shard->entries.size();
+            total.bytes += shard->bytes;
+        }
+        return total;
+    }
+
+    void ShaderCache::clear() noexcept {
+        for(auto &shard : this->shards) {
+            std::lock_guard<std::mutex> lock(shard->mutex);
+            shard->index.clear();
+            shard->entries.clear();
+            shard->bytes = 0;
+        }
+    }
+}
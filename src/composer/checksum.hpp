@@ -0,0 +1,89 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef COMPOSER__CHECKSUM_HPP
+#define COMPOSER__CHECKSUM_HPP
+
+#include <cstddef>
+#include <cstring>
+#include <composer/encrypt.hpp>
+#include <composer/xtea.hpp>
+#include <hash-library/md5.h>
+
+namespace Composer {
+    /**
+     * Write a raw MD5 hash as 32 hex characters, as stored in the trailer
+     * @param raw_hash  raw hash
+     * @param hash      output characters, not null terminated
+     */
+    inline void format_checksum(unsigned char const raw_hash[MD5::HashBytes], char hash[32]) noexcept {
+        static const char dec2hex[16 + 1] = "0123456789abcdef";
+
+        for(std::size_t i = 0; i < MD5::HashBytes; i++) {
+            hash[i * 2] = dec2hex[raw_hash[i] >> 4];
+            hash[i * 2 + 1] = dec2hex[raw_hash[i] & 15];
+        }
+    }
+
+    /**
+     * Read 32 hex characters from the trailer as a raw MD5 hash
+     * @param hash      hex characters
+     * @param raw_hash  output raw hash
+     * @return          false if a character isn't a lowercase hex digit
+     */
+    inline bool parse_checksum(char const hash[32], unsigned char raw_hash[MD5::HashBytes]) noexcept {
+        auto hex2dec = [](char c) -> int {
+            if(c >= '0' && c <= '9') {
+                return c - '0';
+            }
+            if(c >= 'a' && c <= 'f') {
+                return c - 'a' + 10;
+            }
+            return -1;
+        };
+
+        for(std::size_t i = 0; i < MD5::HashBytes; i++) {
+            int high = hex2dec(hash[i * 2]);
+            int low = hex2dec(hash[i * 2 + 1]);
+            if(high < 0 || low < 0) {
+                return false;
+            }
+            raw_hash[i] = static_cast<unsigned char>(high << 4 | low);
+        }
+        return true;
+    }
+
+    /**
+     * Write the MD5 hash of the data added so far as 32 hex characters, as stored in the trailer
+     * @param md5       hasher
+     * @param hash      output characters, not null terminated
+     */
+    inline void format_checksum(MD5 &md5, char hash[32]) noexcept {
+        unsigned char raw_hash[MD5::HashBytes];
+        md5.getHash(raw_hash);
+        format_checksum(raw_hash, hash);
+    }
+
+    /**
+     * Append the trailer to shader data and encrypt it in place; the buffer must start on a block boundary
+     * of the encrypted data
+     * @param buffer    shader data, with room for the trailer
+     * @param size      size of the shader data in the buffer
+     * @param hash      hash of the whole shader data, 32 hex characters
+     * @param key       key
+     * @return          size of the encrypted data
+     */
+    inline std::size_t seal_shader_data(char *buffer, std::size_t size, char const hash[32], Key const &key) noexcept {
+        std::memmove(buffer + size, hash, 32);
+        buffer[size + trailer_size - 1] = 0; // all good
+
+        auto buffer_size = size + trailer_size;
+        encrypt_blocks(buffer, buffer_size / 8, key);
+        if(buffer_size % 8) {
+            encrypt_blocks(buffer + buffer_size - 8, 1, key);
+        }
+
+        return buffer_size;
+    }
+}
+
+#endif
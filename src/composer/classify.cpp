@@ -0,0 +1,201 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <composer/classify.hpp>
+#include <composer/encrypt.hpp>
+#include "trailer.hpp"
+
+namespace Composer {
+    constexpr const std::size_t classify_head_size = 4096;
+    constexpr const std::size_t classify_window_size = 1024;
+    constexpr const std::size_t classify_window_count = 3;
+
+    /** Data up to this size is sampled whole */
+    constexpr const std::size_t classify_whole_size = classify_head_size + classify_window_count * classify_window_size;
+
+    /** Below this many sampled bytes the entropy says too little */
+    constexpr const std::size_t classify_entropy_minimum = 512;
+
+    /** How far below random data the entropy has to be for plaintext, in bits per byte */
+    constexpr const double classify_entropy_margin = 0.5;
+
+    namespace {
+        /**
+         * Sampled part of the data
+         */
+        struct SampleWindow {
+            char const *data;
+            std::size_t size;
+            std::uint64_t offset;
+        };
+
+        /**
+         * Where the samples are taken
+         * @return  number of windows
+         */
+        std::size_t sample_layout(std::uint64_t size, std::uint64_t offsets[1 + classify_window_count], std::size_t sizes[1 + classify_window_count]) noexcept {
+            if(size <= classify_whole_size) {
+                offsets[0] = 0;
+                sizes[0] = static_cast<std::size_t>(size);
+                return 1;
+            }
+
+            offsets[0] = 0;
+            sizes[0] = classify_head_size;
+            for(std::size_t i = 1; i <= classify_window_count; i++) {
+                // Aligned so the token scan sees the data as the shader compiler laid it out
+                offsets[i] = std::min(size * i / (classify_window_count + 1), size - classify_window_size) / 8 * 8;
+                sizes[i] = classify_window_size;
+            }
+            return 1 + classify_window_count;
+        }
+
+        /**
+         * Check for a D3D shader version token, 0xFFFE (vs) or 0xFFFF (ps) then major 1-3, minor 0-4
+         */
+        bool is_version_token(unsigned char const *bytes) noexcept {
+            return bytes[3] == 0xFF && (bytes[2] == 0xFE || bytes[2] == 0xFF) && bytes[1] >= 1 && bytes[1] <= 3 && bytes[0] <= 4;
+        }
+
+        ShaderClassification classify_samples(SampleWindow const *windows, std::size_t window_count, char const *trailer_window, std::uint64_t trailer_offset, std::uint64_t size, Key const *keys, std::size_t key_count) noexcept {
+            ShaderClassification classification;
+
+            std::size_t histogram[256] = {};
+            std::size_t sampled = 0;
+            for(std::size_t i = 0; i < window_count; i++) {
+                auto bytes = reinterpret_cast<unsigned char const *>(windows[i].data);
+                for(std::size_t j = 0; j < windows[i].size; j++) {
+                    histogram[bytes[j]]++;
+                }
+                sampled += windows[i].size;
+
+                std::size_t first = static_cast<std::size_t>((4 - windows[i].offset % 4) % 4);
+                for(std::size_t j = first; j + 4 <= windows[i].size && !classification.bytecode; j += 4) {
+                    classification.bytecode = is_version_token(bytes + j);
+                }
+            }
+
+            for(auto count : histogram) {
+                if(count) {
+                    double p = static_cast<double>(count) / static_cast<double>(sampled);
+                    classification.entropy -= p * std::log2(p);
+                }
+            }
+
+            if(size >= trailer_size && key_count > 0 && detect_trailer_key(trailer_window, trailer_offset, size, keys, key_count, classification.key_index)) {
+                classification.kind = ShaderKind::encrypted;
+                return classification;
+            }
+
+            // Too small to encrypt
+            if(size < 8) {
+                return classification;
+            }
+
+            // Entropy of that many random bytes, with the usual small sample bias
+            double random_entropy = 8.0 - 255.0 / (2.0 * static_cast<double>(sampled) * std::log(2.0));
+            if(classification.bytecode || (sampled >= classify_entropy_minimum && classification.entropy < random_entropy - classify_entropy_margin)) {
+                classification.kind = ShaderKind::plaintext;
+            }
+
+            return classification;
+        }
+    }
+
+    ShaderClassification classify_shader(char const *data, std::size_t size, Key const *keys, std::size_t key_count) noexcept {
+        std::uint64_t offsets[1 + classify_window_count];
+        std::size_t sizes[1 + classify_window_count];
+        auto window_count = sample_layout(size, offsets, sizes);
+
+        SampleWindow windows[1 + classify_window_count];
+        for(std::size_t i = 0; i < window_count; i++) {
+            windows[i] = { data + offsets[i], sizes[i], offsets[i] };
+        }
+
+        return classify_samples(windows, window_count, data, 0, size, keys, key_count);
+    }
+
+    ShaderClassification classify_shader(char const *data, std::size_t size, Key const &key) noexcept {
+        return classify_shader(data, size, &key, 1);
+    }
+
+    Result try_classify_shader_file(std::filesystem::path const &input_file, ShaderClassification &classification, Key const *keys, std::size_t key_count) noexcept {
+        std::error_code ec;
+        if(!std::filesystem::exists(input_file, ec)) {
+            return { Status::file_not_found, ENOENT };
+        }
+
+        try {
+            std::ifstream file;
+            file.open(input_file, std::ios_base::in | std::ios_base::binary);
+            if(!file) {
+                return { Status::read_failed, errno };
+            }
+
+            file.seekg(0, std::ios::end);
+            auto filesize = file.tellg();
+            if(filesize < 0) {
+                return { Status::read_failed, errno };
+            }
+            auto size = static_cast<std::uint64_t>(filesize);
+
+            std::uint64_t offsets[1 + classify_window_count];
+            std::size_t sizes[1 + classify_window_count];
+            auto window_count = sample_layout(size, offsets, sizes);
+
+            char head[classify_whole_size];
+            char samples[classify_window_count][classify_window_size];
+            char trailer_window[trailer_window_size];
+
+            SampleWindow windows[1 + classify_window_count];
+            for(std::size_t i = 0; i < window_count; i++) {
+                char *buffer = i == 0 ? head : samples[i - 1];
+                file.seekg(static_cast<std::streamoff>(offsets[i]));
+                file.read(buffer, static_cast<std::streamsize>(sizes[i]));
+                if(!file) {
+                    return { Status::read_failed, errno };
+                }
+                windows[i] = { buffer, sizes[i], offsets[i] };
+            }
+
+            // Small files were read whole
+            char const *trailer_data = head;
+            std::uint64_t trailer_offset = 0;
+            if(window_count > 1) {
+                trailer_offset = trailer_window_offset(size);
+                file.seekg(static_cast<std::streamoff>(trailer_offset));
+                file.read(trailer_window, static_cast<std::streamsize>(size - trailer_offset));
+                if(!file) {
+                    return { Status::read_failed, errno };
+                }
+                trailer_data = trailer_window;
+            }
+
+            classification = classify_samples(windows, window_count, trailer_data, trailer_offset, size, keys, key_count);
+            return {};
+        }
+        catch(...) {
+            return { Status::read_failed };
+        }
+    }
+
+    Result try_classify_shader_file(std::filesystem::path const &input_file, ShaderClassification &classification, Key const &key) noexcept {
+        return try_classify_shader_file(input_file, classification, &key, 1);
+    }
+
+    const char *shader_kind_name(ShaderKind kind) noexcept {
+        switch(kind) {
+            case ShaderKind::unknown:
+                return "unknown";
+            case ShaderKind::plaintext:
+                return "plaintext";
+            case ShaderKind::encrypted:
+                return "encrypted";
+        }
+        return "unknown";
+    }
+}
@@ -0,0 +1,177 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <tuple>
+#include <composer/dedup.hpp>
+#include <composer/hash.hpp>
+#include <composer/mapped_file.hpp>
+#include "output_file.hpp"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#endif
+
+namespace Composer {
+    namespace {
+        /**
+         * Compare two files byte for byte
+         */
+        bool same_content(std::filesystem::path const &a, std::filesystem::path const &b) noexcept {
+            MappedFile first;
+            MappedFile second;
+            if(!first.open(a) || !second.open(b) || first.size() != second.size()) {
+                return false;
+            }
+            return first.size() == 0 || std::memcmp(first.data(), second.data(), first.size()) == 0;
+        }
+
+        /**
+         * Clone the extents of input_file into a new output_file
+         */
+        bool reflink_file(std::filesystem::path const &input_file, std::filesystem::path const &output_file) noexcept {
+#ifdef __linux__
+            int input = ::open(input_file.c_str(), O_RDONLY | O_CLOEXEC);
+            if(input < 0) {
+                return false;
+            }
+
+            int output = ::open(output_file.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+            if(output < 0) {
+                ::close(input);
+                return false;
+            }
+
+            bool cloned = ::ioctl(output, FICLONE, input) == 0;
+            ::close(output);
+            ::close(input);
+            if(!cloned) {
+                ::unlink(output_file.c_str());
+            }
+            return cloned;
+#else
+            (void)input_file;
+            (void)output_file;
+            return false;
+#endif
+        }
+    }
+
+    std::vector<std::size_t> find_duplicate_files(std::vector<std::filesystem::path> const &files, std::vector<std::uint64_t> const &sizes, WorkerPool &pool) {
+        std::vector<std::size_t> originals(files.size());
+        std::vector<std::size_t> candidates;
+        for(std::size_t i = 0; i < files.size(); i++) {
+            originals[i] = i;
+            candidates.push_back(i);
+        }
+
+        // Sizes seen once can't have duplicates
+        std::stable_sort(candidates.begin(), candidates.end(), [&](std::size_t a, std::size_t b) {
+            return sizes[a] < sizes[b];
+        });
+        std::vector<std::size_t> shared;
+        for(std::size_t i = 0; i < candidates.size(); i++) {
+            bool before = i > 0 && sizes[candidates[i - 1]] == sizes[candidates[i]];
+            bool after = i + 1 < candidates.size() && sizes[candidates[i + 1]] == sizes[candidates[i]];
+            if(before || after) {
+                shared.push_back(candidates[i]);
+            }
+        }
+
+        std::vector<std::uint64_t> hashes(files.size());
+        std::vector<char> readable(files.size());
+        for(auto index : shared) {
+            pool.submit([&, index]() {
+                MappedFile file;
+                if(file.open(files[index]) && file.size() == sizes[index]) {
+                    hashes[index] = fast_hash64(file.data(), file.size());
+                    readable[index] = true;
+                }
+            });
+        }
+        pool.wait();
+
+        shared.erase(std::remove_if(shared.begin(), shared.end(), [&](std::size_t index) { return !readable[index]; }), shared.end());
+        std::sort(shared.begin(), shared.end(), [&](std::size_t a, std::size_t b) {
+            return std::tie(sizes[a], hashes[a], a) < std::tie(sizes[b], hashes[b], b);
+        });
+
+        // The first file of each run of equal hashes is the original; the others are confirmed
+        std::size_t first = 0;
+        for(std::size_t i = 1; i < shared.size(); i++) {
+            if(sizes[shared[i]] != sizes[shared[first]] || hashes[shared[i]] != hashes[shared[first]]) {
+                first = i;
+                continue;
+            }
+
+            std::size_t original = shared[first];
+            std::size_t index = shared[i];
+            pool.submit([&, original, index]() {
+                if(same_content(files[original], files[index])) {
+                    originals[index] = original;
+                }
+            });
+        }
+        pool.wait();
+
+        return originals;
+    }
+
+    Result clone_file(std::filesystem::path const &input_file, std::filesystem::path const &output_file, CloneMethod &method) noexcept {
+        std::filesystem::path destination;
+        std::filesystem::path temporary_path;
+        try {
+            destination = resolve_output_path(output_file);
+            temporary_path = temporary_output_path(destination);
+        }
+        catch(...) {
+            return { Status::out_of_memory };
+        }
+
+        // Made next to the output and renamed over it, like every other output
+        std::error_code ec;
+        CloneMethod used = CloneMethod::reflink;
+        if(!reflink_file(input_file, temporary_path)) {
+            used = CloneMethod::hardlink;
+            std::filesystem::create_hard_link(input_file, temporary_path, ec);
+        }
+        if(used == CloneMethod::hardlink && ec) {
+            // Another filesystem, or one without links
+            used = CloneMethod::copy;
+            ec.clear();
+            std::filesystem::copy_file(input_file, temporary_path, ec);
+        }
+
+        if(!ec) {
+            std::filesystem::rename(temporary_path, destination, ec);
+        }
+        if(ec) {
+            std::error_code remove_ec;
+            std::filesystem::remove(temporary_path, remove_ec);
+            return { Status::write_failed, ec.value() };
+        }
+
+        // Renaming a link over another link of the same file does nothing
+        std::filesystem::remove(temporary_path, ec);
+
+        note_output(destination);
+        method = used;
+        return {};
+    }
+
+    const char *clone_method_name(CloneMethod method) noexcept {
+        switch(method) {
+            case CloneMethod::reflink:
+                return "reflink";
+            case CloneMethod::hardlink:
+                return "hardlink";
+            case CloneMethod::copy:
+                return "copy";
+        }
+        return "copy";
+    }
+}
@@ -0,0 +1,96 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <composer/diff.hpp>
+#include <composer/encrypt.hpp>
+#include <composer/mapped_file.hpp>
+
+namespace Composer {
+    namespace {
+        /**
+         * Bytes compared with a single memcmp before looking at individual blocks; most of a
+         * rebuilt shader is unchanged, so this is what the scan spends its time on
+         */
+        constexpr std::size_t diff_stride = 4096;
+
+        void add_range(std::vector<ByteRange> &ranges, std::uint64_t offset, std::uint64_t end) {
+            if(offset >= end) {
+                return;
+            }
+            if(!ranges.empty() && ranges.back().offset + ranges.back().size >= offset) {
+                auto &last = ranges.back();
+                last.size = std::max(last.offset + last.size, end) - last.offset;
+                return;
+            }
+            ranges.push_back({ offset, end - offset });
+        }
+
+        /**
+         * Offset of the blocks that aren't independent: the last whole block overlaps the tail block
+         */
+        std::uint64_t independent_blocks_end(std::uint64_t size) noexcept {
+            return size % 8 ? size / 8 * 8 - 8 : size;
+        }
+    }
+
+    void diff_encrypted_shaders(char const *a, std::size_t a_size, char const *b, std::size_t b_size, std::vector<ByteRange> &ranges) {
+        ranges.clear();
+
+        std::uint64_t a_shader_size = a_size - trailer_size;
+        std::uint64_t b_shader_size = b_size - trailer_size;
+        std::uint64_t shader_size = std::max(a_shader_size, b_shader_size);
+
+        // With equal sizes the blocks line up all the way to the end, otherwise only up to the
+        // shorter shader data since past it one side is the trailer
+        std::size_t blocks_end = static_cast<std::size_t>(independent_blocks_end(a_size));
+        if(a_size != b_size) {
+            blocks_end = static_cast<std::size_t>(std::min(a_shader_size, b_shader_size) / 8 * 8);
+        }
+        for(std::size_t offset = 0; offset < blocks_end; offset += diff_stride) {
+            auto stride = std::min(diff_stride, blocks_end - offset);
+            if(std::memcmp(a + offset, b + offset, stride) == 0) {
+                continue;
+            }
+
+            for(std::size_t block = offset; block < offset + stride; block += 8) {
+                if(std::memcmp(a + block, b + block, 8) != 0) {
+                    add_range(ranges, block, std::min<std::uint64_t>(block + 8, shader_size));
+                }
+            }
+        }
+
+        bool same_end = a_size == b_size && std::memcmp(a + blocks_end, b + blocks_end, a_size - blocks_end) == 0;
+        if(!same_end) {
+            add_range(ranges, blocks_end, shader_size);
+        }
+    }
+
+    Result try_diff_encrypted_shader_files(std::filesystem::path const &a_file, std::filesystem::path const &b_file, std::vector<ByteRange> &ranges) noexcept {
+        MappedFile a;
+        auto result = a.open(a_file);
+        if(!result) {
+            return result;
+        }
+
+        MappedFile b;
+        result = b.open(b_file);
+        if(!result) {
+            return result;
+        }
+
+        if(a.size() < trailer_size || b.size() < trailer_size) {
+            return { Status::data_too_small };
+        }
+
+        try {
+            diff_encrypted_shaders(a.data(), a.size(), b.data(), b.size(), ranges);
+        }
+        catch(std::bad_alloc const &) {
+            return { Status::out_of_memory };
+        }
+
+        return {};
+    }
+}
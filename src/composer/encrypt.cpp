@@ -1,96 +1,178 @@
-#include <cstdint>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
 #include <iostream>
+#include <stdexcept>
+#include <system_error>
+#include <vector>
 #include <composer/encrypt.hpp>
-#include <hash-library/md5.h>
+#include <composer/worker_pool.hpp>
+#include "checksum.hpp"
+#include "trailer.hpp"
 
 namespace Composer {
-    constexpr const std::uint32_t key[] = { 0x3FFFEF, 0xE5, 0x3FFFFFDD, 0x7FC3 };
-    constexpr const std::uint32_t delta = 0x61C88647;
-    
-    std::vector<char> decrypt_shader(std::vector<char> const &encrypted_shader_data) {
-        if(encrypted_shader_data.size() < 8) {
-            throw std::runtime_error("shader data is too small");
+    static void hash_shader_data(char const *data, std::size_t size, char hash[32]) noexcept {
+        MD5 md5;
+        md5.add(data, size);
+        format_checksum(md5, hash);
+    }
+
+    Result try_decrypt_shader(char const *encrypted_shader_data, std::size_t size, char *output, std::size_t &output_size, Key const &key) noexcept {
+        if(size < trailer_size) {
+            return { Status::data_too_small };
         }
 
-        auto decrypt_block = [](char *buffer) {
-            std::uint32_t &slice_1 = *reinterpret_cast<std::uint32_t *>(buffer);
-            std::uint32_t &slice_2 = *reinterpret_cast<std::uint32_t *>(buffer + 4);
-            std::int32_t sum = 0xC6EF3720;
+        if(output != encrypted_shader_data) {
+            std::memmove(output, encrypted_shader_data, size);
+        }
 
-            for(std::size_t i = 0; i < 32; i++) {
-                slice_2 -= (((slice_1 >> 0x5) + key[0]) ^ ((slice_1 << 0x4) + key[1])) ^ (sum + slice_1);
-                slice_1 -= (((slice_2 << 0x4) + key[2]) ^ ((slice_2 >> 0x5) + key[3])) ^ (sum + slice_2);
-                sum = static_cast<std::uint64_t>(sum) + delta;
-            }
-        };
+        if(size % 8) {
+            decrypt_blocks(output + size - 8, 1, key);
+        }
 
-        auto buffer = encrypted_shader_data;
-        auto buffer_size = buffer.size();
+        decrypt_blocks(output, size / 8, key);
 
-        if(buffer_size % 8) {
-            decrypt_block(buffer.data() + buffer_size - 8);
+        // Check if decrypted data is valid
+        char hash[32];
+        std::size_t shader_size = size - trailer_size;
+        hash_shader_data(output, shader_size, hash);
+        if(std::memcmp(hash, output + shader_size, sizeof(hash)) != 0) {
+            return { Status::checksum_failed };
         }
 
-        for(std::size_t i = 0; i < buffer_size / 8; i++) {
-            decrypt_block(buffer.data() + i * 8);
+        // Check if it is all good
+        if(output[size - 1] != 0) {
+            return { Status::not_null_terminated };
         }
 
-        // Decrypted data MD5 hash
-        char hash[32];
-        std::copy(buffer.end() - 33, buffer.end() - 1, hash);
+        output_size = shader_size;
+        return {};
+    }
 
-        // Check if decrypted data is valid
-        MD5 md5;
-        if(md5(buffer.data(), buffer.size() - 33) != std::string(hash, 32)) {
-            throw std::runtime_error("decrypted data checksum failed");
+    Result try_encrypt_shader(char const *shader_data, std::size_t size, char *output, std::size_t &output_size, Key const &key) noexcept {
+        if(size < 8) {
+            return { Status::data_too_small };
         }
 
-        // Check if it is all good
-        if(buffer.back() != 0) {
-            throw std::runtime_error("decrypted data is not null terminated");
+        if(output != shader_data) {
+            std::memmove(output, shader_data, size);
+        }
+
+        // Append shader data hash and encrypt
+        char hash[32];
+        hash_shader_data(output, size, hash);
+        auto buffer_size = seal_shader_data(output, size, hash, key);
+
+        output_size = buffer_size;
+        return {};
+    }
+
+    std::vector<char> decrypt_shader(std::vector<char> const &encrypted_shader_data, Key const &key) {
+        std::vector<char> buffer(encrypted_shader_data.size());
+        std::size_t buffer_size;
+
+        auto result = try_decrypt_shader(encrypted_shader_data.data(), encrypted_shader_data.size(), buffer.data(), buffer_size, key);
+        if(!result) {
+            throw std::runtime_error(status_message(result.status));
         }
 
         // Remove decrypted data checksum
-        buffer.resize(buffer.size() - 33);
+        buffer.resize(buffer_size);
 
-        return std::move(buffer);
+        return buffer;
     }
 
-    std::vector<char> encrypt_shader(std::vector<char> const &shader_data) {
-        if(shader_data.size() < 8) {
-            throw std::runtime_error("shader data is too small");
+    std::vector<char> encrypt_shader(std::vector<char> const &shader_data, Key const &key) {
+        std::vector<char> buffer(shader_data.size() + trailer_size);
+        std::size_t buffer_size;
+
+        auto result = try_encrypt_shader(shader_data.data(), shader_data.size(), buffer.data(), buffer_size, key);
+        if(!result) {
+            throw std::runtime_error(status_message(result.status));
         }
 
-        auto encrypt_block = [](char *buffer) {
-            std::uint32_t &slice_1 = *reinterpret_cast<std::uint32_t *>(buffer);
-            std::uint32_t &slice_2 = *reinterpret_cast<std::uint32_t *>(buffer + 4);
-            std::int32_t sum = 0;
+        return buffer;
+    }
 
-            for(std::size_t i = 0; i < 32; i++) {
-                sum = static_cast<std::uint64_t>(sum) - delta;
-                slice_1 += (((slice_2 << 0x4) + key[2]) ^ ((slice_2 >> 0x5) + key[3])) ^ (sum + slice_2);
-                slice_2 += (((slice_1 >> 0x5) + key[0]) ^ ((slice_1 << 0x4) + key[1])) ^ (sum + slice_1);
-            }
-        };
+    Result try_shader_fingerprint(char const *encrypted_shader_data, std::size_t size, unsigned char fingerprint[16], Key const &key) noexcept {
+        if(size < trailer_size) {
+            return { Status::data_too_small };
+        }
 
-        // Hash shader data
-        MD5 md5;
-        std::string hash = md5(shader_data.data(), shader_data.size());
+        char trailer[trailer_size];
+        decrypt_trailer(encrypted_shader_data, 0, size, key, trailer);
+        return trailer_fingerprint(trailer, fingerprint);
+    }
 
-        auto buffer = shader_data;
-        buffer.insert(buffer.end(), hash.begin(), hash.end());
-        buffer.push_back(0); // all good
-        
-        auto buffer_size = buffer.size();
+    bool detect_shader_key(char const *encrypted_shader_data, std::size_t size, Key const *keys, std::size_t key_count, std::size_t &key_index) noexcept {
+        if(size < trailer_size) {
+            return false;
+        }
+        return detect_trailer_key(encrypted_shader_data, 0, size, keys, key_count, key_index);
+    }
 
-        for(std::size_t i = 0; i < buffer_size / 8; i++) {
-            encrypt_block(buffer.data() + i * 8);
+    /** Bytes of small jobs run together, so the pool isn't fed tiny items */
+    constexpr const std::size_t job_group_size = 1 << 20;
+
+    /**
+     * Run jobs in groups on a pool
+     */
+    template<typename Operation>
+    static bool run_jobs(ShaderJob *jobs, std::size_t count, WorkerPool *pool, JobCallback const &callback, Operation &&operation) {
+        std::vector<std::size_t> group_starts;
+        std::size_t group_bytes = job_group_size;
+        for(std::size_t i = 0; i < count; i++) {
+            if(group_bytes >= job_group_size) {
+                group_starts.push_back(i);
+                group_bytes = 0;
+            }
+            group_bytes += std::max<std::size_t>(jobs[i].size, 1024);
         }
+        group_starts.push_back(count);
 
-        if(buffer_size % 8) {
-            encrypt_block(buffer.data() + buffer_size - 8);
+        auto *workers = pool;
+        if(!workers) {
+            try {
+                workers = &shared_worker_pool();
+            }
+            catch(std::system_error const &e) {
+                // Starting the shared pool, e.g. EAGAIN at the thread limit
+                for(std::size_t i = 0; i < count; i++) {
+                    jobs[i].result = { Status::thread_failed, e.code().value() };
+                    if(callback) {
+                        callback(i, jobs[i].result);
+                    }
+                }
+                return count == 0;
+            }
         }
 
-        return std::move(buffer);
+        std::atomic<bool> failed(false);
+        workers->parallel_for(group_starts.size() - 1, [&](std::size_t group) {
+            for(std::size_t i = group_starts[group]; i < group_starts[group + 1]; i++) {
+                auto &job = jobs[i];
+                job.result = operation(job);
+                if(!job.result) {
+                    failed = true;
+                }
+                if(callback) {
+                    callback(i, job.result);
+                }
+            }
+        });
+
+        return !failed;
+    }
+
+    bool decrypt_many(ShaderJob *jobs, std::size_t count, WorkerPool *pool, JobCallback const &callback, Key const &key) {
+        return run_jobs(jobs, count, pool, callback, [&](ShaderJob &job) {
+            return try_decrypt_shader(job.input, job.size, job.output, job.output_size, key);
+        });
+    }
+
+    bool encrypt_many(ShaderJob *jobs, std::size_t count, WorkerPool *pool, JobCallback const &callback, Key const &key) {
+        return run_jobs(jobs, count, pool, callback, [&](ShaderJob &job) {
+            return try_encrypt_shader(job.input, job.size, job.output, job.output_size, key);
+        });
     }
 }
@@ -1,117 +1,361 @@
 // SPDX-License-Identifier: GPL-3.0-only
 
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <new>
 #include <string>
-#include <vector>
 #include <fstream>
+#include <sstream>
 #include <filesystem>
 #include <stdexcept>
+#include <system_error>
+#include <vector>
+#include <composer/buffer.hpp>
 #include <composer/encrypt.hpp>
+#include <composer/file.hpp>
+#include <composer/profile.hpp>
+#include <composer/worker_pool.hpp>
+#include "file_io.hpp"
+#include "output_file.hpp"
+#include "trailer.hpp"
 
 namespace Composer {
-    static std::vector<char> read_file(std::filesystem::path filepath) {
-        if(!std::filesystem::exists(filepath)) {
-            std::stringstream error;
-            error << "Input file '" << filepath << "' does not exists!";
-            throw std::runtime_error(error.str());
+    Result read_file(std::filesystem::path const &filepath, std::size_t extra_capacity, Buffer &buffer, std::size_t &size) noexcept {
+        std::error_code ec;
+        if(!std::filesystem::exists(filepath, ec)) {
+            return { Status::file_not_found, ENOENT };
         }
 
         try {
             std::ifstream file;
             file.open(filepath, std::ios_base::in | std::ios_base::binary);
-            
+            if(!file) {
+                return { Status::read_failed, errno };
+            }
+
             // Get file size
             file.seekg(0, std::ios::end);
-            std::size_t filesize = file.tellg();
+            auto filesize = file.tellg();
             file.seekg(0, std::ios::beg);
+            if(filesize < 0) {
+                return { Status::read_failed, errno };
+            }
 
-            std::vector<char> buffer(filesize);
-            file.read(buffer.data(), filesize);
+            // Leave room for the operation to work in place
+            size = static_cast<std::size_t>(filesize);
+            if(!buffer.reserve(size + extra_capacity)) {
+                return { Status::out_of_memory };
+            }
+            file.read(buffer.data(), size);
+            if(!file) {
+                return { Status::read_failed, errno };
+            }
 
-            file.close();
-
-            return std::move(buffer);
+            return {};
+        }
+        catch(std::bad_alloc const &) {
+            return { Status::out_of_memory };
         }
         catch(...) {
-            throw;
+            return { Status::read_failed };
+        }
+    }
+
+    Result write_file(std::filesystem::path const &filepath, char const *data, std::size_t size) noexcept {
+        OutputFile file;
+        auto result = file.open(filepath);
+        if(!result) {
+            return result;
+        }
+
+        result = file.write(data, size);
+        if(!result) {
+            return result;
         }
+
+        return file.commit();
     }
 
-    static void write_file(std::filesystem::path filepath, std::vector<char> data) {
+    /**
+     * Read only the blocks of an encrypted shader file holding the trailer
+     */
+    static Result read_trailer_window(std::filesystem::path const &filepath, char window[trailer_window_size], std::uint64_t &window_offset, std::uint64_t &size) noexcept {
+        std::error_code ec;
+        if(!std::filesystem::exists(filepath, ec)) {
+            return { Status::file_not_found, ENOENT };
+        }
+
         try {
-            std::ofstream file;
-            file.open(filepath, std::ios_base::out | std::ios_base::binary);
+            std::ifstream file;
+            file.open(filepath, std::ios_base::in | std::ios_base::binary);
+            if(!file) {
+                return { Status::read_failed, errno };
+            }
 
-            file.write(data.data(), data.size());
-            file.close();
+            file.seekg(0, std::ios::end);
+            auto filesize = file.tellg();
+            if(filesize < 0) {
+                return { Status::read_failed, errno };
+            }
+
+            size = static_cast<std::uint64_t>(filesize);
+            if(size < trailer_size) {
+                return { Status::data_too_small };
+            }
+
+            window_offset = trailer_window_offset(size);
+            file.seekg(window_offset);
+            file.read(window, size - window_offset);
+            if(!file) {
+                return { Status::read_failed, errno };
+            }
+
+            return {};
         }
         catch(...) {
-            throw;
+            return { Status::read_failed };
         }
     }
 
-    void decrypt_shader_file(std::filesystem::path input_file, std::filesystem::path output_file) {
+    static void throw_file_error(Result result, std::filesystem::path const &input_file, const char *operation) {
         std::stringstream error;
-        std::vector<char> input_data;
-        std::vector<char> output_data;
 
-        try {
-            input_data = read_file(input_file);
+        switch(result.status) {
+            case Status::file_not_found:
+                error << "Input file '" << input_file << "' does not exists!" << std::endl;
+                error << "Failed to read input file!" << std::endl;
+                break;
+
+            case Status::read_failed:
+                error << (result.error_number ? std::strerror(result.error_number) : status_message(result.status)) << std::endl;
+                error << "Failed to read input file!" << std::endl;
+                break;
+
+            case Status::write_failed:
+                error << (result.error_number ? std::strerror(result.error_number) : status_message(result.status)) << std::endl;
+                error << "Failed to write output file!" << std::endl;
+                break;
+
+            default:
+                error << status_message(result.status) << std::endl;
+                error << operation << std::endl;
+                break;
         }
-        catch(const std::runtime_error e) {
-            error << e.what() << std::endl;
-            error << "Failed to read input file!" << std::endl;
-            throw std::runtime_error(error.str());
+
+        throw std::runtime_error(error.str());
+    }
+
+    Result try_decrypt_shader_file(std::filesystem::path const &input_file, std::filesystem::path const &output_file, Key const &key) noexcept {
+        Buffer buffer;
+        return try_decrypt_shader_file(input_file, output_file, buffer, key);
+    }
+
+    Result try_encrypt_shader_file(std::filesystem::path const &input_file, std::filesystem::path const &output_file, Key const &key) noexcept {
+        Buffer buffer;
+        return try_encrypt_shader_file(input_file, output_file, buffer, key);
+    }
+
+    Result try_decrypt_shader_file(std::filesystem::path const &input_file, std::filesystem::path const &output_file, Buffer &buffer, Key const &key) noexcept {
+        std::size_t size;
+
+        auto result = read_file(input_file, 0, buffer, size);
+        if(!result) {
+            return result;
         }
 
-        try {
-            output_data = decrypt_shader(input_data);
+        result = try_decrypt_shader(buffer.data(), size, buffer.data(), size, key);
+        if(!result) {
+            return result;
         }
-        catch(const std::runtime_error e) {
-            error << e.what() << std::endl;
-            error << "Failed to decrypt shader!" << std::endl;
-            throw std::runtime_error(error.str());
+
+        return write_file(output_file, buffer.data(), size);
+    }
+
+    Result try_encrypt_shader_file(std::filesystem::path const &input_file, std::filesystem::path const &output_file, Buffer &buffer, Key const &key) noexcept {
+        std::size_t size;
+
+        auto result = read_file(input_file, trailer_size, buffer, size);
+        if(!result) {
+            return result;
         }
 
-        try {
-            write_file(output_file, output_data);
+        result = try_encrypt_shader(buffer.data(), size, buffer.data(), size, key);
+        if(!result) {
+            return result;
         }
-        catch(const std::runtime_error e) {
-            error << e.what() << std::endl;
-            error << "Failed to write output file!" << std::endl;
-            throw std::runtime_error(error.str());
+
+        return write_file(output_file, buffer.data(), size);
+    }
+
+    Result try_shader_file_fingerprint(std::filesystem::path const &input_file, unsigned char fingerprint[16], Key const &key) noexcept {
+        char window[trailer_window_size];
+        std::uint64_t window_offset;
+        std::uint64_t size;
+        auto result = read_trailer_window(input_file, window, window_offset, size);
+        if(!result) {
+            return result;
         }
+
+        char trailer[trailer_size];
+        decrypt_trailer(window, window_offset, size, key, trailer);
+        return trailer_fingerprint(trailer, fingerprint);
     }
 
-    void encrypt_shader_file(std::filesystem::path input_file, std::filesystem::path output_file) {
-        std::stringstream error;
-        std::vector<char> input_data;
-        std::vector<char> output_data;
-        
-        try {
-            input_data = read_file(input_file);
+    Result try_detect_shader_file_key(std::filesystem::path const &input_file, Key const *keys, std::size_t key_count, std::size_t &key_index) noexcept {
+        char window[trailer_window_size];
+        std::uint64_t window_offset;
+        std::uint64_t size;
+        auto result = read_trailer_window(input_file, window, window_offset, size);
+        if(!result) {
+            return result;
         }
-        catch(const std::runtime_error e) {
-            error << e.what() << std::endl;
-            error << "Failed to read input file!" << std::endl;
-            throw std::runtime_error(error.str());
+
+        if(!detect_trailer_key(window, window_offset, size, keys, key_count, key_index)) {
+            return { Status::key_not_found };
         }
 
-        try {
-            output_data = encrypt_shader(input_data);
+        return {};
+    }
+
+    /**
+     * Check if the machine profile wants the pipelined mode for a file
+     */
+    static bool use_pipeline(std::filesystem::path const &input_file, Profile const &profile) noexcept {
+        if(profile.pipeline_threshold == 0) {
+            return false;
         }
-        catch(const std::runtime_error e) {
-            error << e.what() << std::endl;
-            error << "Failed to encrypt shader!" << std::endl;
-            throw std::runtime_error(error.str());
+        std::error_code ec;
+        auto size = std::filesystem::file_size(input_file, ec);
+        return !ec && size >= profile.pipeline_threshold;
+    }
+
+    void decrypt_shader_file(std::filesystem::path input_file, std::filesystem::path output_file, Key const &key) {
+        Profile profile;
+        read_machine_profile(profile);
+        if(use_pipeline(input_file, profile)) {
+            return decrypt_shader_file(input_file, output_file, profile.pipeline, key);
         }
 
-        try {
-            write_file(output_file, output_data);
+        auto result = try_decrypt_shader_file(input_file, output_file, key);
+        if(!result) {
+            throw_file_error(result, input_file, "Failed to decrypt shader!");
+        }
+    }
+
+    void encrypt_shader_file(std::filesystem::path input_file, std::filesystem::path output_file, Key const &key) {
+        Profile profile;
+        read_machine_profile(profile);
+        if(use_pipeline(input_file, profile)) {
+            return encrypt_shader_file(input_file, output_file, profile.pipeline, key);
+        }
+
+        auto result = try_encrypt_shader_file(input_file, output_file, key);
+        if(!result) {
+            throw_file_error(result, input_file, "Failed to encrypt shader!");
+        }
+    }
+
+    void decrypt_shader_file(std::filesystem::path input_file, std::filesystem::path output_file, PipelineOptions const &options, Key const &key) {
+        auto result = try_decrypt_shader_file(input_file, output_file, options, key);
+        if(!result) {
+            throw_file_error(result, input_file, "Failed to decrypt shader!");
         }
-        catch(const std::runtime_error e) {
-            error << e.what() << std::endl;
-            error << "Failed to write output file!" << std::endl;
-            throw std::runtime_error(error.str());
+    }
+
+    void encrypt_shader_file(std::filesystem::path input_file, std::filesystem::path output_file, PipelineOptions const &options, Key const &key) {
+        auto result = try_encrypt_shader_file(input_file, output_file, options, key);
+        if(!result) {
+            throw_file_error(result, input_file, "Failed to encrypt shader!");
+        }
+    }
+
+    void transcode_shader_file(std::filesystem::path input_file, std::filesystem::path output_file, Key const &from_key, Key const &to_key) {
+        auto result = try_transcode_shader_file(input_file, output_file, from_key, to_key);
+        if(!result) {
+            throw_file_error(result, input_file, "Failed to transcode shader!");
+        }
+    }
+
+    /**
+     * Run file jobs largest first on a pool. Buffers are lent to the threads for this call only,
+     * so the pool's long-lived threads don't keep them afterwards.
+     */
+    template<typename Operation>
+    static bool run_file_jobs(ShaderFileJob *jobs, std::size_t count, WorkerPool *pool, JobCallback const &callback, Operation &&operation) {
+        auto *workers = pool;
+        if(!workers) {
+            try {
+                workers = &shared_worker_pool();
+            }
+            catch(std::system_error const &e) {
+                // Starting the shared pool, e.g. EAGAIN at the thread limit
+                for(std::size_t i = 0; i < count; i++) {
+                    jobs[i].result = { Status::thread_failed, e.code().value() };
+                    if(callback) {
+                        callback(i, jobs[i].result);
+                    }
+                }
+                return count == 0;
+            }
+        }
+
+        std::vector<std::uint64_t> sizes(count);
+        std::vector<std::size_t> order(count);
+        for(std::size_t i = 0; i < count; i++) {
+            std::error_code ec;
+            auto size = std::filesystem::file_size(jobs[i].input_file, ec);
+            sizes[i] = ec ? 0 : size;
+            order[i] = i;
         }
+        std::stable_sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) {
+            return sizes[a] > sizes[b];
+        });
+
+        // At most one per pool thread plus the caller, so returning one never reallocates
+        std::mutex buffers_mutex;
+        std::vector<Buffer> buffers;
+        buffers.reserve(workers->size() + 1);
+
+        std::atomic<bool> failed(false);
+        workers->parallel_for(count, [&](std::size_t item) {
+            Buffer buffer;
+            {
+                std::lock_guard<std::mutex> lock(buffers_mutex);
+                if(!buffers.empty()) {
+                    buffer = std::move(buffers.back());
+                    buffers.pop_back();
+                }
+            }
+
+            auto index = order[item];
+            auto &job = jobs[index];
+            job.result = operation(job, buffer);
+            if(!job.result) {
+                failed = true;
+            }
+            if(callback) {
+                callback(index, job.result);
+            }
+
+            std::lock_guard<std::mutex> lock(buffers_mutex);
+            buffers.push_back(std::move(buffer));
+        });
+
+        return !failed;
+    }
+
+    bool decrypt_many(ShaderFileJob *jobs, std::size_t count, WorkerPool *pool, JobCallback const &callback, Key const &key) {
+        return run_file_jobs(jobs, count, pool, callback, [&](ShaderFileJob &job, Buffer &buffer) {
+            return try_decrypt_shader_file(job.input_file, job.output_file, buffer, key);
+        });
+    }
+
+    bool encrypt_many(ShaderFileJob *jobs, std::size_t count, WorkerPool *pool, JobCallback const &callback, Key const &key) {
+        return run_file_jobs(jobs, count, pool, callback, [&](ShaderFileJob &job, Buffer &buffer) {
+            return try_encrypt_shader_file(job.input_file, job.output_file, buffer, key);
+        });
     }
 }
@@ -0,0 +1,32 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef COMPOSER__FILE_IO_HPP
+#define COMPOSER__FILE_IO_HPP
+
+#include <cstddef>
+#include <filesystem>
+#include <composer/buffer.hpp>
+#include <composer/result.hpp>
+
+namespace Composer {
+    /**
+     * Read a whole file into a buffer
+     * @param filepath          path to the file
+     * @param extra_capacity    bytes to leave after the data, so operations can work in place
+     * @param buffer            scratch buffer, grown if too small
+     * @param size              set to the size of the file
+     * @return                  result of the operation
+     */
+    Result read_file(std::filesystem::path const &filepath, std::size_t extra_capacity, Buffer &buffer, std::size_t &size) noexcept;
+
+    /**
+     * Write a whole file, replacing it atomically
+     * @param filepath  path to the file
+     * @param data      data
+     * @param size      size of the data
+     * @return          result of the operation
+     */
+    Result write_file(std::filesystem::path const &filepath, char const *data, std::size_t size) noexcept;
+}
+
+#endif
@@ -0,0 +1,92 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <cstring>
+#include <composer/hash.hpp>
+
+namespace Composer {
+    constexpr std::uint64_t prime1 = 0x9E3779B185EBCA87ULL;
+    constexpr std::uint64_t prime2 = 0xC2B2AE3D27D4EB4FULL;
+    constexpr std::uint64_t prime3 = 0x165667B19E3779F9ULL;
+    constexpr std::uint64_t prime4 = 0x85EBCA77C2B2AE63ULL;
+    constexpr std::uint64_t prime5 = 0x27D4EB2F165667C5ULL;
+
+    static inline std::uint64_t rotate_left(std::uint64_t value, int bits) noexcept {
+        return (value << bits) | (value >> (64 - bits));
+    }
+
+    static inline std::uint64_t read_u64(unsigned char const *data) noexcept {
+        std::uint64_t value = 0;
+        for(std::size_t i = 0; i < 8; i++) {
+            value |= static_cast<std::uint64_t>(data[i]) << (i * 8);
+        }
+        return value;
+    }
+
+    static inline std::uint32_t read_u32(unsigned char const *data) noexcept {
+        std::uint32_t value = 0;
+        for(std::size_t i = 0; i < 4; i++) {
+            value |= static_cast<std::uint32_t>(data[i]) << (i * 8);
+        }
+        return value;
+    }
+
+    static inline std::uint64_t hash_round(std::uint64_t accumulator, std::uint64_t input) noexcept {
+        accumulator += input * prime2;
+        accumulator = rotate_left(accumulator, 31);
+        return accumulator * prime1;
+    }
+
+    static inline std::uint64_t merge_round(std::uint64_t hash, std::uint64_t accumulator) noexcept {
+        hash ^= hash_round(0, accumulator);
+        return hash * prime1 + prime4;
+    }
+
+    std::uint64_t fast_hash64(void const *data, std::size_t size, std::uint64_t seed) noexcept {
+        auto const *input = static_cast<unsigned char const *>(data);
+        auto const *end = input + size;
+        std::uint64_t hash;
+
+        // Four independent lanes over 32-byte stripes
+        if(size >= 32) {
+            std::uint64_t lanes[4] = { seed + prime1 + prime2, seed + prime2, seed, seed - prime1 };
+            do {
+                for(std::size_t lane = 0; lane < 4; lane++) {
+                    lanes[lane] = hash_round(lanes[lane], read_u64(input + lane * 8));
+                }
+                input += 32;
+            }
+            while(end - input >= 32);
+
+            hash = rotate_left(lanes[0], 1) + rotate_left(lanes[1], 7) + rotate_left(lanes[2], 12) + rotate_left(lanes[3], 18);
+            for(std::size_t lane = 0; lane < 4; lane++) {
+                hash = merge_round(hash, lanes[lane]);
+            }
+        }
+        else {
+            hash = seed + prime5;
+        }
+
+        hash += static_cast<std::uint64_t>(size);
+
+        for(; end - input >= 8; input += 8) {
+            hash ^= hash_round(0, read_u64(input));
+            hash = rotate_left(hash, 27) * prime1 + prime4;
+        }
+        if(end - input >= 4) {
+            hash ^= static_cast<std::uint64_t>(read_u32(input)) * prime1;
+            hash = rotate_left(hash, 23) * prime2 + prime3;
+            input += 4;
+        }
+        for(; input < end; input++) {
+            hash ^= *input * prime5;
+            hash = rotate_left(hash, 11) * prime1;
+        }
+
+        hash ^= hash >> 33;
+        hash *= prime2;
+        hash ^= hash >> 29;
+        hash *= prime3;
+        hash ^= hash >> 32;
+        return hash;
+    }
+}
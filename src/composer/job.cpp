@@ -0,0 +1,140 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <composer/encrypt.hpp>
+#include <composer/job.hpp>
+#include "checksum.hpp"
+
+namespace Composer {
+    /** Blocks decrypted between two looks at the clock and the cancellation flag */
+    constexpr const std::size_t job_slice_blocks = 128;
+
+    DecryptJob::DecryptJob(char const *encrypted_shader_data, std::size_t size, char *output, Key const &key) noexcept : input(encrypted_shader_data), output(output), size(size), key(key) {
+        if(size < trailer_size) {
+            this->finish({ Status::data_too_small });
+        }
+    }
+
+    bool DecryptJob::step(StepBudget const &budget) noexcept {
+        if(this->done) {
+            return true;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        auto stop = budget.max_time.count() > 0 ? now + budget.max_time : std::chrono::steady_clock::time_point::max();
+        std::size_t blocks_left = budget.max_blocks > 0 ? budget.max_blocks : std::numeric_limits<std::size_t>::max();
+
+        std::size_t block_count = this->size / 8;
+        std::size_t shader_size = this->size - trailer_size;
+
+        while(true) {
+            if(this->cancelled.load(std::memory_order_relaxed)) {
+                this->finish({ Status::cancelled });
+                return true;
+            }
+            if(now >= this->deadline) {
+                this->finish({ Status::deadline_exceeded });
+                return true;
+            }
+            if(blocks_left == 0 || now >= stop) {
+                return false;
+            }
+
+            // The overlapping last block goes first, as in try_decrypt_shader
+            if(!this->tail_done) {
+                if(this->size % 8) {
+                    if(this->output != this->input) {
+                        std::memcpy(this->output + this->size - 8, this->input + this->size - 8, 8);
+                    }
+                    decrypt_blocks(this->output + this->size - 8, 1, this->key);
+                    blocks_left--;
+                }
+                this->tail_done = true;
+            }
+            else if(this->next_block < block_count) {
+                std::size_t count = std::min({ job_slice_blocks, blocks_left, block_count - this->next_block });
+                std::size_t begin = this->next_block * 8;
+                std::size_t end = begin + count * 8;
+
+                if(this->output != this->input) {
+                    // Bytes from size - 8 on already went through the tail step
+                    std::size_t copy_end = this->size % 8 ? std::min(end, this->size - 8) : end;
+                    if(copy_end > begin) {
+                        std::memcpy(this->output + begin, this->input + begin, copy_end - begin);
+                    }
+                }
+                decrypt_blocks(this->output + begin, count, this->key);
+                this->next_block += count;
+                blocks_left -= count;
+
+                // Everything before the next block is final
+                std::size_t final_size = std::min(end, shader_size);
+                if(final_size > this->hashed) {
+                    this->md5.add(this->output + this->hashed, final_size - this->hashed);
+                    this->hashed = final_size;
+                }
+            }
+            else {
+                this->check_trailer();
+                return true;
+            }
+
+            if(budget.max_time.count() > 0 || this->deadline != std::chrono::steady_clock::time_point::max()) {
+                now = std::chrono::steady_clock::now();
+            }
+        }
+    }
+
+    void DecryptJob::check_trailer() noexcept {
+        char hash[32];
+        format_checksum(this->md5, hash);
+
+        std::size_t shader_size = this->size - trailer_size;
+        if(std::memcmp(hash, this->output + shader_size, sizeof(hash)) != 0) {
+            this->finish({ Status::checksum_failed });
+        }
+        else if(this->output[this->size - 1] != 0) {
+            this->finish({ Status::not_null_terminated });
+        }
+        else {
+            this->finish({});
+        }
+    }
+
+    void DecryptJob::finish(Result result) noexcept {
+        this->done = true;
+        this->outcome = result;
+    }
+
+    void DecryptJob::cancel() noexcept {
+        this->cancelled.store(true, std::memory_order_relaxed);
+    }
+
+    void DecryptJob::set_deadline(std::chrono::steady_clock::time_point deadline) noexcept {
+        this->deadline = deadline;
+    }
+
+    bool DecryptJob::finished() const noexcept {
+        return this->done;
+    }
+
+    Result DecryptJob::result() const noexcept {
+        return this->outcome;
+    }
+
+    std::size_t DecryptJob::output_size() const noexcept {
+        return this->done && this->outcome ? this->size - trailer_size : 0;
+    }
+
+    double DecryptJob::progress() const noexcept {
+        if(this->done && this->outcome) {
+            return 1;
+        }
+        if(this->size / 8 == 0) {
+            return 0;
+        }
+        return static_cast<double>(this->next_block) / static_cast<double>(this->size / 8);
+    }
+}
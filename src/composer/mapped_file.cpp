@@ -0,0 +1,110 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <cerrno>
+#include <fstream>
+#include <utility>
+#include <composer/mapped_file.hpp>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define COMPOSER_HAS_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Composer {
+    MappedFile::MappedFile(MappedFile &&other) noexcept :
+        memory(std::exchange(other.memory, nullptr)),
+        length(std::exchange(other.length, 0)),
+        buffer(std::move(other.buffer)) {}
+
+    MappedFile &MappedFile::operator=(MappedFile &&other) noexcept {
+        if(this != &other) {
+            this->close();
+            this->memory = std::exchange(other.memory, nullptr);
+            this->length = std::exchange(other.length, 0);
+            this->buffer = std::move(other.buffer);
+        }
+        return *this;
+    }
+
+    MappedFile::~MappedFile() {
+        this->close();
+    }
+
+    Result MappedFile::open(std::filesystem::path const &filepath) noexcept {
+        this->close();
+
+#ifdef COMPOSER_HAS_MMAP
+        int fd = ::open(filepath.c_str(), O_RDONLY | O_CLOEXEC);
+        if(fd < 0) {
+            return { errno == ENOENT ? Status::file_not_found : Status::read_failed, errno };
+        }
+
+        struct stat info;
+        if(fstat(fd, &info) != 0) {
+            int error_number = errno;
+            ::close(fd);
+            return { Status::read_failed, error_number };
+        }
+
+        if(info.st_size > 0) {
+            void *memory = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(memory == MAP_FAILED) {
+                int error_number = errno;
+                ::close(fd);
+                return { Status::read_failed, error_number };
+            }
+            this->memory = static_cast<char const *>(memory);
+            this->length = static_cast<std::size_t>(info.st_size);
+        }
+
+        // The mapping keeps its own reference to the file
+        ::close(fd);
+        return {};
+#else
+        std::error_code ec;
+        if(!std::filesystem::exists(filepath, ec)) {
+            return { Status::file_not_found, ENOENT };
+        }
+
+        try {
+            std::ifstream file(filepath, std::ios_base::in | std::ios_base::binary);
+            auto filesize = std::filesystem::file_size(filepath, ec);
+            if(!file || ec) {
+                return { Status::read_failed, errno };
+            }
+
+            if(!this->buffer.allocate(filesize)) {
+                return { Status::out_of_memory };
+            }
+
+            file.read(this->buffer.data(), filesize);
+            if(!file) {
+                this->buffer.release();
+                return { Status::read_failed, errno };
+            }
+        }
+        catch(...) {
+            this->buffer.release();
+            return { Status::read_failed };
+        }
+
+        this->memory = this->buffer.data();
+        this->length = this->buffer.size();
+        return {};
+#endif
+    }
+
+    void MappedFile::close() noexcept {
+#ifdef COMPOSER_HAS_MMAP
+        if(this->memory && !this->buffer.data()) {
+            munmap(const_cast<char *>(this->memory), this->length);
+        }
+#endif
+        this->buffer.release();
+        this->memory = nullptr;
+        this->length = 0;
+    }
+}
@@ -0,0 +1,180 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <composer/numa.hpp>
+
+#ifdef __linux__
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace Composer {
+    static thread_local std::size_t thread_numa_node = no_numa_node;
+
+    /**
+     * Parse a CPU number of a CPU list
+     */
+    static bool parse_cpu_number(std::string const &text, unsigned long &number) noexcept {
+        if(text.empty() || text.size() > 5 || text.find_first_not_of("0123456789") != std::string::npos) {
+            return false;
+        }
+        number = std::strtoul(text.c_str(), nullptr, 10);
+        return true;
+    }
+
+    bool parse_cpu_list(std::string const &text, std::vector<unsigned> &cpus) noexcept {
+        try {
+            std::vector<unsigned> parsed;
+            std::size_t position = 0;
+            while(position < text.size()) {
+                auto end = text.find(',', position);
+                if(end == std::string::npos) {
+                    end = text.size();
+                }
+
+                auto range = text.substr(position, end - position);
+                auto dash = range.find('-');
+                unsigned long first;
+                unsigned long last;
+                if(!parse_cpu_number(range.substr(0, dash), first) || !parse_cpu_number(dash == std::string::npos ? range : range.substr(dash + 1), last) || last < first) {
+                    return false;
+                }
+
+                for(auto cpu = first; cpu <= last; cpu++) {
+                    parsed.push_back(static_cast<unsigned>(cpu));
+                }
+                position = end + 1;
+            }
+
+            if(parsed.empty()) {
+                return false;
+            }
+            cpus = std::move(parsed);
+            return true;
+        }
+        catch(...) {
+            return false;
+        }
+    }
+
+    bool parse_numa_topology(std::string const &text, NumaTopology &topology) noexcept {
+        try {
+            NumaTopology parsed;
+            std::size_t position = 0;
+            while(position <= text.size()) {
+                auto end = text.find('/', position);
+                if(end == std::string::npos) {
+                    end = text.size();
+                }
+
+                NumaNode node;
+                node.id = parsed.nodes.size();
+                if(!parse_cpu_list(text.substr(position, end - position), node.cpus)) {
+                    return false;
+                }
+                parsed.nodes.push_back(std::move(node));
+                position = end + 1;
+            }
+
+            topology = std::move(parsed);
+            return true;
+        }
+        catch(...) {
+            return false;
+        }
+    }
+
+    Result read_numa_topology(NumaTopology &topology, std::filesystem::path const &root) noexcept {
+        try {
+            std::error_code ec;
+            if(!std::filesystem::is_directory(root, ec)) {
+                return { Status::file_not_found };
+            }
+
+            NumaTopology parsed;
+            for(auto const &entry : std::filesystem::directory_iterator(root, ec)) {
+                auto name = entry.path().filename().string();
+                if(name.size() <= 4 || name.compare(0, 4, "node") != 0 || name.find_first_not_of("0123456789", 4) != std::string::npos) {
+                    continue;
+                }
+
+                std::ifstream file(entry.path() / "cpulist");
+                std::string line;
+                if(!file || !std::getline(file, line)) {
+                    return { Status::read_failed };
+                }
+
+                // Memory-only nodes have an empty list
+                NumaNode node;
+                node.id = std::stoul(name.substr(4));
+                if(parse_cpu_list(line, node.cpus)) {
+                    parsed.nodes.push_back(std::move(node));
+                }
+            }
+            if(ec) {
+                return { Status::read_failed, ec.value() };
+            }
+
+            std::sort(parsed.nodes.begin(), parsed.nodes.end(), [](NumaNode const &a, NumaNode const &b) {
+                return a.id < b.id;
+            });
+            topology = std::move(parsed);
+            return {};
+        }
+        catch(...) {
+            return { Status::read_failed };
+        }
+    }
+
+    NumaTopology const &system_numa_topology() {
+        static const NumaTopology topology = []() {
+            NumaTopology topology;
+            if(char const *fake = std::getenv("COMPOSER_NUMA_TOPOLOGY")) {
+                if(std::string(fake) != "off") {
+                    parse_numa_topology(fake, topology);
+                }
+                return topology;
+            }
+
+            read_numa_topology(topology);
+            return topology;
+        }();
+        return topology;
+    }
+
+    bool bind_thread_to_numa_node(NumaNode const &node) noexcept {
+        thread_numa_node = node.id;
+
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for(auto cpu : node.cpus) {
+            if(cpu < CPU_SETSIZE) {
+                CPU_SET(cpu, &set);
+            }
+        }
+
+        // Fails for CPUs that don't exist, e.g. with a fake topology
+        bool pinned = pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+
+        // Pages the thread faults in come from its node even if the process has another policy
+        constexpr const std::size_t mask_bits = sizeof(unsigned long) * 8;
+        if(node.id < mask_bits) {
+            unsigned long mask = 1ul << node.id;
+            ::syscall(SYS_set_mempolicy, MPOL_PREFERRED, &mask, mask_bits);
+        }
+        return pinned;
+#else
+        return false;
+#endif
+    }
+
+    std::size_t current_numa_node() noexcept {
+        return thread_numa_node;
+    }
+}
@@ -0,0 +1,246 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <atomic>
+#include <cerrno>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <composer/file.hpp>
+#include "output_file.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define COMPOSER_HAS_POSIX_IO
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Composer {
+    namespace {
+        /** Ending of temporary_output_path names */
+        constexpr const char *temporary_suffix = ".tmp";
+
+        std::mutex outputs_mutex;
+
+#ifdef __linux__
+        /** A directory per filesystem with outputs not synced yet, for syncfs */
+        std::unordered_map<dev_t, int> pending_filesystems;
+#else
+        bool outputs_pending = false;
+#endif
+    }
+
+    std::filesystem::path temporary_output_path(std::filesystem::path const &filepath) {
+        static std::atomic<unsigned long> counter(0);
+#ifdef COMPOSER_HAS_POSIX_IO
+        auto process = static_cast<unsigned long>(::getpid());
+#else
+        unsigned long process = 0;
+#endif
+
+        // Hidden, and not matching the extensions the tools produce
+        auto name = "." + filepath.filename().string() + "." + std::to_string(process) + "-" + std::to_string(counter++) + temporary_suffix;
+        return filepath.parent_path() / name;
+    }
+
+    bool is_temporary_output_path(std::filesystem::path const &filepath) {
+        auto name = filepath.filename().string();
+        std::size_t suffix_size = std::char_traits<char>::length(temporary_suffix);
+        if(name.size() <= suffix_size + 1 || name.front() != '.' || name.compare(name.size() - suffix_size, suffix_size, temporary_suffix) != 0) {
+            return false;
+        }
+
+        // ".<name>.<process>-<counter>" before the suffix, both numbers in decimal
+        std::size_t position = name.size() - suffix_size;
+        for(int number = 0; number < 2; number++) {
+            std::size_t digits_end = position;
+            while(position > 1 && name[position - 1] >= '0' && name[position - 1] <= '9') {
+                position--;
+            }
+            if(position == digits_end || position <= 1 || name[position - 1] != (number == 0 ? '-' : '.')) {
+                return false;
+            }
+            position--;
+        }
+        return true;
+    }
+
+    std::filesystem::path resolve_output_path(std::filesystem::path const &filepath) {
+        auto resolved = filepath;
+
+        // Same limit on chains of links as the kernel
+        std::error_code ec;
+        for(int hops = 0; hops < 40 && std::filesystem::is_symlink(resolved, ec); hops++) {
+            auto target = std::filesystem::read_symlink(resolved, ec);
+            if(ec) {
+                break;
+            }
+            resolved = target.is_absolute() ? target : resolved.parent_path() / target;
+        }
+        return resolved;
+    }
+
+    void note_output(std::filesystem::path const &filepath) noexcept {
+#ifdef __linux__
+        struct stat status;
+        if(::stat(filepath.c_str(), &status) != 0) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(outputs_mutex);
+        if(pending_filesystems.count(status.st_dev)) {
+            return;
+        }
+
+        auto directory = filepath.parent_path();
+        int fd = ::open(directory.empty() ? "." : directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if(fd >= 0) {
+            try {
+                pending_filesystems.emplace(status.st_dev, fd);
+            }
+            catch(...) {
+                ::close(fd);
+            }
+        }
+#else
+        (void)filepath;
+        std::lock_guard<std::mutex> lock(outputs_mutex);
+        outputs_pending = true;
+#endif
+    }
+
+    Result sync_outputs() noexcept {
+#ifdef __linux__
+        std::unordered_map<dev_t, int> filesystems;
+        {
+            std::lock_guard<std::mutex> lock(outputs_mutex);
+            filesystems.swap(pending_filesystems);
+        }
+
+        // One flush per filesystem covers the data and the renames of every output on it
+        Result result;
+        for(auto const &filesystem : filesystems) {
+            if(::syncfs(filesystem.second) != 0 && result) {
+                result = { Status::write_failed, errno };
+            }
+            ::close(filesystem.second);
+        }
+        return result;
+#else
+        {
+            std::lock_guard<std::mutex> lock(outputs_mutex);
+            if(!outputs_pending) {
+                return {};
+            }
+            outputs_pending = false;
+        }
+#ifdef COMPOSER_HAS_POSIX_IO
+        ::sync();
+#endif
+        return {};
+#endif
+    }
+
+    OutputFile::~OutputFile() {
+        this->discard();
+    }
+
+    Result OutputFile::open(std::filesystem::path const &filepath) noexcept {
+        this->discard();
+
+        try {
+            this->filepath = resolve_output_path(filepath);
+            this->temporary_path = temporary_output_path(this->filepath);
+        }
+        catch(...) {
+            return { Status::out_of_memory };
+        }
+
+#ifdef COMPOSER_HAS_POSIX_IO
+        this->fd = ::open(this->temporary_path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+        if(this->fd < 0) {
+            return { Status::write_failed, errno };
+        }
+
+        // A replaced file keeps its permissions, and its owner if we may give it away (else at
+        // least its group); the mode goes last as changing the owner clears set-id bits
+        struct stat status;
+        if(::stat(this->filepath.c_str(), &status) == 0 && S_ISREG(status.st_mode)) {
+            bool owner_kept = ::fchown(this->fd, status.st_uid, status.st_gid) == 0 || ::fchown(this->fd, static_cast<uid_t>(-1), status.st_gid) == 0;
+            (void)owner_kept;
+            ::fchmod(this->fd, status.st_mode & 07777);
+        }
+#else
+        this->file = std::fopen(this->temporary_path.string().c_str(), "wb");
+        if(!this->file) {
+            return { Status::write_failed, errno };
+        }
+#endif
+        return {};
+    }
+
+    Result OutputFile::write(char const *data, std::size_t size) noexcept {
+#ifdef COMPOSER_HAS_POSIX_IO
+        while(size > 0) {
+            auto written = ::write(this->fd, data, size);
+            if(written < 0) {
+                if(errno == EINTR) {
+                    continue;
+                }
+                return { Status::write_failed, errno };
+            }
+            data += written;
+            size -= static_cast<std::size_t>(written);
+        }
+#else
+        if(size > 0 && std::fwrite(data, 1, size, this->file) != size) {
+            return { Status::write_failed, errno };
+        }
+#endif
+        return {};
+    }
+
+    Result OutputFile::commit() noexcept {
+#ifdef COMPOSER_HAS_POSIX_IO
+        int error = ::close(this->fd) == 0 ? 0 : errno;
+        this->fd = -1;
+#else
+        int error = std::fclose(this->file) == 0 ? 0 : errno;
+        this->file = nullptr;
+#endif
+        std::error_code ec;
+        if(error == 0) {
+            std::filesystem::rename(this->temporary_path, this->filepath, ec);
+            error = ec.value();
+        }
+
+        if(error != 0) {
+            std::filesystem::remove(this->temporary_path, ec);
+            this->temporary_path.clear();
+            return { Status::write_failed, error };
+        }
+
+        this->temporary_path.clear();
+        note_output(this->filepath);
+        return {};
+    }
+
+    void OutputFile::discard() noexcept {
+#ifdef COMPOSER_HAS_POSIX_IO
+        if(this->fd >= 0) {
+            ::close(this->fd);
+            this->fd = -1;
+        }
+#else
+        if(this->file) {
+            std::fclose(this->file);
+            this->file = nullptr;
+        }
+#endif
+        if(!this->temporary_path.empty()) {
+            std::error_code ec;
+            std::filesystem::remove(this->temporary_path, ec);
+            this->temporary_path.clear();
+        }
+    }
+}
@@ -0,0 +1,98 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef COMPOSER__OUTPUT_FILE_HPP
+#define COMPOSER__OUTPUT_FILE_HPP
+
+#include <cstddef>
+#include <cstdio>
+#include <filesystem>
+#include <composer/result.hpp>
+
+namespace Composer {
+    /**
+     * File replaced atomically: data goes to a temporary file next to it, which is renamed over
+     * the file on commit and takes over the old file's permissions (and owner, where allowed).
+     * A symbolic link is followed, and its target replaced.
+     *
+     * Other processes see the old file or the whole new one, never a partial one. Nothing is
+     * flushed on commit, though: until sync_outputs returns, a crash can leave the old file, the
+     * new one, or, where the rename reached the disk before the data, an empty or partial one.
+     */
+    class OutputFile {
+    public:
+        OutputFile() noexcept = default;
+        OutputFile(OutputFile const &) = delete;
+        OutputFile &operator=(OutputFile const &) = delete;
+
+        /**
+         * Discard the data unless committed
+         */
+        ~OutputFile();
+
+        /**
+         * Create the temporary file
+         * @param filepath  path the file will have once committed
+         * @return          result of the operation
+         */
+        Result open(std::filesystem::path const &filepath) noexcept;
+
+        /**
+         * Append data
+         * @param data  data
+         * @param size  size of the data
+         * @return      result of the operation
+         */
+        Result write(char const *data, std::size_t size) noexcept;
+
+        /**
+         * Close the file and move it into place
+         * @return  result of the operation
+         */
+        Result commit() noexcept;
+
+        /**
+         * Close and remove the temporary file
+         */
+        void discard() noexcept;
+
+    private:
+        std::filesystem::path filepath;
+        std::filesystem::path temporary_path;
+#if defined(__unix__) || defined(__APPLE__)
+        int fd = -1;
+#else
+        std::FILE *file = nullptr;
+#endif
+    };
+
+    /**
+     * Get a path for a temporary file next to a file, unique within the process
+     * @param filepath  file
+     * @return          path in the same directory
+     */
+    std::filesystem::path temporary_output_path(std::filesystem::path const &filepath);
+
+    /**
+     * Check if a path has the form of one from temporary_output_path, from any process, so tools
+     * watching a directory can leave such files alone
+     * @param filepath  path
+     * @return          true if the file name matches
+     */
+    bool is_temporary_output_path(std::filesystem::path const &filepath);
+
+    /**
+     * Get the file writing to a path replaces: the target of a symbolic link, followed through
+     * chains of them, or the path itself
+     * @param filepath  path
+     * @return          path of the file to replace
+     */
+    std::filesystem::path resolve_output_path(std::filesystem::path const &filepath);
+
+    /**
+     * Record that a file was put in place, for the next sync_outputs
+     * @param filepath  file
+     */
+    void note_output(std::filesystem::path const &filepath) noexcept;
+}
+
+#endif
@@ -0,0 +1,283 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <composer/buffer.hpp>
+#include <composer/encrypt.hpp>
+#include <composer/pack.hpp>
+#include "checksum.hpp"
+
+namespace Composer {
+    constexpr const char pack_magic[4] = { 'C', 'M', 'P', 'K' };
+    constexpr const std::uint32_t pack_version = 1;
+    constexpr const std::size_t pack_header_size = 32;
+    constexpr const std::size_t pack_index_entry_size = 40;
+
+    static void put_u32(char *buffer, std::uint32_t value) noexcept {
+        for(std::size_t i = 0; i < 4; i++) {
+            buffer[i] = static_cast<char>(value >> (i * 8));
+        }
+    }
+
+    static void put_u64(char *buffer, std::uint64_t value) noexcept {
+        for(std::size_t i = 0; i < 8; i++) {
+            buffer[i] = static_cast<char>(value >> (i * 8));
+        }
+    }
+
+    static std::uint32_t get_u32(char const *buffer) noexcept {
+        std::uint32_t value = 0;
+        for(std::size_t i = 0; i < 4; i++) {
+            value |= static_cast<std::uint32_t>(static_cast<unsigned char>(buffer[i])) << (i * 8);
+        }
+        return value;
+    }
+
+    static std::uint64_t get_u64(char const *buffer) noexcept {
+        std::uint64_t value = 0;
+        for(std::size_t i = 0; i < 8; i++) {
+            value |= static_cast<std::uint64_t>(static_cast<unsigned char>(buffer[i])) << (i * 8);
+        }
+        return value;
+    }
+
+    Result PackWriter::open(std::filesystem::path const &filepath) noexcept {
+        try {
+            this->entries.clear();
+            this->file.open(filepath, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+            if(!this->file) {
+                return { Status::write_failed, errno };
+            }
+
+            // The header is written for real once the index is known
+            char header[pack_header_size] = {};
+            this->file.write(header, sizeof(header));
+            this->offset = sizeof(header);
+            if(!this->file) {
+                return { Status::write_failed, errno };
+            }
+        }
+        catch(...) {
+            return { Status::write_failed };
+        }
+
+        return {};
+    }
+
+    Result PackWriter::add_entry(std::string const &name, char const *encrypted_shader_data, std::size_t size, char const *trailer) noexcept {
+        try {
+            Entry entry;
+            entry.name = name;
+            entry.offset = this->offset;
+            entry.size = size;
+            if(!parse_checksum(trailer, entry.checksum)) {
+                return { Status::checksum_failed };
+            }
+
+            this->file.write(encrypted_shader_data, size);
+            if(!this->file) {
+                return { Status::write_failed, errno };
+            }
+
+            this->offset += size;
+            this->entries.push_back(std::move(entry));
+        }
+        catch(std::bad_alloc const &) {
+            return { Status::out_of_memory };
+        }
+        catch(...) {
+            return { Status::write_failed };
+        }
+
+        return {};
+    }
+
+    Result PackWriter::add_shader(std::string const &name, char const *shader_data, std::size_t size) noexcept {
+        if(size < 8) {
+            return { Status::data_too_small };
+        }
+
+        Buffer buffer;
+        if(!buffer.allocate(size + trailer_size)) {
+            return { Status::out_of_memory };
+        }
+
+        // Hash once for both the trailer and the index
+        char hash[32];
+        MD5 md5;
+        md5.add(shader_data, size);
+        format_checksum(md5, hash);
+
+        std::memcpy(buffer.data(), shader_data, size);
+        auto encrypted_size = seal_shader_data(buffer.data(), size, hash, default_key);
+
+        return this->add_entry(name, buffer.data(), encrypted_size, hash);
+    }
+
+    Result PackWriter::add_encrypted_shader(std::string const &name, char const *encrypted_shader_data, std::size_t size) noexcept {
+        Buffer buffer;
+        if(!buffer.allocate(size)) {
+            return { Status::out_of_memory };
+        }
+
+        std::size_t shader_size;
+        auto result = try_decrypt_shader(encrypted_shader_data, size, buffer.data(), shader_size);
+        if(!result) {
+            return result;
+        }
+
+        // The decrypted trailer is still in the buffer
+        return this->add_entry(name, encrypted_shader_data, size, buffer.data() + shader_size);
+    }
+
+    Result PackWriter::finish() noexcept {
+        try {
+            std::sort(this->entries.begin(), this->entries.end(), [](Entry const &a, Entry const &b) {
+                return a.name < b.name;
+            });
+
+            for(std::size_t i = 1; i < this->entries.size(); i++) {
+                if(this->entries[i - 1].name == this->entries[i].name) {
+                    return { Status::duplicate_entry };
+                }
+            }
+
+            // Index followed by the names
+            std::uint64_t index_offset = this->offset;
+            std::uint64_t names_offset = index_offset + this->entries.size() * pack_index_entry_size;
+            std::uint32_t name_offset = 0;
+            for(auto const &entry : this->entries) {
+                char record[pack_index_entry_size];
+                put_u32(record, name_offset);
+                put_u32(record + 4, static_cast<std::uint32_t>(entry.name.size()));
+                put_u64(record + 8, entry.offset);
+                put_u64(record + 16, entry.size);
+                std::memcpy(record + 24, entry.checksum, sizeof(entry.checksum));
+                this->file.write(record, sizeof(record));
+                name_offset += static_cast<std::uint32_t>(entry.name.size());
+            }
+
+            for(auto const &entry : this->entries) {
+                this->file.write(entry.name.data(), entry.name.size());
+            }
+
+            char header[pack_header_size] = {};
+            std::memcpy(header, pack_magic, sizeof(pack_magic));
+            put_u32(header + 4, pack_version);
+            put_u32(header + 8, static_cast<std::uint32_t>(this->entries.size()));
+            put_u64(header + 16, index_offset);
+            put_u64(header + 24, names_offset);
+            this->file.seekp(0);
+            this->file.write(header, sizeof(header));
+
+            this->file.close();
+            if(!this->file) {
+                return { Status::write_failed, errno };
+            }
+        }
+        catch(std::bad_alloc const &) {
+            return { Status::out_of_memory };
+        }
+        catch(...) {
+            return { Status::write_failed };
+        }
+
+        return {};
+    }
+
+    Result PackReader::open(std::filesystem::path const &filepath) noexcept {
+        this->count = 0;
+        auto result = this->file.open(filepath);
+        if(!result) {
+            return result;
+        }
+
+        auto *data = this->file.data();
+        auto size = this->file.size();
+        if(size < pack_header_size || std::memcmp(data, pack_magic, sizeof(pack_magic)) != 0 || get_u32(data + 4) != pack_version) {
+            return { Status::invalid_pack };
+        }
+
+        std::uint64_t count = get_u32(data + 8);
+        std::uint64_t index_offset = get_u64(data + 16);
+        std::uint64_t names_offset = get_u64(data + 24);
+        if(index_offset > size || count > (size - index_offset) / pack_index_entry_size || names_offset != index_offset + count * pack_index_entry_size) {
+            return { Status::invalid_pack };
+        }
+
+        this->index = data + index_offset;
+        this->names = data + names_offset;
+        this->names_size = size - names_offset;
+
+        // Check every entry once so lookups don't have to
+        for(std::size_t i = 0; i < count; i++) {
+            char const *record = this->index + i * pack_index_entry_size;
+            std::uint64_t name_end = static_cast<std::uint64_t>(get_u32(record)) + get_u32(record + 4);
+            std::uint64_t entry_offset = get_u64(record + 8);
+            std::uint64_t entry_size = get_u64(record + 16);
+            if(name_end > this->names_size || entry_offset < pack_header_size || entry_offset > index_offset || entry_size > index_offset - entry_offset) {
+                return { Status::invalid_pack };
+            }
+        }
+
+        this->count = static_cast<std::size_t>(count);
+        return {};
+    }
+
+    PackEntry PackReader::entry(std::size_t index) const noexcept {
+        char const *record = this->index + index * pack_index_entry_size;
+
+        PackEntry entry;
+        entry.name = std::string_view(this->names + get_u32(record), get_u32(record + 4));
+        entry.offset = get_u64(record + 8);
+        entry.size = get_u64(record + 16);
+        std::memcpy(entry.checksum, record + 24, sizeof(entry.checksum));
+        return entry;
+    }
+
+    bool PackReader::find(std::string_view name, PackEntry &entry) const noexcept {
+        std::size_t low = 0;
+        std::size_t high = this->count;
+        while(low < high) {
+            std::size_t middle = low + (high - low) / 2;
+            char const *record = this->index + middle * pack_index_entry_size;
+            std::string_view middle_name(this->names + get_u32(record), get_u32(record + 4));
+
+            int comparison = middle_name.compare(name);
+            if(comparison == 0) {
+                entry = this->entry(middle);
+                return true;
+            }
+            if(comparison < 0) {
+                low = middle + 1;
+            }
+            else {
+                high = middle;
+            }
+        }
+        return false;
+    }
+
+    Result PackReader::try_decrypt(PackEntry const &entry, char *output, std::size_t &output_size) const noexcept {
+        return try_decrypt_shader(this->data(entry), static_cast<std::size_t>(entry.size), output, output_size);
+    }
+
+    std::vector<char> PackReader::decrypt(std::string_view name) const {
+        PackEntry entry;
+        if(!this->find(name, entry)) {
+            throw std::runtime_error(status_message(Status::entry_not_found));
+        }
+
+        std::vector<char> buffer(entry.size);
+        std::size_t buffer_size;
+        auto result = this->try_decrypt(entry, buffer.data(), buffer_size);
+        if(!result) {
+            throw std::runtime_error(status_message(result.status));
+        }
+
+        buffer.resize(buffer_size);
+        return buffer;
+    }
+}
@@ -0,0 +1,332 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <new>
+#include <system_error>
+#include <thread>
+#include <vector>
+#include <composer/buffer.hpp>
+#include <composer/encrypt.hpp>
+#include <composer/file.hpp>
+#include <composer/xtea.hpp>
+#include "checksum.hpp"
+#include "output_file.hpp"
+
+namespace Composer {
+    namespace {
+        struct Chunk {
+            char *data;
+            std::uint64_t offset;
+            std::size_t size;
+        };
+
+        /**
+         * Fixed-capacity blocking ring of chunks
+         */
+        class ChunkRing {
+        public:
+            explicit ChunkRing(std::size_t capacity) : slots(capacity) {}
+
+            void push(Chunk chunk) {
+                std::unique_lock<std::mutex> lock(mutex);
+                not_full.wait(lock, [this] { return count < slots.size() || closed; });
+                if(closed) {
+                    return;
+                }
+                slots[(head + count) % slots.size()] = chunk;
+                count++;
+                not_empty.notify_one();
+            }
+
+            /**
+             * Take the oldest chunk, returns false once the ring is closed and drained
+             */
+            bool pop(Chunk &chunk) {
+                std::unique_lock<std::mutex> lock(mutex);
+                not_empty.wait(lock, [this] { return count > 0 || closed; });
+                if(count == 0) {
+                    return false;
+                }
+                chunk = slots[head];
+                head = (head + 1) % slots.size();
+                count--;
+                not_full.notify_one();
+                return true;
+            }
+
+            void close() {
+                std::lock_guard<std::mutex> lock(mutex);
+                closed = true;
+                not_empty.notify_all();
+                not_full.notify_all();
+            }
+
+        private:
+            std::vector<Chunk> slots;
+            std::size_t head = 0;
+            std::size_t count = 0;
+            bool closed = false;
+            std::mutex mutex;
+            std::condition_variable not_empty;
+            std::condition_variable not_full;
+        };
+
+        /**
+         * Copy the intersection of [source_offset, source_offset + source_size) and [offset, offset + size) into destination
+         */
+        void copy_overlap(char *destination, std::uint64_t offset, std::size_t size, char const *source, std::uint64_t source_offset, std::size_t source_size) noexcept {
+            auto begin = std::max(offset, source_offset);
+            auto end = std::min(offset + size, source_offset + source_size);
+            if(begin < end) {
+                std::memcpy(destination + (begin - offset), source + (begin - source_offset), end - begin);
+            }
+        }
+
+        Result open_input(std::filesystem::path const &filepath, std::ifstream &file, std::uint64_t &size) {
+            std::error_code ec;
+            if(!std::filesystem::exists(filepath, ec)) {
+                return { Status::file_not_found, ENOENT };
+            }
+
+            file.open(filepath, std::ios_base::in | std::ios_base::binary);
+            if(!file) {
+                return { Status::read_failed, errno };
+            }
+
+            file.seekg(0, std::ios::end);
+            auto filesize = file.tellg();
+            file.seekg(0, std::ios::beg);
+            if(filesize < 0) {
+                return { Status::read_failed, errno };
+            }
+
+            size = static_cast<std::uint64_t>(filesize);
+            return {};
+        }
+
+        /**
+         * Stream the input through transform in chunks; transform returns how many bytes from the
+         * start of the chunk go to the output
+         */
+        template<typename Transform>
+        Result run_pipeline(std::ifstream &input, std::uint64_t input_size, OutputFile &output, PipelineOptions const &options, Transform &&transform) {
+            std::size_t chunk_size = std::max<std::size_t>((options.chunk_size + 63) / 64 * 64, 64);
+            std::size_t chunk_count = std::max<std::size_t>(options.chunk_count, 2);
+            Buffer storage;
+            if(!storage.allocate(chunk_size * chunk_count)) {
+                return { Status::out_of_memory };
+            }
+
+            ChunkRing free_chunks(chunk_count);
+            ChunkRing read_chunks(chunk_count);
+            ChunkRing processed_chunks(chunk_count);
+            for(std::size_t i = 0; i < chunk_count; i++) {
+                free_chunks.push({ storage.data() + i * chunk_size, 0, 0 });
+            }
+
+            Result read_result;
+            Result write_result;
+            std::atomic<bool> failed(false);
+
+            std::thread reader([&]() {
+                Chunk chunk;
+                for(std::uint64_t offset = 0; offset < input_size && free_chunks.pop(chunk); offset += chunk_size) {
+                    chunk.offset = offset;
+                    chunk.size = static_cast<std::size_t>(std::min<std::uint64_t>(chunk_size, input_size - offset));
+                    input.read(chunk.data, chunk.size);
+                    if(!input) {
+                        read_result = { Status::read_failed, errno };
+                        failed = true;
+                        break;
+                    }
+                    read_chunks.push(chunk);
+                }
+                read_chunks.close();
+            });
+
+            std::thread writer([&]() {
+                Chunk chunk;
+                while(processed_chunks.pop(chunk)) {
+                    if(!failed && chunk.size > 0) {
+                        write_result = output.write(chunk.data, chunk.size);
+                        if(!write_result) {
+                            failed = true;
+                            free_chunks.close();
+                        }
+                    }
+                    free_chunks.push(chunk);
+                }
+            });
+
+            Chunk chunk;
+            while(read_chunks.pop(chunk)) {
+                if(!failed) {
+                    chunk.size = transform(chunk);
+                }
+                processed_chunks.push(chunk);
+            }
+            processed_chunks.close();
+
+            reader.join();
+            writer.join();
+
+            return read_result ? write_result : read_result;
+        }
+
+        template<typename Operation>
+        Result run_file_operation(Operation &&operation) noexcept {
+            Result result;
+
+            try {
+                result = operation();
+            }
+            catch(std::bad_alloc const &) {
+                result = { Status::out_of_memory };
+            }
+            catch(std::system_error const &e) {
+                // Starting the reader or writer thread, e.g. EAGAIN at the thread limit
+                result = { Status::thread_failed, e.code().value() };
+            }
+            catch(...) {
+                result = { Status::write_failed };
+            }
+
+            return result;
+        }
+    }
+
+    Result try_decrypt_shader_file(std::filesystem::path const &input_file, std::filesystem::path const &output_file, PipelineOptions const &options, Key const &key) noexcept {
+        return run_file_operation([&]() -> Result {
+            std::ifstream input;
+            std::uint64_t size;
+            auto result = open_input(input_file, input, size);
+            if(!result) {
+                return result;
+            }
+
+            if(size < trailer_size) {
+                return { Status::data_too_small };
+            }
+
+            // The overlapped tail was encrypted last, so it has to be decrypted first
+            char tail[8];
+            if(size % 8) {
+                input.seekg(size - 8);
+                input.read(tail, sizeof(tail));
+                input.seekg(0);
+                if(!input) {
+                    return { Status::read_failed, errno };
+                }
+                decrypt_blocks(tail, 1, key);
+            }
+
+            // Only put in place once complete
+            OutputFile output;
+            result = output.open(output_file);
+            if(!result) {
+                return result;
+            }
+
+            MD5 md5;
+            char trailer[trailer_size];
+            std::uint64_t blocks_end = size / 8 * 8;
+            std::uint64_t shader_size = size - trailer_size;
+
+            result = run_pipeline(input, size, output, options, [&](Chunk &chunk) -> std::size_t {
+                if(size % 8) {
+                    copy_overlap(chunk.data, chunk.offset, chunk.size, tail, size - 8, sizeof(tail));
+                }
+
+                auto chunk_end = chunk.offset + chunk.size;
+                if(chunk.offset < blocks_end) {
+                    decrypt_blocks(chunk.data, (std::min(chunk_end, blocks_end) - chunk.offset) / 8, key);
+                }
+
+                copy_overlap(trailer, shader_size, sizeof(trailer), chunk.data, chunk.offset, chunk.size);
+
+                if(chunk.offset >= shader_size) {
+                    return 0;
+                }
+                auto shader_bytes = static_cast<std::size_t>(std::min(chunk_end, shader_size) - chunk.offset);
+                md5.add(chunk.data, shader_bytes);
+                return shader_bytes;
+            });
+            if(!result) {
+                return result;
+            }
+
+            char hash[32];
+            format_checksum(md5, hash);
+            if(std::memcmp(hash, trailer, sizeof(hash)) != 0) {
+                return { Status::checksum_failed };
+            }
+
+            if(trailer[trailer_size - 1] != 0) {
+                return { Status::not_null_terminated };
+            }
+
+            return output.commit();
+        });
+    }
+
+    Result try_encrypt_shader_file(std::filesystem::path const &input_file, std::filesystem::path const &output_file, PipelineOptions const &options, Key const &key) noexcept {
+        return run_file_operation([&]() -> Result {
+            std::ifstream input;
+            std::uint64_t size;
+            auto result = open_input(input_file, input, size);
+            if(!result) {
+                return result;
+            }
+
+            if(size < 8) {
+                return { Status::data_too_small };
+            }
+
+            // Only put in place once complete
+            OutputFile output;
+            result = output.open(output_file);
+            if(!result) {
+                return result;
+            }
+
+            // Blocks past the last whole plaintext block need the hash, they are finished at the end
+            MD5 md5;
+            char last_blocks[8 + trailer_size];
+            std::uint64_t blocks_end = size / 8 * 8;
+            std::size_t last_blocks_size = static_cast<std::size_t>(size - blocks_end) + trailer_size;
+
+            result = run_pipeline(input, size, output, options, [&](Chunk &chunk) -> std::size_t {
+                md5.add(chunk.data, chunk.size);
+                copy_overlap(last_blocks, blocks_end, last_blocks_size - trailer_size, chunk.data, chunk.offset, chunk.size);
+
+                if(chunk.offset >= blocks_end) {
+                    return 0;
+                }
+                auto block_bytes = static_cast<std::size_t>(std::min(chunk.offset + chunk.size, blocks_end) - chunk.offset);
+                encrypt_blocks(chunk.data, block_bytes / 8, key);
+                return block_bytes;
+            });
+            if(!result) {
+                return result;
+            }
+
+            char hash[32];
+            format_checksum(md5, hash);
+            seal_shader_data(last_blocks, last_blocks_size - trailer_size, hash, key);
+
+            result = output.write(last_blocks, last_blocks_size);
+            if(!result) {
+                return result;
+            }
+
+            return output.commit();
+        });
+    }
+}
@@ -0,0 +1,137 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <algorithm>
+#include <utility>
+#include "prefetch.hpp"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Composer {
+    bool disk_location(std::filesystem::path const &file, DiskLocation &location) noexcept {
+#ifdef __linux__
+        int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+        if(fd < 0) {
+            return false;
+        }
+
+        struct stat status;
+        if(::fstat(fd, &status) != 0) {
+            ::close(fd);
+            return false;
+        }
+        location.device = static_cast<std::uint64_t>(status.st_dev);
+        location.inode = static_cast<std::uint64_t>(status.st_ino);
+        location.offset = 0;
+        location.physical = false;
+
+        // Only the first extent; files are read front to back
+        alignas(struct fiemap) unsigned char request[sizeof(struct fiemap) + sizeof(struct fiemap_extent)] = {};
+        auto map = reinterpret_cast<struct fiemap *>(request);
+        map->fm_start = 0;
+        map->fm_length = FIEMAP_MAX_OFFSET;
+        map->fm_extent_count = 1;
+
+        if(::ioctl(fd, FS_IOC_FIEMAP, map) == 0 && map->fm_mapped_extents > 0) {
+            // Inline, delayed or encoded extents have no meaningful address
+            auto flags = map->fm_extents[0].fe_flags;
+            if(!(flags & (FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DELALLOC | FIEMAP_EXTENT_DATA_INLINE | FIEMAP_EXTENT_NOT_ALIGNED))) {
+                location.offset = map->fm_extents[0].fe_physical;
+                location.physical = true;
+            }
+        }
+
+        ::close(fd);
+        return true;
+#else
+        (void)file;
+        (void)location;
+        return false;
+#endif
+    }
+
+    std::vector<std::size_t> disk_order(std::vector<std::filesystem::path> const &files) {
+        std::vector<DiskLocation> locations(files.size());
+        std::vector<char> found(files.size());
+        bool physical = true;
+        for(std::size_t i = 0; i < files.size(); i++) {
+            found[i] = disk_location(files[i], locations[i]);
+            physical = physical && (!found[i] || locations[i].physical);
+        }
+
+        std::vector<std::size_t> order(files.size());
+        for(std::size_t i = 0; i < order.size(); i++) {
+            order[i] = i;
+        }
+
+        // Inode order for all files if any lacks an extent; files that couldn't be looked up go
+        // last, in their given order
+        std::stable_sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) {
+            if(found[a] != found[b]) {
+                return found[a] > found[b];
+            }
+            if(!found[a]) {
+                return false;
+            }
+            if(locations[a].device != locations[b].device) {
+                return locations[a].device < locations[b].device;
+            }
+            if(physical) {
+                return locations[a].offset < locations[b].offset;
+            }
+            return locations[a].inode < locations[b].inode;
+        });
+        return order;
+    }
+
+    Prefetcher::Prefetcher(std::vector<std::filesystem::path> files, std::vector<std::uint64_t> sizes, std::uint64_t window) : files(std::move(files)), sizes(std::move(sizes)), window(window) {
+        this->thread = std::thread([this]() { this->run(); });
+    }
+
+    Prefetcher::~Prefetcher() {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->stopping = true;
+        }
+        this->changed.notify_all();
+        this->thread.join();
+    }
+
+    void Prefetcher::consumed(std::uint64_t bytes) {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->consumed_bytes += bytes;
+        }
+        this->changed.notify_all();
+    }
+
+    void Prefetcher::run() {
+        std::uint64_t advised = 0;
+        for(std::size_t i = 0; i < this->files.size(); i++) {
+            {
+                // The first file is always advised, however large
+                std::unique_lock<std::mutex> lock(this->mutex);
+                this->changed.wait(lock, [&] { return this->stopping || advised <= this->consumed_bytes || advised - this->consumed_bytes + this->sizes[i] <= this->window; });
+                if(this->stopping) {
+                    return;
+                }
+            }
+
+#ifdef __linux__
+            // Starts asynchronous reads of the whole file into the page cache
+            int fd = ::open(this->files[i].c_str(), O_RDONLY | O_CLOEXEC);
+            if(fd >= 0) {
+                ::posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+                ::close(fd);
+            }
+#endif
+            advised += this->sizes[i];
+        }
+    }
+}
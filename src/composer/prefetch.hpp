@@ -0,0 +1,84 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef COMPOSER__PREFETCH_HPP
+#define COMPOSER__PREFETCH_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Composer {
+    /**
+     * Where a file lies on its device, for sorting
+     */
+    struct DiskLocation {
+        std::uint64_t device = 0;
+        std::uint64_t inode = 0;
+
+        /** Physical byte offset of the first extent */
+        std::uint64_t offset = 0;
+
+        /** The offset is known */
+        bool physical = false;
+    };
+
+    /**
+     * Look up where a file starts on disk, from FIEMAP; the inode is always set
+     * @param file      path to the file
+     * @param location  set to the location
+     * @return          true if anything was found
+     */
+    bool disk_location(std::filesystem::path const &file, DiskLocation &location) noexcept;
+
+    /**
+     * Order files the way they lie on disk. Physical offsets are only used if every file has
+     * one, as they don't compare with inode numbers.
+     * @param files     files
+     * @return          indices of the files in disk order
+     */
+    std::vector<std::size_t> disk_order(std::vector<std::filesystem::path> const &files);
+
+    /**
+     * Thread asking the kernel to read files ahead of their consumers.
+     *
+     * Files are advised in the given order while the bytes advised stay within `window` of the
+     * bytes consumed, so the page cache is filled just ahead of the reads and not evicted before.
+     */
+    class Prefetcher {
+    public:
+        /**
+         * Start prefetching
+         * @param files     files in the order they will be read
+         * @param sizes     size of each file
+         * @param window    bytes to stay ahead of the consumers
+         */
+        Prefetcher(std::vector<std::filesystem::path> files, std::vector<std::uint64_t> sizes, std::uint64_t window);
+        ~Prefetcher();
+
+        Prefetcher(Prefetcher const &) = delete;
+        Prefetcher &operator=(Prefetcher const &) = delete;
+
+        /**
+         * Report bytes about to be read, letting the window move on
+         */
+        void consumed(std::uint64_t bytes);
+
+    private:
+        void run();
+
+        std::vector<std::filesystem::path> files;
+        std::vector<std::uint64_t> sizes;
+        std::uint64_t window;
+        std::uint64_t consumed_bytes = 0;
+        bool stopping = false;
+        std::mutex mutex;
+        std::condition_variable changed;
+        std::thread thread;
+    };
+}
+
+#endif
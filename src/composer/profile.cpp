@@ -0,0 +1,227 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <cerrno>
+#include <charconv>
+#include <cstdlib>
+#include <fstream>
+#include <mutex>
+#include <new>
+#include <composer/profile.hpp>
+
+namespace Composer {
+    constexpr const char profile_magic[] = "# composer profile 1";
+
+    static std::mutex active_mutex;
+    static Profile active;
+
+    template<typename Integer>
+    static bool parse_integer(std::string const &text, Integer &value) noexcept {
+        auto end = text.data() + text.size();
+        auto [position, error] = std::from_chars(text.data(), end, value);
+        return error == std::errc() && position == end && !text.empty();
+    }
+
+    std::filesystem::path default_profile_path() {
+        if(char const *path = std::getenv("COMPOSER_PROFILE")) {
+            return path;
+        }
+        if(char const *config = std::getenv("XDG_CONFIG_HOME"); config && *config) {
+            return std::filesystem::path(config) / "composer" / "profile";
+        }
+        if(char const *home = std::getenv("HOME"); home && *home) {
+            return std::filesystem::path(home) / ".config" / "composer" / "profile";
+        }
+        return {};
+    }
+
+    Result read_profile(std::filesystem::path const &filepath, Profile &profile) noexcept {
+        std::error_code ec;
+        if(filepath.empty() || !std::filesystem::exists(filepath, ec)) {
+            return { Status::file_not_found, ENOENT };
+        }
+
+        try {
+            std::ifstream file(filepath, std::ios_base::in | std::ios_base::binary);
+            if(!file) {
+                return { Status::read_failed, errno };
+            }
+
+            std::string line;
+            if(!std::getline(file, line) || line != profile_magic) {
+                return { Status::invalid_profile };
+            }
+
+            Profile read;
+            while(std::getline(file, line)) {
+                if(line.empty() || line[0] == '#') {
+                    continue;
+                }
+
+                auto tab = line.find('\t');
+                if(tab == std::string::npos) {
+                    return { Status::invalid_profile };
+                }
+                auto name = line.substr(0, tab);
+                auto value_start = line.find_first_not_of('\t', tab);
+                auto value = value_start == std::string::npos ? std::string() : line.substr(value_start);
+
+                bool valid;
+                if(name == "cipher") {
+                    valid = parse_cipher_backend(value, read.cipher_backend);
+                }
+                else if(name == "md5") {
+                    valid = parse_md5_kernel(value, read.md5_kernel);
+                }
+                else if(name == "alloc") {
+                    valid = parse_allocation_policy(value, read.allocation_policy);
+                }
+                else if(name == "pipeline-threshold") {
+                    valid = parse_integer(value, read.pipeline_threshold);
+                }
+                else if(name == "chunk-size") {
+                    valid = parse_integer(value, read.pipeline.chunk_size) && read.pipeline.chunk_size > 0;
+                }
+                else if(name == "chunk-count") {
+                    valid = parse_integer(value, read.pipeline.chunk_count) && read.pipeline.chunk_count >= 2;
+                }
+                else if(name == "threads") {
+                    valid = parse_integer(value, read.thread_count);
+                }
+                else {
+                    // Written by a newer version
+                    valid = true;
+                }
+
+                if(!valid) {
+                    return { Status::invalid_profile };
+                }
+            }
+
+            if(file.bad()) {
+                return { Status::read_failed, errno };
+            }
+
+            profile = read;
+        }
+        catch(std::bad_alloc const &) {
+            return { Status::out_of_memory };
+        }
+        catch(...) {
+            return { Status::read_failed };
+        }
+
+        return {};
+    }
+
+    Result write_profile(std::filesystem::path const &filepath, Profile const &profile) noexcept {
+        try {
+            std::error_code ec;
+            if(filepath.has_parent_path()) {
+                std::filesystem::create_directories(filepath.parent_path(), ec);
+            }
+
+            std::ofstream file(filepath, std::ios_base::out | std::ios_base::binary);
+            if(!file) {
+                return { Status::write_failed, errno };
+            }
+
+            file << profile_magic << "\n";
+            file << "cipher\t" << cipher_backend_name(profile.cipher_backend) << "\n";
+            file << "md5\t" << md5_kernel_name(profile.md5_kernel) << "\n";
+            file << "alloc\t" << allocation_policy_name(profile.allocation_policy) << "\n";
+            file << "pipeline-threshold\t" << profile.pipeline_threshold << "\n";
+            file << "chunk-size\t" << profile.pipeline.chunk_size << "\n";
+            file << "chunk-count\t" << profile.pipeline.chunk_count << "\n";
+            file << "threads\t" << profile.thread_count << "\n";
+
+            file.close();
+            if(!file) {
+                return { Status::write_failed, errno };
+            }
+        }
+        catch(std::bad_alloc const &) {
+            return { Status::out_of_memory };
+        }
+        catch(...) {
+            return { Status::write_failed };
+        }
+
+        return {};
+    }
+
+    void apply_profile(Profile const &profile) noexcept {
+        // A profile copied from another machine may name kernels this CPU lacks
+        set_cipher_backend(profile.cipher_backend);
+        MD5::setKernel(profile.md5_kernel);
+        set_allocation_policy(profile.allocation_policy);
+
+        std::lock_guard<std::mutex> lock(active_mutex);
+        active = profile;
+    }
+
+    Profile active_profile() noexcept {
+        std::lock_guard<std::mutex> lock(active_mutex);
+        return active;
+    }
+
+    Result read_machine_profile(Profile &profile) noexcept {
+        static Result result;
+        static Profile machine;
+        static std::once_flag once;
+
+        std::call_once(once, []() {
+            Profile read;
+            try {
+                result = read_profile(default_profile_path(), read);
+            }
+            catch(...) {
+                result = { Status::out_of_memory };
+            }
+            if(result) {
+                machine = read;
+            }
+        });
+
+        profile = machine;
+        return result;
+    }
+
+    Result load_profile() noexcept {
+        static Result result;
+        static std::once_flag once;
+
+        std::call_once(once, []() {
+            Profile profile;
+            result = read_machine_profile(profile);
+            if(result) {
+                apply_profile(profile);
+            }
+        });
+
+        return result;
+    }
+
+    const char *md5_kernel_name(MD5::Kernel kernel) noexcept {
+        switch(kernel) {
+            case MD5::Auto:
+                return "auto";
+            case MD5::Portable:
+                return "portable";
+            case MD5::Bmi:
+                return "bmi";
+            case MD5::Avx512:
+                return "avx512";
+        }
+        return "unknown";
+    }
+
+    bool parse_md5_kernel(std::string const &name, MD5::Kernel &kernel) noexcept {
+        for(auto candidate : { MD5::Auto, MD5::Portable, MD5::Bmi, MD5::Avx512 }) {
+            if(name == md5_kernel_name(candidate)) {
+                kernel = candidate;
+                return true;
+            }
+        }
+        return false;
+    }
+}
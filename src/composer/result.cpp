@@ -0,0 +1,53 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <composer/result.hpp>
+
+namespace Composer {
+    const char *status_message(Status status) noexcept {
+        switch(status) {
+            case Status::ok:
+                return "success";
+            case Status::data_too_small:
+                return "shader data is too small";
+            case Status::checksum_failed:
+                return "decrypted data checksum failed";
+            case Status::not_null_terminated:
+                return "decrypted data is not null terminated";
+            case Status::out_of_memory:
+                return "out of memory";
+            case Status::file_not_found:
+                return "file does not exists";
+            case Status::read_failed:
+                return "failed to read file";
+            case Status::write_failed:
+                return "failed to write file";
+            case Status::invalid_pack:
+                return "invalid shader pack";
+            case Status::entry_not_found:
+                return "shader pack entry not found";
+            case Status::duplicate_entry:
+                return "duplicate shader pack entry";
+            case Status::key_not_found:
+                return "no matching key";
+            case Status::not_supported:
+                return "not supported on this platform";
+            case Status::invalid_report:
+                return "invalid batch report";
+            case Status::invalid_profile:
+                return "invalid machine profile";
+            case Status::invalid_archive:
+                return "invalid tar archive";
+            case Status::cancelled:
+                return "operation cancelled";
+            case Status::deadline_exceeded:
+                return "deadline exceeded";
+            case Status::skipped:
+                return "skipped, not in the expected form";
+            case Status::thread_failed:
+                return "failed to start a thread";
+            case Status::output_conflict:
+                return "another input has the same output file";
+        }
+        return "unknown error";
+    }
+}
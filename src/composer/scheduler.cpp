@@ -0,0 +1,276 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <composer/buffer.hpp>
+#include <composer/encrypt.hpp>
+#include <composer/file.hpp>
+#include <composer/scheduler.hpp>
+#include "byte_budget.hpp"
+#include "checksum.hpp"
+#include "file_io.hpp"
+#include "prefetch.hpp"
+
+namespace Composer {
+    namespace {
+        /**
+         * Pieces of a split file. Each one is queued on the pool, but whoever gets to it first runs
+         * it, so the owning thread can do them itself instead of waiting for a busy pool.
+         */
+        class Segments {
+        public:
+            enum State : std::uint8_t {
+                pending,
+                claimed,
+                done
+            };
+
+            Segments(std::size_t count, std::function<void(std::size_t)> work) : states(count, pending), work(std::move(work)) {}
+
+            /**
+             * Run a segment unless someone else already did or is doing it
+             */
+            void run(std::size_t index) {
+                {
+                    std::lock_guard<std::mutex> lock(this->mutex);
+                    if(this->states[index] != pending) {
+                        return;
+                    }
+                    this->states[index] = claimed;
+                }
+
+                this->work(index);
+
+                std::lock_guard<std::mutex> lock(this->mutex);
+                this->states[index] = done;
+                this->finished.notify_all();
+            }
+
+            /**
+             * Run a segment if nobody did, then wait for it
+             */
+            void complete(std::size_t index) {
+                this->run(index);
+                std::unique_lock<std::mutex> lock(this->mutex);
+                this->finished.wait(lock, [&] { return this->states[index] == done; });
+            }
+
+            /**
+             * Queue a segment on the pool
+             */
+            static void submit(std::shared_ptr<Segments> const &segments, WorkerPool &pool, std::size_t index) {
+                pool.submit([segments, index]() {
+                    segments->run(index);
+                });
+            }
+
+        private:
+            std::vector<State> states;
+            std::function<void(std::size_t)> work;
+            std::mutex mutex;
+            std::condition_variable finished;
+        };
+
+        /**
+         * Encrypt shader data in place, buffer needs trailer_size bytes of extra room
+         */
+        std::size_t encrypt_split(char *buffer, std::size_t size, Key const &key, WorkerPool &pool, std::size_t segment_size) {
+            std::size_t blocks_end = size / 8 * 8;
+            std::size_t count = (blocks_end + segment_size - 1) / segment_size;
+            auto segments = std::make_shared<Segments>(count, [=, &key](std::size_t index) {
+                auto offset = index * segment_size;
+                encrypt_blocks(buffer + offset, (std::min(offset + segment_size, blocks_end) - offset) / 8, key);
+            });
+
+            // A segment can only be encrypted once it was hashed
+            MD5 md5;
+            for(std::size_t index = 0; index < count; index++) {
+                auto offset = index * segment_size;
+                md5.add(buffer + offset, std::min(offset + segment_size, blocks_end) - offset);
+                Segments::submit(segments, pool, index);
+            }
+            md5.add(buffer + blocks_end, size - blocks_end);
+
+            char hash[32];
+            format_checksum(md5, hash);
+            seal_shader_data(buffer + blocks_end, size - blocks_end, hash, key);
+
+            for(std::size_t index = 0; index < count; index++) {
+                segments->complete(index);
+            }
+
+            return size + trailer_size;
+        }
+
+        /**
+         * Decrypt encrypted shader data in place
+         */
+        Result decrypt_split(char *buffer, std::size_t size, std::size_t &output_size, Key const &key, WorkerPool &pool, std::size_t segment_size) {
+            if(size < trailer_size) {
+                return { Status::data_too_small };
+            }
+
+            // The overlapped tail was encrypted last
+            if(size % 8) {
+                decrypt_blocks(buffer + size - 8, 1, key);
+            }
+
+            std::size_t blocks_end = size / 8 * 8;
+            std::size_t count = (blocks_end + segment_size - 1) / segment_size;
+            auto segments = std::make_shared<Segments>(count, [=, &key](std::size_t index) {
+                auto offset = index * segment_size;
+                decrypt_blocks(buffer + offset, (std::min(offset + segment_size, blocks_end) - offset) / 8, key);
+            });
+            for(std::size_t index = 0; index < count; index++) {
+                Segments::submit(segments, pool, index);
+            }
+
+            // Hash in order as the segments come in
+            MD5 md5;
+            std::size_t shader_size = size - trailer_size;
+            for(std::size_t index = 0; index < count; index++) {
+                segments->complete(index);
+                auto offset = index * segment_size;
+                if(offset < shader_size) {
+                    md5.add(buffer + offset, std::min(offset + segment_size, shader_size) - offset);
+                }
+            }
+            if(blocks_end < shader_size) {
+                md5.add(buffer + blocks_end, shader_size - blocks_end);
+            }
+
+            char hash[32];
+            format_checksum(md5, hash);
+            if(std::memcmp(hash, buffer + shader_size, sizeof(hash)) != 0) {
+                return { Status::checksum_failed };
+            }
+            if(buffer[size - 1] != 0) {
+                return { Status::not_null_terminated };
+            }
+
+            output_size = shader_size;
+            return {};
+        }
+
+        Result run_split(ShaderTask const &task, Operation operation, WorkerPool &pool, std::size_t segment_size, Key const &key) {
+            Buffer buffer;
+            std::size_t size;
+            auto result = read_file(task.input_file, operation == Operation::encrypt ? trailer_size : 0, buffer, size);
+            if(!result) {
+                return result;
+            }
+
+            if(operation == Operation::encrypt) {
+                if(size < 8) {
+                    return { Status::data_too_small };
+                }
+                size = encrypt_split(buffer.data(), size, key, pool, segment_size);
+            }
+            else {
+                result = decrypt_split(buffer.data(), size, size, key, pool, segment_size);
+                if(!result) {
+                    return result;
+                }
+            }
+
+            return write_file(task.output_file, buffer.data(), size);
+        }
+
+        Result run_task(ShaderTask const &task, Operation operation, WorkerPool &pool, SchedulerOptions const &options, std::uint64_t retain_limit, Key const &key) {
+            if(task.size >= options.split_size) {
+                std::size_t segment_size = std::max<std::size_t>((options.segment_size + 7) / 8 * 8, 8);
+                return run_split(task, operation, pool, segment_size, key);
+            }
+
+            // Small files reuse a per-thread buffer, kept afterwards only if it is within the
+            // thread's share of the memory cap
+            thread_local Buffer buffer;
+            auto result = operation == Operation::encrypt ? try_encrypt_shader_file(task.input_file, task.output_file, buffer, key) : try_decrypt_shader_file(task.input_file, task.output_file, buffer, key);
+            if(buffer.size() > retain_limit) {
+                buffer.release();
+            }
+            return result;
+        }
+    }
+
+    bool run_shader_tasks(std::vector<ShaderTask> &tasks, Operation operation, WorkerPool &pool, SchedulerOptions const &options, Key const &key) {
+        std::vector<std::size_t> order(tasks.size());
+        for(std::size_t i = 0; i < order.size(); i++) {
+            order[i] = i;
+        }
+        if(options.order == TaskOrder::physical) {
+            std::vector<std::filesystem::path> files(tasks.size());
+            for(std::size_t i = 0; i < tasks.size(); i++) {
+                files[i] = tasks[i].input_file;
+            }
+            order = disk_order(files);
+        }
+        else {
+            std::stable_sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) {
+                return tasks[a].size > tasks[b].size;
+            });
+        }
+
+        // Reads ahead in the order the tasks are submitted
+        std::unique_ptr<Prefetcher> prefetcher;
+        if(options.prefetch_window) {
+            std::vector<std::filesystem::path> files(order.size());
+            std::vector<std::uint64_t> sizes(order.size());
+            for(std::size_t i = 0; i < order.size(); i++) {
+                files[i] = tasks[order[i]].input_file;
+                sizes[i] = tasks[order[i]].size;
+            }
+            prefetcher = std::make_unique<Prefetcher>(std::move(files), std::move(sizes), options.prefetch_window);
+        }
+
+        // Input bytes done, for checkpoints
+        std::atomic<std::uint64_t> processed(0);
+
+        // A quarter of the cap is for the buffers threads keep between files, the rest for the
+        // data of running tasks, so both together stay under it
+        std::uint64_t retained_bytes = options.max_bytes_in_flight / 4;
+        std::uint64_t retain_limit = retained_bytes / std::max<std::size_t>(pool.size(), 1);
+        ByteBudget budget(options.max_bytes_in_flight - retained_bytes);
+        for(auto index : order) {
+            auto &task = tasks[index];
+            std::uint64_t cost = task.size + trailer_size;
+            budget.acquire(cost);
+
+            pool.submit([&, cost]() {
+                if(prefetcher) {
+                    prefetcher->consumed(task.size);
+                }
+
+                try {
+                    task.result = run_task(task, operation, pool, options, retain_limit, key);
+                }
+                catch(std::bad_alloc const &) {
+                    task.result = { Status::out_of_memory };
+                }
+                catch(...) {
+                    task.result = { Status::write_failed };
+                }
+
+                // Whoever crosses a checkpoint flushes everything written up to it
+                if(options.checkpoint_bytes) {
+                    auto total = processed.fetch_add(task.size) + task.size;
+                    if(total / options.checkpoint_bytes != (total - task.size) / options.checkpoint_bytes) {
+                        sync_outputs();
+                    }
+                }
+                budget.release(cost);
+            });
+        }
+        budget.wait_idle();
+
+        return std::all_of(tasks.begin(), tasks.end(), [](ShaderTask const &task) {
+            return static_cast<bool>(task.result);
+        });
+    }
+}
@@ -0,0 +1,499 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+#include <composer/buffer.hpp>
+#include <composer/encrypt.hpp>
+#include <composer/tar.hpp>
+#include "byte_budget.hpp"
+
+namespace Composer {
+    constexpr const std::size_t tar_block_size = 512;
+
+    /** Archives are padded to records of 20 blocks, like tar does */
+    constexpr const std::size_t tar_record_size = 20 * tar_block_size;
+
+    /** Cap on pax and GNU long name headers, anything bigger is a broken archive */
+    constexpr const std::uint64_t tar_extended_limit = 1 << 20;
+
+    namespace {
+        /**
+         * Pax or GNU header coming before the entry it applies to
+         */
+        struct ExtendedHeader {
+            char header[tar_block_size];
+            std::string data;
+        };
+
+        /**
+         * Entry waiting to be written; data holds the output once done is set
+         */
+        struct TarEntry {
+            /** Header blocks, extended ones included, sizes already rewritten */
+            std::vector<char> headers;
+
+            Buffer data;
+            std::uint64_t input_size = 0;
+            std::uint64_t output_size = 0;
+
+            /** Bytes taken from the budget */
+            std::uint64_t budget = 0;
+
+            std::string name;
+            bool regular = false;
+            bool done = false;
+            Result result;
+        };
+
+        std::uint64_t padding(std::uint64_t size) noexcept {
+            return (tar_block_size - size % tar_block_size) % tar_block_size;
+        }
+
+        bool parse_octal(char const *field, std::size_t length, std::uint64_t &value) noexcept {
+            std::size_t i = 0;
+            while(i < length && field[i] == ' ') {
+                i++;
+            }
+
+            value = 0;
+            bool digits = false;
+            for(; i < length && field[i] >= '0' && field[i] <= '7'; i++) {
+                value = value * 8 + static_cast<std::uint64_t>(field[i] - '0');
+                digits = true;
+            }
+
+            // Then only terminators
+            for(; i < length; i++) {
+                if(field[i] != ' ' && field[i] != '\0') {
+                    return false;
+                }
+            }
+            return digits;
+        }
+
+        /**
+         * Size field, octal or GNU base-256 for 8 GiB and more
+         */
+        bool parse_size(char const header[tar_block_size], std::uint64_t &size) noexcept {
+            auto field = reinterpret_cast<unsigned char const *>(header + 124);
+            if(field[0] & 0x80) {
+                size = 0;
+                for(std::size_t i = 1; i < 12; i++) {
+                    if(size >> 56) {
+                        return false;
+                    }
+                    size = size << 8 | field[i];
+                }
+                return true;
+            }
+            return parse_octal(header + 124, 12, size);
+        }
+
+        void write_octal(char *field, std::size_t length, std::uint64_t value) noexcept {
+            field[length - 1] = '\0';
+            for(std::size_t i = length - 1; i > 0; i--) {
+                field[i - 1] = static_cast<char>('0' + (value & 7));
+                value >>= 3;
+            }
+        }
+
+        void write_size(char header[tar_block_size], std::uint64_t size) noexcept {
+            if(size < (std::uint64_t(1) << 33)) {
+                write_octal(header + 124, 12, size);
+                return;
+            }
+
+            auto field = reinterpret_cast<unsigned char *>(header + 124);
+            field[0] = 0x80;
+            for(std::size_t i = 11; i > 0; i--) {
+                field[i] = static_cast<unsigned char>(size);
+                size >>= 8;
+            }
+        }
+
+        /**
+         * Sum of the header bytes with the checksum field counted as spaces
+         */
+        std::uint32_t header_checksum(char const header[tar_block_size]) noexcept {
+            std::uint32_t sum = 0;
+            for(std::size_t i = 0; i < tar_block_size; i++) {
+                sum += (i >= 148 && i < 156) ? ' ' : static_cast<unsigned char>(header[i]);
+            }
+            return sum;
+        }
+
+        bool valid_checksum(char const header[tar_block_size]) noexcept {
+            std::uint64_t stored;
+            if(!parse_octal(header + 148, 8, stored)) {
+                return false;
+            }
+            if(stored == header_checksum(header)) {
+                return true;
+            }
+
+            // Some old writers summed signed chars
+            std::int32_t sum = 0;
+            for(std::size_t i = 0; i < tar_block_size; i++) {
+                sum += (i >= 148 && i < 156) ? ' ' : static_cast<signed char>(header[i]);
+            }
+            return static_cast<std::int64_t>(stored) == sum;
+        }
+
+        void update_checksum(char header[tar_block_size]) noexcept {
+            write_octal(header + 148, 7, header_checksum(header));
+            header[155] = ' ';
+        }
+
+        bool is_zero_block(char const block[tar_block_size]) noexcept {
+            return std::all_of(block, block + tar_block_size, [](char c) { return c == 0; });
+        }
+
+        std::string header_name(char const header[tar_block_size]) {
+            std::string name(header, strnlen(header, 100));
+            if(std::memcmp(header + 257, "ustar", 5) == 0 && header[345] != '\0') {
+                name = std::string(header + 345, strnlen(header + 345, 155)) + "/" + name;
+            }
+            return name;
+        }
+
+        /**
+         * Split the pax record at position, "<length> <key>=<value>\n"
+         * @return  length of the record, 0 if it is malformed
+         */
+        std::size_t split_pax_record(std::string const &data, std::size_t position, std::string &key, std::string &value) {
+            auto space = data.find(' ', position);
+            if(space == std::string::npos) {
+                return 0;
+            }
+            std::size_t length = std::strtoull(data.c_str() + position, nullptr, 10);
+            if(length <= space + 1 - position || position + length > data.size() || data[position + length - 1] != '\n') {
+                return 0;
+            }
+
+            auto record = data.substr(space + 1, position + length - space - 2);
+            auto equals = record.find('=');
+            if(equals == std::string::npos) {
+                return 0;
+            }
+            key = record.substr(0, equals);
+            value = record.substr(equals + 1);
+            return length;
+        }
+
+        bool find_pax_record(std::string const &data, std::string const &key, std::string &value) {
+            std::string record_key;
+            std::size_t position = 0;
+            while(position < data.size()) {
+                auto length = split_pax_record(data, position, record_key, value);
+                if(length == 0) {
+                    return false;
+                }
+                if(record_key == key) {
+                    return true;
+                }
+                position += length;
+            }
+            return false;
+        }
+
+        std::string format_pax_record(std::string const &key, std::string const &value) {
+            auto body = " " + key + "=" + value + "\n";
+
+            // The length counts its own digits
+            std::size_t length = body.size() + 1;
+            while(std::to_string(length).size() + body.size() != length) {
+                length = std::to_string(length).size() + body.size();
+            }
+            return std::to_string(length) + body;
+        }
+
+        /**
+         * Replace the value of a record of a pax header, keeping the others in order
+         */
+        std::string replace_pax_record(std::string const &data, std::string const &key, std::string const &value) {
+            std::string output;
+            std::string record_key;
+            std::string record_value;
+            std::size_t position = 0;
+            while(position < data.size()) {
+                auto length = split_pax_record(data, position, record_key, record_value);
+                if(length == 0) {
+                    output += data.substr(position);
+                    break;
+                }
+                output += record_key == key ? format_pax_record(key, value) : data.substr(position, length);
+                position += length;
+            }
+            return output;
+        }
+
+        /**
+         * Read exactly size bytes; a short read is a truncated archive unless the stream broke
+         */
+        Result read_exact(std::istream &input, char *data, std::uint64_t size) {
+            input.read(data, static_cast<std::streamsize>(size));
+            if(static_cast<std::uint64_t>(input.gcount()) != size) {
+                if(input.bad()) {
+                    return { Status::read_failed, errno };
+                }
+                return { Status::invalid_archive };
+            }
+            return {};
+        }
+
+        Result skip(std::istream &input, std::uint64_t size) {
+            char scratch[tar_block_size];
+            while(size > 0) {
+                auto piece = std::min<std::uint64_t>(size, sizeof(scratch));
+                auto result = read_exact(input, scratch, piece);
+                if(!result) {
+                    return result;
+                }
+                size -= piece;
+            }
+            return {};
+        }
+    }
+
+    Result transform_tar_stream(std::istream &input, std::ostream &output, Operation operation, WorkerPool &pool, TarStreamOptions const &options, TarStreamStats &stats, Key const &key) {
+        stats = TarStreamStats();
+
+        ByteBudget budget(options.max_bytes_in_flight);
+        std::mutex mutex;
+        std::condition_variable changed;
+        std::deque<TarEntry> entries;
+        bool reading = true;
+        bool failed = false;
+        Result outcome;
+        std::uint64_t written = 0;
+
+        // Keep the first failure, with mutex held
+        auto fail = [&](Result result, std::string const &name) {
+            if(!failed) {
+                failed = true;
+                outcome = result;
+                stats.failed_entry = name;
+            }
+        };
+
+        // Writes entries in order as they are done. After a failure it only drains the queue,
+        // so every job has finished and every byte is released when it returns.
+        std::thread writer([&]() {
+            static const char zeros[tar_block_size] = {};
+
+            std::unique_lock<std::mutex> lock(mutex);
+            while(true) {
+                changed.wait(lock, [&] { return (!entries.empty() && entries.front().done) || (!reading && entries.empty()); });
+                if(entries.empty()) {
+                    return;
+                }
+
+                TarEntry &entry = entries.front();
+                if(!entry.result) {
+                    fail(entry.result, entry.name);
+                }
+                else if(!failed) {
+                    lock.unlock();
+                    output.write(entry.headers.data(), static_cast<std::streamsize>(entry.headers.size()));
+                    output.write(entry.data.data(), static_cast<std::streamsize>(entry.output_size));
+                    output.write(zeros, static_cast<std::streamsize>(padding(entry.output_size)));
+                    bool good = static_cast<bool>(output);
+                    lock.lock();
+
+                    if(good) {
+                        written += entry.headers.size() + entry.output_size + padding(entry.output_size);
+                        stats.entries++;
+                        stats.files += entry.regular;
+                    }
+                    else {
+                        fail({ Status::write_failed, errno }, entry.name);
+                    }
+                }
+
+                budget.release(entry.budget);
+                entries.pop_front();
+            }
+        });
+
+        std::vector<ExtendedHeader> extended;
+        std::string name;
+        Result result;
+
+        try {
+            char header[tar_block_size];
+            while(true) {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if(failed) {
+                        break;
+                    }
+                }
+
+                input.read(header, tar_block_size);
+                if(input.gcount() == 0 && input.eof() && extended.empty()) {
+                    // Missing end-of-archive blocks, accepted like tar does
+                    break;
+                }
+                if(input.gcount() != tar_block_size) {
+                    result = input.bad() ? Result { Status::read_failed, errno } : Result { Status::invalid_archive };
+                    break;
+                }
+                if(is_zero_block(header)) {
+                    break;
+                }
+
+                std::uint64_t size;
+                if(!valid_checksum(header) || !parse_size(header, size)) {
+                    result = { Status::invalid_archive };
+                    break;
+                }
+
+                char type = header[156];
+                if(type == 'x' || type == 'g' || type == 'L' || type == 'K') {
+                    if(size > tar_extended_limit) {
+                        result = { Status::invalid_archive };
+                        break;
+                    }
+                    ExtendedHeader header_data;
+                    std::memcpy(header_data.header, header, tar_block_size);
+                    header_data.data.resize(size);
+                    if(!(result = read_exact(input, header_data.data.data(), size)) || !(result = skip(input, padding(size)))) {
+                        break;
+                    }
+                    extended.push_back(std::move(header_data));
+                    continue;
+                }
+
+                // Extended headers override the name and size of the entry
+                name = header_name(header);
+                bool pax_size = false;
+                for(auto const &header_data : extended) {
+                    std::string value;
+                    if(header_data.header[156] == 'x') {
+                        if(find_pax_record(header_data.data, "path", value)) {
+                            name = value;
+                        }
+                        if(find_pax_record(header_data.data, "size", value)) {
+                            size = std::strtoull(value.c_str(), nullptr, 10);
+                            pax_size = true;
+                        }
+                    }
+                    else if(header_data.header[156] == 'L') {
+                        name = std::string(header_data.data.c_str());
+                    }
+                }
+
+                TarEntry entry;
+                entry.name = name;
+                entry.regular = (type == '0' || type == '7' || (type == '\0' && (name.empty() || name.back() != '/')));
+                entry.input_size = size;
+                entry.output_size = size;
+                if(entry.regular) {
+                    if(operation == Operation::encrypt) {
+                        entry.output_size = size + trailer_size;
+                    }
+                    else if(size < trailer_size) {
+                        result = { Status::data_too_small };
+                        break;
+                    }
+                    else {
+                        entry.output_size = size - trailer_size;
+                    }
+                }
+
+                for(auto &header_data : extended) {
+                    if(entry.regular && pax_size && header_data.header[156] == 'x') {
+                        header_data.data = replace_pax_record(header_data.data, "size", std::to_string(entry.output_size));
+                        write_size(header_data.header, header_data.data.size());
+                        update_checksum(header_data.header);
+                    }
+                    entry.headers.insert(entry.headers.end(), header_data.header, header_data.header + tar_block_size);
+                    entry.headers.insert(entry.headers.end(), header_data.data.begin(), header_data.data.end());
+                    entry.headers.resize(entry.headers.size() + padding(header_data.data.size()));
+                }
+                extended.clear();
+
+                if(entry.regular) {
+                    write_size(header, entry.output_size);
+                    update_checksum(header);
+                }
+                entry.headers.insert(entry.headers.end(), header, header + tar_block_size);
+
+                // Encryption works in place and needs room for the trailer
+                entry.budget = std::max(entry.input_size, entry.output_size);
+                budget.acquire(entry.budget);
+                if(!entry.data.reserve(entry.budget)) {
+                    budget.release(entry.budget);
+                    result = { Status::out_of_memory };
+                    break;
+                }
+                if(!(result = read_exact(input, entry.data.data(), size)) || !(result = skip(input, padding(size)))) {
+                    budget.release(entry.budget);
+                    break;
+                }
+
+                bool regular = entry.regular;
+                TarEntry *queued;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    entries.push_back(std::move(entry));
+                    queued = &entries.back();
+                    queued->done = !regular;
+                    changed.notify_all();
+                }
+
+                if(regular) {
+                    pool.submit([&, queued]() {
+                        std::size_t output_size;
+                        auto result = operation == Operation::encrypt
+                            ? try_encrypt_shader(queued->data.data(), queued->input_size, queued->data.data(), output_size, key)
+                            : try_decrypt_shader(queued->data.data(), queued->input_size, queued->data.data(), output_size, key);
+
+                        std::lock_guard<std::mutex> lock(mutex);
+                        queued->result = result;
+                        queued->done = true;
+                        changed.notify_all();
+                    });
+                }
+            }
+        }
+        catch(std::bad_alloc const &) {
+            result = { Status::out_of_memory };
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            reading = false;
+            changed.notify_all();
+        }
+        writer.join();
+
+        // Entries before the one the reader stopped at fail first
+        if(!result) {
+            fail(result, name);
+        }
+
+        if(failed) {
+            return outcome;
+        }
+
+        // Two zero blocks, then up to the end of the record
+        static const char zeros[tar_record_size] = {};
+        written += 2 * tar_block_size;
+        output.write(zeros, 2 * tar_block_size);
+        output.write(zeros, static_cast<std::streamsize>((tar_record_size - written % tar_record_size) % tar_record_size));
+        output.flush();
+        if(!output) {
+            return { Status::write_failed, errno };
+        }
+
+        return {};
+    }
+}
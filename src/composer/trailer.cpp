@@ -0,0 +1,85 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <cstring>
+#include "checksum.hpp"
+#include "trailer.hpp"
+
+namespace Composer {
+    void decrypt_trailer(char const *window, std::uint64_t window_offset, std::uint64_t size, Key const &key, char trailer[trailer_size]) noexcept {
+        auto offset = trailer_window_offset(size);
+        auto length = static_cast<std::size_t>(size - offset);
+
+        char blocks[trailer_window_size];
+        std::memcpy(blocks, window + (offset - window_offset), length);
+
+        // Same order as a full decrypt: overlapped tail first
+        if(size % 8) {
+            decrypt_blocks(blocks + length - 8, 1, key);
+        }
+        decrypt_blocks(blocks, length / 8, key);
+
+        std::memcpy(trailer, blocks + length - trailer_size, trailer_size);
+    }
+
+    bool valid_trailer(char const trailer[trailer_size]) noexcept {
+        for(std::size_t i = 0; i < trailer_size - 1; i++) {
+            char c = trailer[i];
+            if(!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'))) {
+                return false;
+            }
+        }
+        return trailer[trailer_size - 1] == 0;
+    }
+
+    Result trailer_fingerprint(char const trailer[trailer_size], unsigned char fingerprint[16]) noexcept {
+        if(!parse_checksum(trailer, fingerprint)) {
+            return { Status::checksum_failed };
+        }
+        if(trailer[trailer_size - 1] != 0) {
+            return { Status::not_null_terminated };
+        }
+        return {};
+    }
+
+    bool detect_trailer_key(char const *window, std::uint64_t window_offset, std::uint64_t size, Key const *keys, std::size_t key_count, std::size_t &key_index) noexcept {
+        auto offset = trailer_window_offset(size);
+        auto length = static_cast<std::size_t>(size - offset);
+
+        for(std::size_t first = 0; first < key_count; first += key_lanes) {
+            // Pad the last group with the first key of the group
+            Key lane_keys[key_lanes];
+            char lane_blocks[key_lanes][trailer_window_size];
+            for(std::size_t lane = 0; lane < key_lanes; lane++) {
+                lane_keys[lane] = keys[first + lane < key_count ? first + lane : first];
+                std::memcpy(lane_blocks[lane], window + (offset - window_offset), length);
+            }
+
+            auto decrypt_lanes = [&](std::size_t position) {
+                char blocks[key_lanes * 8];
+                for(std::size_t lane = 0; lane < key_lanes; lane++) {
+                    std::memcpy(blocks + lane * 8, lane_blocks[lane] + position, 8);
+                }
+                decrypt_blocks_with_keys(blocks, lane_keys);
+                for(std::size_t lane = 0; lane < key_lanes; lane++) {
+                    std::memcpy(lane_blocks[lane] + position, blocks + lane * 8, 8);
+                }
+            };
+
+            if(size % 8) {
+                decrypt_lanes(length - 8);
+            }
+            for(std::size_t position = 0; position + 8 <= length; position += 8) {
+                decrypt_lanes(position);
+            }
+
+            for(std::size_t lane = 0; lane < key_lanes && first + lane < key_count; lane++) {
+                if(valid_trailer(lane_blocks[lane] + length - trailer_size)) {
+                    key_index = first + lane;
+                    return true;
+                }
+            }
+        }
+
+        return false;
+    }
+}
@@ -0,0 +1,67 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef COMPOSER__TRAILER_HPP
+#define COMPOSER__TRAILER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <composer/encrypt.hpp>
+#include <composer/result.hpp>
+#include <composer/xtea.hpp>
+
+namespace Composer {
+    /**
+     * Bytes at the end of encrypted shader data needed to decrypt the trailer: the blocks holding
+     * the 33 trailer bytes, including the overlapped tail
+     */
+    constexpr std::size_t trailer_window_size = trailer_size + 7;
+
+    /**
+     * Get the offset of the trailer window
+     * @param size  size of the encrypted shader data, at least trailer_size
+     * @return      offset of the first block holding trailer bytes
+     */
+    constexpr std::uint64_t trailer_window_offset(std::uint64_t size) noexcept {
+        return (size - trailer_size) / 8 * 8;
+    }
+
+    /**
+     * Decrypt only the trailer of encrypted shader data
+     * @param window        the last bytes of the data, starting at or before trailer_window_offset(size)
+     * @param window_offset offset of the window in the data
+     * @param size          size of the encrypted shader data, at least trailer_size
+     * @param key           key
+     * @param trailer       set to the decrypted trailer
+     */
+    void decrypt_trailer(char const *window, std::uint64_t window_offset, std::uint64_t size, Key const &key, char trailer[trailer_size]) noexcept;
+
+    /**
+     * Check if a decrypted trailer is well formed: 32 lowercase hex characters and a null terminator
+     * @param trailer   decrypted trailer
+     * @return          true if well formed
+     */
+    bool valid_trailer(char const trailer[trailer_size]) noexcept;
+
+    /**
+     * Get the raw shader data hash from a decrypted trailer
+     * @param trailer       decrypted trailer
+     * @param fingerprint   set to the raw MD5 hash
+     * @return              result of the operation, checksum_failed or not_null_terminated if malformed
+     */
+    Result trailer_fingerprint(char const trailer[trailer_size], unsigned char fingerprint[16]) noexcept;
+
+    /**
+     * Find the first key that decrypts the trailer into a well formed one, decrypting
+     * key_lanes candidates at once
+     * @param window        the last bytes of the data, starting at or before trailer_window_offset(size)
+     * @param window_offset offset of the window in the data
+     * @param size          size of the encrypted shader data, at least trailer_size
+     * @param keys          candidate keys
+     * @param key_count     number of candidate keys
+     * @param key_index     set to the index of the matching key
+     * @return              true if a key matched
+     */
+    bool detect_trailer_key(char const *window, std::uint64_t window_offset, std::uint64_t size, Key const *keys, std::size_t key_count, std::size_t &key_index) noexcept;
+}
+
+#endif
@@ -0,0 +1,259 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <new>
+#include <stdexcept>
+#include <vector>
+#include <composer/buffer.hpp>
+#include <composer/encrypt.hpp>
+#include <composer/file.hpp>
+#include "checksum.hpp"
+#include "output_file.hpp"
+#include "trailer.hpp"
+
+namespace Composer {
+    namespace {
+        /**
+         * Bytes decrypted, hashed and encrypted again in one go; small enough to stay in L1
+         */
+        constexpr std::size_t transcode_stride = 4096;
+
+        /**
+         * Size of the chunks read from and written to files
+         */
+        constexpr std::size_t transcode_chunk_size = 1 << 20;
+
+        /**
+         * Re-encrypts encrypted shader data front to back. Blocks before tail_offset are independent;
+         * the last whole block and the overlapped tail block share bytes and are done together.
+         */
+        class Transcoder {
+        public:
+            Transcoder(std::uint64_t size, Key const &from_key, Key const &to_key) noexcept : size(size), from_key(from_key), to_key(to_key) {
+                this->shader_size = size - trailer_size;
+                this->tail_offset = size % 8 ? size / 8 * 8 - 8 : size;
+            }
+
+            /**
+             * Offset of the blocks that have to go through tail()
+             */
+            std::uint64_t blocks_end() const noexcept {
+                return this->tail_offset;
+            }
+
+            /**
+             * Transcode blocks in [offset, offset + length), which must be before blocks_end()
+             */
+            void blocks(char const *input, char *output, std::uint64_t offset, std::size_t length) noexcept {
+                for(std::size_t done = 0; done < length; done += transcode_stride) {
+                    auto stride = std::min(transcode_stride, length - done);
+                    char *blocks = output + done;
+                    if(blocks != input + done) {
+                        std::memmove(blocks, input + done, stride);
+                    }
+
+                    decrypt_blocks(blocks, stride / 8, this->from_key);
+                    this->hash(blocks, offset + done, stride);
+                    encrypt_blocks(blocks, stride / 8, this->to_key);
+                }
+            }
+
+            /**
+             * Transcode the last size - blocks_end() bytes
+             */
+            void tail(char *data) noexcept {
+                auto length = static_cast<std::size_t>(this->size - this->tail_offset);
+                if(length == 0) {
+                    return;
+                }
+
+                // Undo the encryption in reverse order, then redo it
+                decrypt_blocks(data + length - 8, 1, this->from_key);
+                decrypt_blocks(data, 1, this->from_key);
+                this->hash(data, this->tail_offset, length);
+                encrypt_blocks(data, 1, this->to_key);
+                encrypt_blocks(data + length - 8, 1, this->to_key);
+            }
+
+            /**
+             * Compare the hash of everything transcoded with the trailer
+             */
+            Result check(char const trailer[trailer_size]) noexcept {
+                char hash[32];
+                format_checksum(this->md5, hash);
+                if(std::memcmp(hash, trailer, sizeof(hash)) != 0) {
+                    return { Status::checksum_failed };
+                }
+
+                if(trailer[trailer_size - 1] != 0) {
+                    return { Status::not_null_terminated };
+                }
+
+                return {};
+            }
+
+        private:
+            void hash(char const *plaintext, std::uint64_t offset, std::size_t length) noexcept {
+                if(offset < this->shader_size) {
+                    this->md5.add(plaintext, static_cast<std::size_t>(std::min<std::uint64_t>(length, this->shader_size - offset)));
+                }
+            }
+
+            std::uint64_t size;
+            std::uint64_t shader_size;
+            std::uint64_t tail_offset;
+            Key const &from_key;
+            Key const &to_key;
+            MD5 md5;
+        };
+
+        /**
+         * Hex digits of the trailer; if they aren't, the key is wrong and the hash can never match
+         */
+        bool valid_checksum(char const trailer[trailer_size]) noexcept {
+            char checksum[trailer_size];
+            std::memcpy(checksum, trailer, trailer_size - 1);
+            checksum[trailer_size - 1] = 0;
+            return valid_trailer(checksum);
+        }
+    }
+
+    Result try_transcode_shader(char const *encrypted_shader_data, std::size_t size, char *output, Key const &from_key, Key const &to_key) noexcept {
+        if(size < trailer_size) {
+            return { Status::data_too_small };
+        }
+
+        // The trailer is carried over as is, it is only needed up front to fail early on a wrong key
+        char trailer[trailer_size];
+        decrypt_trailer(encrypted_shader_data, 0, size, from_key, trailer);
+        if(!valid_checksum(trailer)) {
+            return { Status::checksum_failed };
+        }
+
+        Transcoder transcoder(size, from_key, to_key);
+        auto blocks_end = static_cast<std::size_t>(transcoder.blocks_end());
+        transcoder.blocks(encrypted_shader_data, output, 0, blocks_end);
+
+        char tail[16];
+        std::memcpy(tail, encrypted_shader_data + blocks_end, size - blocks_end);
+        transcoder.tail(tail);
+        std::memcpy(output + blocks_end, tail, size - blocks_end);
+
+        return transcoder.check(trailer);
+    }
+
+    std::vector<char> transcode_shader(std::vector<char> const &encrypted_shader_data, Key const &from_key, Key const &to_key) {
+        std::vector<char> buffer(encrypted_shader_data.size());
+
+        auto result = try_transcode_shader(encrypted_shader_data.data(), encrypted_shader_data.size(), buffer.data(), from_key, to_key);
+        if(!result) {
+            throw std::runtime_error(status_message(result.status));
+        }
+
+        return buffer;
+    }
+
+    Result try_transcode_shader_file(std::filesystem::path const &input_file, std::filesystem::path const &output_file, Key const &from_key, Key const &to_key) noexcept {
+        std::error_code ec;
+        if(!std::filesystem::exists(input_file, ec)) {
+            return { Status::file_not_found, ENOENT };
+        }
+
+        Result result;
+
+        try {
+            result = [&]() -> Result {
+                std::ifstream input(input_file, std::ios_base::in | std::ios_base::binary);
+                if(!input) {
+                    return { Status::read_failed, errno };
+                }
+
+                input.seekg(0, std::ios::end);
+                auto filesize = input.tellg();
+                if(filesize < 0) {
+                    return { Status::read_failed, errno };
+                }
+
+                auto size = static_cast<std::uint64_t>(filesize);
+                if(size < trailer_size) {
+                    return { Status::data_too_small };
+                }
+
+                char window[trailer_window_size];
+                auto window_offset = trailer_window_offset(size);
+                input.seekg(window_offset);
+                input.read(window, size - window_offset);
+                input.seekg(0);
+                if(!input) {
+                    return { Status::read_failed, errno };
+                }
+
+                char trailer[trailer_size];
+                decrypt_trailer(window, window_offset, size, from_key, trailer);
+                if(!valid_checksum(trailer)) {
+                    return { Status::checksum_failed };
+                }
+
+                Buffer buffer;
+                if(!buffer.allocate(static_cast<std::size_t>(std::min<std::uint64_t>(transcode_chunk_size, size)))) {
+                    return { Status::out_of_memory };
+                }
+
+                // Only put in place once the checksum is known to be good
+                OutputFile output;
+                auto output_result = output.open(output_file);
+                if(!output_result) {
+                    return output_result;
+                }
+
+                Transcoder transcoder(size, from_key, to_key);
+                auto blocks_end = transcoder.blocks_end();
+                for(std::uint64_t offset = 0; offset < blocks_end; offset += transcode_chunk_size) {
+                    auto length = static_cast<std::size_t>(std::min<std::uint64_t>(transcode_chunk_size, blocks_end - offset));
+                    input.read(buffer.data(), length);
+                    if(!input) {
+                        return { Status::read_failed, errno };
+                    }
+
+                    transcoder.blocks(buffer.data(), buffer.data(), offset, length);
+
+                    output_result = output.write(buffer.data(), length);
+                    if(!output_result) {
+                        return output_result;
+                    }
+                }
+
+                char tail[16];
+                auto tail_size = static_cast<std::size_t>(size - blocks_end);
+                input.read(tail, tail_size);
+                if(!input) {
+                    return { Status::read_failed, errno };
+                }
+                transcoder.tail(tail);
+                output_result = output.write(tail, tail_size);
+                if(!output_result) {
+                    return output_result;
+                }
+
+                auto check = transcoder.check(trailer);
+                if(!check) {
+                    return check;
+                }
+
+                return output.commit();
+            }();
+        }
+        catch(std::bad_alloc const &) {
+            result = { Status::out_of_memory };
+        }
+        catch(...) {
+            result = { Status::write_failed };
+        }
+
+        return result;
+    }
+}
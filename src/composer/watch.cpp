@@ -0,0 +1,176 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <algorithm>
+#include <cerrno>
+#include <new>
+#include <composer/watch.hpp>
+#include "output_file.hpp"
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace Composer {
+    DirectoryWatcher::~DirectoryWatcher() {
+        this->close();
+    }
+
+#ifdef __linux__
+    Result DirectoryWatcher::open(std::filesystem::path const &directory) noexcept {
+        this->close();
+
+        std::error_code ec;
+        if(!std::filesystem::is_directory(directory, ec)) {
+            return { Status::file_not_found, ENOENT };
+        }
+
+        this->descriptor = inotify_init1(IN_CLOEXEC);
+        if(this->descriptor < 0) {
+            return { Status::read_failed, errno };
+        }
+
+        if(!this->add_directory(directory)) {
+            auto error_number = errno;
+            this->close();
+            return { Status::read_failed, error_number };
+        }
+
+        try {
+            for(auto const &item : std::filesystem::recursive_directory_iterator(directory, ec)) {
+                if(item.is_directory(ec)) {
+                    this->add_directory(item.path());
+                }
+            }
+        }
+        catch(...) {
+            this->close();
+            return { Status::out_of_memory };
+        }
+
+        return {};
+    }
+
+    void DirectoryWatcher::close() noexcept {
+        if(this->descriptor >= 0) {
+            ::close(this->descriptor);
+            this->descriptor = -1;
+        }
+        this->directories.clear();
+    }
+
+    bool DirectoryWatcher::add_directory(std::filesystem::path const &directory) noexcept {
+        // Written files show up once closed or renamed into place, never half written
+        int watch = inotify_add_watch(this->descriptor, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ONLYDIR);
+        if(watch < 0) {
+            return false;
+        }
+
+        try {
+            this->directories[watch] = directory;
+        }
+        catch(...) {
+            inotify_rm_watch(this->descriptor, watch);
+            return false;
+        }
+        return true;
+    }
+
+    Result DirectoryWatcher::wait(std::vector<std::filesystem::path> &files, std::chrono::milliseconds debounce) noexcept {
+        files.clear();
+        if(this->descriptor < 0) {
+            return { Status::read_failed, EBADF };
+        }
+
+        alignas(inotify_event) char events[16 * 1024];
+        int timeout = -1;
+
+        try {
+            while(true) {
+                pollfd poll_descriptor = { this->descriptor, POLLIN, 0 };
+                int ready = poll(&poll_descriptor, 1, timeout);
+                if(ready < 0) {
+                    if(errno == EINTR) {
+                        continue;
+                    }
+                    return { Status::read_failed, errno };
+                }
+                if(ready == 0) {
+                    std::sort(files.begin(), files.end());
+                    files.erase(std::unique(files.begin(), files.end()), files.end());
+
+                    // Temporary files renamed during the burst are gone by now
+                    files.erase(std::remove_if(files.begin(), files.end(), [](std::filesystem::path const &file) {
+                        std::error_code ec;
+                        return !std::filesystem::is_regular_file(file, ec);
+                    }), files.end());
+                    return {};
+                }
+
+                auto length = read(this->descriptor, events, sizeof(events));
+                if(length < 0) {
+                    if(errno == EINTR || errno == EAGAIN) {
+                        continue;
+                    }
+                    return { Status::read_failed, errno };
+                }
+
+                for(char *position = events; position < events + length;) {
+                    auto *event = reinterpret_cast<inotify_event *>(position);
+                    position += sizeof(inotify_event) + event->len;
+
+                    auto directory = this->directories.find(event->wd);
+                    if(directory == this->directories.end() || event->len == 0) {
+                        continue;
+                    }
+
+                    auto path = directory->second / event->name;
+                    if(event->mask & IN_ISDIR) {
+                        // New subdirectories are watched too; files already in them are reported
+                        if(this->add_directory(path)) {
+                            std::error_code ec;
+                            for(auto const &item : std::filesystem::recursive_directory_iterator(path, ec)) {
+                                if(item.is_directory(ec)) {
+                                    this->add_directory(item.path());
+                                }
+                                else if(item.is_regular_file(ec) && !is_temporary_output_path(item.path())) {
+                                    files.push_back(item.path());
+                                }
+                            }
+                        }
+                    }
+                    else if(event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO) && !is_temporary_output_path(path)) {
+                        // Outputs written into the tree close their temporary file before renaming
+                        // it, so it may still be there when the burst ends
+                        files.push_back(std::move(path));
+                    }
+                }
+
+                // Keep collecting until the burst is over
+                if(!files.empty()) {
+                    timeout = static_cast<int>(debounce.count());
+                }
+            }
+        }
+        catch(...) {
+            return { Status::out_of_memory };
+        }
+    }
+#else
+    Result DirectoryWatcher::open(std::filesystem::path const &) noexcept {
+        return { Status::not_supported };
+    }
+
+    void DirectoryWatcher::close() noexcept {}
+
+    bool DirectoryWatcher::add_directory(std::filesystem::path const &) noexcept {
+        return false;
+    }
+
+    Result DirectoryWatcher::wait(std::vector<std::filesystem::path> &files, std::chrono::milliseconds) noexcept {
+        files.clear();
+        return { Status::not_supported };
+    }
+#endif
+}
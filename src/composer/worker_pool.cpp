@@ -0,0 +1,200 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <composer/worker_pool.hpp>
+
+namespace Composer {
+    namespace {
+        /**
+         * Items of a parallel_for; shared with the queued runners, which may start after it returned
+         */
+        struct ParallelFor {
+            std::size_t count;
+            std::function<void(std::size_t)> work;
+            std::atomic<std::size_t> next{0};
+            std::size_t finished = 0;
+            std::mutex mutex;
+            std::condition_variable done;
+
+            ParallelFor(std::size_t count, std::function<void(std::size_t)> work) : count(count), work(std::move(work)) {}
+
+            /**
+             * Run items until none are left
+             */
+            void run() {
+                std::size_t item;
+                std::size_t ran = 0;
+                while((item = this->next.fetch_add(1)) < this->count) {
+                    this->work(item);
+                    ran++;
+                }
+
+                if(ran) {
+                    std::lock_guard<std::mutex> lock(this->mutex);
+                    this->finished += ran;
+                    if(this->finished == this->count) {
+                        this->done.notify_all();
+                    }
+                }
+            }
+        };
+    }
+
+    WorkerPool::WorkerPool(std::size_t thread_count) {
+        this->start(thread_count, system_numa_topology());
+    }
+
+    WorkerPool::WorkerPool(std::size_t thread_count, NumaTopology const &topology) {
+        this->start(thread_count, topology);
+    }
+
+    void WorkerPool::start(std::size_t thread_count, NumaTopology const &topology) {
+        if(thread_count == 0) {
+            thread_count = std::max(std::thread::hardware_concurrency(), 1u);
+        }
+
+        // Every queue gets at least one thread
+        this->pinned = topology.is_numa() && thread_count > 1;
+        std::size_t queue_count = this->pinned ? std::min(topology.nodes.size(), thread_count) : 1;
+        for(std::size_t i = 0; i < queue_count; i++) {
+            this->queues.emplace_back();
+            if(this->pinned) {
+                this->queues.back().node = topology.nodes[i];
+            }
+        }
+
+        this->threads.reserve(thread_count);
+        try {
+            for(std::size_t i = 0; i < thread_count; i++) {
+                this->threads.emplace_back(&WorkerPool::work, this, i % queue_count);
+            }
+        }
+        catch(...) {
+            // No destructor runs for a constructor that throws, and joinable threads would terminate
+            this->stop();
+            throw;
+        }
+    }
+
+    WorkerPool::~WorkerPool() {
+        this->stop();
+    }
+
+    void WorkerPool::stop() noexcept {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->stopping = true;
+        }
+        for(auto &queue : this->queues) {
+            queue.job_available.notify_all();
+        }
+
+        for(auto &thread : this->threads) {
+            thread.join();
+        }
+    }
+
+    void WorkerPool::submit(std::function<void()> job) {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->enqueue(std::move(job), this->next_queue++);
+    }
+
+    void WorkerPool::submit(std::function<void()> job, std::size_t node) {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->enqueue(std::move(job), node);
+    }
+
+    void WorkerPool::enqueue(std::function<void()> job, std::size_t node) {
+        auto index = node % this->queues.size();
+        this->queues[index].jobs.push_back(std::move(job));
+        this->queued++;
+
+        // Wake a thread of the node, or else one that will steal the job
+        for(std::size_t i = 0; i < this->queues.size(); i++) {
+            auto &queue = this->queues[(index + i) % this->queues.size()];
+            if(queue.waiting > queue.wakeups) {
+                queue.wakeups++;
+                queue.job_available.notify_one();
+                break;
+            }
+        }
+    }
+
+    void WorkerPool::wait() {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->idle.wait(lock, [this] { return this->queued == 0 && this->running == 0; });
+    }
+
+    void WorkerPool::parallel_for(std::size_t count, std::function<void(std::size_t)> work) {
+        if(count == 0) {
+            return;
+        }
+
+        auto state = std::make_shared<ParallelFor>(count, std::move(work));
+        std::size_t runners = std::min(count, this->size()) - 1;
+        for(std::size_t i = 0; i < runners; i++) {
+            this->submit([state]() {
+                state->run();
+            });
+        }
+
+        state->run();
+
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->done.wait(lock, [&] { return state->finished == state->count; });
+    }
+
+    WorkerPool &shared_worker_pool() {
+        static WorkerPool pool;
+        return pool;
+    }
+
+    void WorkerPool::work(std::size_t queue_index) {
+        auto &own = this->queues[queue_index];
+        if(this->pinned) {
+            bind_thread_to_numa_node(own.node);
+        }
+
+        std::unique_lock<std::mutex> lock(this->mutex);
+        while(true) {
+            // Own node first, then the others in turn
+            NodeQueue *source = nullptr;
+            for(std::size_t i = 0; i < this->queues.size() && !source; i++) {
+                auto &queue = this->queues[(queue_index + i) % this->queues.size()];
+                if(!queue.jobs.empty()) {
+                    source = &queue;
+                }
+            }
+
+            if(!source) {
+                if(this->stopping) {
+                    return;
+                }
+
+                own.waiting++;
+                own.job_available.wait(lock, [&] { return own.wakeups > 0 || this->stopping; });
+                own.waiting--;
+                if(own.wakeups > 0) {
+                    own.wakeups--;
+                }
+                continue;
+            }
+
+            auto job = std::move(source->jobs.front());
+            source->jobs.pop_front();
+            this->queued--;
+            this->running++;
+
+            lock.unlock();
+            job();
+            lock.lock();
+
+            this->running--;
+            if(this->queued == 0 && this->running == 0) {
+                this->idle.notify_all();
+            }
+        }
+    }
+}
@@ -0,0 +1,361 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <composer/xtea.hpp>
+
+#if defined(__GNUC__) || defined(__clang__)
+#define COMPOSER_VECTOR_LANES
+#if defined(__x86_64__) || defined(__i386__)
+#define COMPOSER_AVX2_LANES
+#endif
+#endif
+
+namespace Composer {
+    constexpr const std::uint32_t delta = 0x61C88647;
+
+    static void encrypt_block(char *buffer, Key const &key) noexcept {
+        std::uint32_t slice_1;
+        std::uint32_t slice_2;
+        std::memcpy(&slice_1, buffer, 4);
+        std::memcpy(&slice_2, buffer + 4, 4);
+        std::int32_t sum = 0;
+
+        for(std::size_t i = 0; i < 32; i++) {
+            sum = static_cast<std::uint64_t>(sum) - delta;
+            slice_1 += (((slice_2 << 0x4) + key.words[2]) ^ ((slice_2 >> 0x5) + key.words[3])) ^ (sum + slice_2);
+            slice_2 += (((slice_1 >> 0x5) + key.words[0]) ^ ((slice_1 << 0x4) + key.words[1])) ^ (sum + slice_1);
+        }
+
+        std::memcpy(buffer, &slice_1, 4);
+        std::memcpy(buffer + 4, &slice_2, 4);
+    }
+
+    static void decrypt_block(char *buffer, Key const &key) noexcept {
+        std::uint32_t slice_1;
+        std::uint32_t slice_2;
+        std::memcpy(&slice_1, buffer, 4);
+        std::memcpy(&slice_2, buffer + 4, 4);
+        std::int32_t sum = 0xC6EF3720;
+
+        for(std::size_t i = 0; i < 32; i++) {
+            slice_2 -= (((slice_1 >> 0x5) + key.words[0]) ^ ((slice_1 << 0x4) + key.words[1])) ^ (sum + slice_1);
+            slice_1 -= (((slice_2 << 0x4) + key.words[2]) ^ ((slice_2 >> 0x5) + key.words[3])) ^ (sum + slice_2);
+            sum = static_cast<std::uint64_t>(sum) + delta;
+        }
+
+        std::memcpy(buffer, &slice_1, 4);
+        std::memcpy(buffer + 4, &slice_2, 4);
+    }
+
+    static void encrypt_blocks_scalar(char *data, std::size_t block_count, Key const &key) noexcept {
+        for(std::size_t i = 0; i < block_count; i++) {
+            encrypt_block(data + i * 8, key);
+        }
+    }
+
+    static void decrypt_blocks_scalar(char *data, std::size_t block_count, Key const &key) noexcept {
+        for(std::size_t i = 0; i < block_count; i++) {
+            decrypt_block(data + i * 8, key);
+        }
+    }
+
+    static void decrypt_blocks_with_keys_scalar(char *blocks, Key const *keys) noexcept {
+        for(std::size_t i = 0; i < key_lanes; i++) {
+            decrypt_block(blocks + i * 8, keys[i]);
+        }
+    }
+
+#ifdef COMPOSER_VECTOR_LANES
+    // One lane per block, the same code is compiled once for the baseline ISA and once for AVX2
+    typedef std::uint32_t Lanes __attribute__((vector_size(key_lanes * 4)));
+
+#define COMPOSER_LANES_INLINE inline __attribute__((always_inline))
+
+    COMPOSER_LANES_INLINE void load_lanes(char const *blocks, Lanes &slice_1, Lanes &slice_2) noexcept {
+        Lanes low;
+        Lanes high;
+        std::memcpy(&low, blocks, sizeof(low));
+        std::memcpy(&high, blocks + sizeof(low), sizeof(high));
+#ifdef __clang__
+        slice_1 = __builtin_shufflevector(low, high, 0, 2, 4, 6, 8, 10, 12, 14);
+        slice_2 = __builtin_shufflevector(low, high, 1, 3, 5, 7, 9, 11, 13, 15);
+#else
+        slice_1 = __builtin_shuffle(low, high, Lanes { 0, 2, 4, 6, 8, 10, 12, 14 });
+        slice_2 = __builtin_shuffle(low, high, Lanes { 1, 3, 5, 7, 9, 11, 13, 15 });
+#endif
+    }
+
+    COMPOSER_LANES_INLINE void store_lanes(char *blocks, Lanes const &slice_1, Lanes const &slice_2) noexcept {
+#ifdef __clang__
+        Lanes low = __builtin_shufflevector(slice_1, slice_2, 0, 8, 1, 9, 2, 10, 3, 11);
+        Lanes high = __builtin_shufflevector(slice_1, slice_2, 4, 12, 5, 13, 6, 14, 7, 15);
+#else
+        Lanes low = __builtin_shuffle(slice_1, slice_2, Lanes { 0, 8, 1, 9, 2, 10, 3, 11 });
+        Lanes high = __builtin_shuffle(slice_1, slice_2, Lanes { 4, 12, 5, 13, 6, 14, 7, 15 });
+#endif
+        std::memcpy(blocks, &low, sizeof(low));
+        std::memcpy(blocks + sizeof(low), &high, sizeof(high));
+    }
+
+    COMPOSER_LANES_INLINE void encrypt_lanes(Lanes &slice_1, Lanes &slice_2, Lanes const (&key)[4]) noexcept {
+        std::uint32_t sum = 0;
+        for(std::size_t i = 0; i < 32; i++) {
+            sum -= delta;
+            slice_1 += (((slice_2 << 0x4) + key[2]) ^ ((slice_2 >> 0x5) + key[3])) ^ (sum + slice_2);
+            slice_2 += (((slice_1 >> 0x5) + key[0]) ^ ((slice_1 << 0x4) + key[1])) ^ (sum + slice_1);
+        }
+    }
+
+    COMPOSER_LANES_INLINE void decrypt_lanes(Lanes &slice_1, Lanes &slice_2, Lanes const (&key)[4]) noexcept {
+        std::uint32_t sum = 0xC6EF3720;
+        for(std::size_t i = 0; i < 32; i++) {
+            slice_2 -= (((slice_1 >> 0x5) + key[0]) ^ ((slice_1 << 0x4) + key[1])) ^ (sum + slice_1);
+            slice_1 -= (((slice_2 << 0x4) + key[2]) ^ ((slice_2 >> 0x5) + key[3])) ^ (sum + slice_2);
+            sum += delta;
+        }
+    }
+
+    COMPOSER_LANES_INLINE void broadcast_key(Key const &key, Lanes (&lanes)[4]) noexcept {
+        for(std::size_t i = 0; i < 4; i++) {
+            lanes[i] = Lanes {} + key.words[i];
+        }
+    }
+
+    template<bool encrypt>
+    COMPOSER_LANES_INLINE void process_blocks_lanes(char *data, std::size_t block_count, Key const &key) noexcept {
+        Lanes key_lanes_words[4];
+        broadcast_key(key, key_lanes_words);
+
+        std::size_t i = 0;
+        for(; i + key_lanes <= block_count; i += key_lanes) {
+            Lanes slice_1;
+            Lanes slice_2;
+            load_lanes(data + i * 8, slice_1, slice_2);
+            if(encrypt) {
+                encrypt_lanes(slice_1, slice_2, key_lanes_words);
+            }
+            else {
+                decrypt_lanes(slice_1, slice_2, key_lanes_words);
+            }
+            store_lanes(data + i * 8, slice_1, slice_2);
+        }
+
+        if(encrypt) {
+            encrypt_blocks_scalar(data + i * 8, block_count - i, key);
+        }
+        else {
+            decrypt_blocks_scalar(data + i * 8, block_count - i, key);
+        }
+    }
+
+    COMPOSER_LANES_INLINE void decrypt_blocks_with_keys_lanes(char *blocks, Key const *keys) noexcept {
+        Lanes key_lanes_words[4];
+        for(std::size_t word = 0; word < 4; word++) {
+            for(std::size_t lane = 0; lane < key_lanes; lane++) {
+                key_lanes_words[word][lane] = keys[lane].words[word];
+            }
+        }
+
+        Lanes slice_1;
+        Lanes slice_2;
+        load_lanes(blocks, slice_1, slice_2);
+        decrypt_lanes(slice_1, slice_2, key_lanes_words);
+        store_lanes(blocks, slice_1, slice_2);
+    }
+
+    static void encrypt_blocks_vector(char *data, std::size_t block_count, Key const &key) noexcept {
+        process_blocks_lanes<true>(data, block_count, key);
+    }
+
+    static void decrypt_blocks_vector(char *data, std::size_t block_count, Key const &key) noexcept {
+        process_blocks_lanes<false>(data, block_count, key);
+    }
+
+    static void decrypt_blocks_with_keys_vector(char *blocks, Key const *keys) noexcept {
+        decrypt_blocks_with_keys_lanes(blocks, keys);
+    }
+#endif
+
+#ifdef COMPOSER_AVX2_LANES
+    __attribute__((target("avx2")))
+    static void encrypt_blocks_avx2(char *data, std::size_t block_count, Key const &key) noexcept {
+        process_blocks_lanes<true>(data, block_count, key);
+    }
+
+    __attribute__((target("avx2")))
+    static void decrypt_blocks_avx2(char *data, std::size_t block_count, Key const &key) noexcept {
+        process_blocks_lanes<false>(data, block_count, key);
+    }
+
+    __attribute__((target("avx2")))
+    static void decrypt_blocks_with_keys_avx2(char *blocks, Key const *keys) noexcept {
+        decrypt_blocks_with_keys_lanes(blocks, keys);
+    }
+#endif
+
+    namespace {
+        struct Kernels {
+            CipherBackend backend;
+            void (*encrypt)(char *data, std::size_t block_count, Key const &key) noexcept;
+            void (*decrypt)(char *data, std::size_t block_count, Key const &key) noexcept;
+            void (*decrypt_with_keys)(char *blocks, Key const *keys) noexcept;
+        };
+
+        constexpr Kernels scalar_kernels = { CipherBackend::scalar, encrypt_blocks_scalar, decrypt_blocks_scalar, decrypt_blocks_with_keys_scalar };
+#ifdef COMPOSER_VECTOR_LANES
+        constexpr Kernels vector_kernels = { CipherBackend::vector, encrypt_blocks_vector, decrypt_blocks_vector, decrypt_blocks_with_keys_vector };
+#endif
+#ifdef COMPOSER_AVX2_LANES
+        constexpr Kernels avx2_kernels = { CipherBackend::avx2, encrypt_blocks_avx2, decrypt_blocks_avx2, decrypt_blocks_with_keys_avx2 };
+#endif
+
+        Kernels const *kernels_for(CipherBackend backend) noexcept {
+            switch(backend) {
+                case CipherBackend::automatic:
+                    if(cipher_backend_supported(CipherBackend::avx2)) {
+                        return kernels_for(CipherBackend::avx2);
+                    }
+                    if(cipher_backend_supported(CipherBackend::vector)) {
+                        return kernels_for(CipherBackend::vector);
+                    }
+                    return &scalar_kernels;
+                case CipherBackend::scalar:
+                    return &scalar_kernels;
+#ifdef COMPOSER_VECTOR_LANES
+                case CipherBackend::vector:
+                    return &vector_kernels;
+#endif
+#ifdef COMPOSER_AVX2_LANES
+                case CipherBackend::avx2:
+                    return &avx2_kernels;
+#endif
+                default:
+                    return nullptr;
+            }
+        }
+
+        std::atomic<Kernels const *> current_kernels(nullptr);
+
+        Kernels const &kernels() noexcept {
+            auto *current = current_kernels.load(std::memory_order_relaxed);
+            if(!current) {
+                current = kernels_for(CipherBackend::automatic);
+                current_kernels.store(current, std::memory_order_relaxed);
+            }
+            return *current;
+        }
+    }
+
+    bool cipher_backend_supported(CipherBackend backend) noexcept {
+        switch(backend) {
+            case CipherBackend::automatic:
+            case CipherBackend::scalar:
+                return true;
+#ifdef COMPOSER_VECTOR_LANES
+            case CipherBackend::vector:
+                return true;
+#endif
+#ifdef COMPOSER_AVX2_LANES
+            case CipherBackend::avx2:
+                __builtin_cpu_init();
+                return __builtin_cpu_supports("avx2");
+#endif
+            default:
+                return false;
+        }
+    }
+
+    bool set_cipher_backend(CipherBackend backend) noexcept {
+        if(!cipher_backend_supported(backend)) {
+            return false;
+        }
+        current_kernels.store(kernels_for(backend), std::memory_order_relaxed);
+        return true;
+    }
+
+    CipherBackend cipher_backend() noexcept {
+        return kernels().backend;
+    }
+
+    const char *cipher_backend_name(CipherBackend backend) noexcept {
+        switch(backend) {
+            case CipherBackend::automatic:
+                return "automatic";
+            case CipherBackend::scalar:
+                return "scalar";
+            case CipherBackend::vector:
+                return "vector";
+            case CipherBackend::avx2:
+                return "avx2";
+        }
+        return "unknown";
+    }
+
+    bool parse_cipher_backend(std::string const &name, CipherBackend &backend) noexcept {
+        for(auto candidate : { CipherBackend::automatic, CipherBackend::scalar, CipherBackend::vector, CipherBackend::avx2 }) {
+            if(name == cipher_backend_name(candidate)) {
+                backend = candidate;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool parse_key(std::string const &text, Key &key) noexcept {
+        char const *current = text.c_str();
+        for(std::size_t i = 0; i < 4; i++) {
+            char *end;
+            errno = 0;
+            unsigned long long word = std::strtoull(current, &end, 16);
+            if(end == current || errno != 0 || word > 0xFFFFFFFF || *end != (i == 3 ? '\0' : ':')) {
+                return false;
+            }
+            key.words[i] = static_cast<std::uint32_t>(word);
+            current = end + 1;
+        }
+        return true;
+    }
+
+    bool read_key_table(std::filesystem::path const &filepath, std::vector<Key> &keys) {
+        std::ifstream file(filepath);
+        if(!file) {
+            return false;
+        }
+
+        keys.clear();
+        std::string line;
+        while(std::getline(file, line)) {
+            while(!line.empty() && (line.back() == '\r' || line.back() == ' ' || line.back() == '\t')) {
+                line.pop_back();
+            }
+            if(line.empty() || line[0] == '#') {
+                continue;
+            }
+
+            Key key;
+            if(!parse_key(line, key)) {
+                return false;
+            }
+            keys.push_back(key);
+        }
+
+        return true;
+    }
+
+    void encrypt_blocks(char *data, std::size_t block_count, Key const &key) noexcept {
+        kernels().encrypt(data, block_count, key);
+    }
+
+    void decrypt_blocks(char *data, std::size_t block_count, Key const &key) noexcept {
+        kernels().decrypt(data, block_count, key);
+    }
+
+    void decrypt_blocks_with_keys(char *blocks, Key const *keys) noexcept {
+        kernels().decrypt_with_keys(blocks, keys);
+    }
+}
@@ -0,0 +1,886 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <iostream>
+#include <filesystem>
+#include <composer/async.hpp>
+#include <composer/cache.hpp>
+#include <composer/encrypt.hpp>
+#include <composer/file.hpp>
+#include <composer/job.hpp>
+#include <composer/numa.hpp>
+#include <composer/profile.hpp>
+#include <composer/scheduler.hpp>
+#include <composer/watch.hpp>
+#include <composer/worker_pool.hpp>
+#include <composer/xtea.hpp>
+#include <hash-library/md5.h>
+#include <cmdline/cmdline.h>
+
+/*
+ * Reference implementations, frozen copies of the original scalar code. Everything the library
+ * does has to produce the same bytes, or Halo rejects the shaders. Don't optimize these.
+ */
+namespace Reference {
+    constexpr const std::uint32_t delta = 0x61C88647;
+
+    static void encrypt_block(char *buffer, Composer::Key const &key) {
+        std::uint32_t slice_1, slice_2;
+        std::memcpy(&slice_1, buffer, 4);
+        std::memcpy(&slice_2, buffer + 4, 4);
+        std::int32_t sum = 0;
+
+        for(std::size_t i = 0; i < 32; i++) {
+            sum = static_cast<std::uint64_t>(sum) - delta;
+            slice_1 += (((slice_2 << 0x4) + key.words[2]) ^ ((slice_2 >> 0x5) + key.words[3])) ^ (sum + slice_2);
+            slice_2 += (((slice_1 >> 0x5) + key.words[0]) ^ ((slice_1 << 0x4) + key.words[1])) ^ (sum + slice_1);
+        }
+
+        std::memcpy(buffer, &slice_1, 4);
+        std::memcpy(buffer + 4, &slice_2, 4);
+    }
+
+    static void decrypt_block(char *buffer, Composer::Key const &key) {
+        std::uint32_t slice_1, slice_2;
+        std::memcpy(&slice_1, buffer, 4);
+        std::memcpy(&slice_2, buffer + 4, 4);
+        std::int32_t sum = 0xC6EF3720;
+
+        for(std::size_t i = 0; i < 32; i++) {
+            slice_2 -= (((slice_1 >> 0x5) + key.words[0]) ^ ((slice_1 << 0x4) + key.words[1])) ^ (sum + slice_1);
+            slice_1 -= (((slice_2 << 0x4) + key.words[2]) ^ ((slice_2 >> 0x5) + key.words[3])) ^ (sum + slice_2);
+            sum = static_cast<std::uint64_t>(sum) + delta;
+        }
+
+        std::memcpy(buffer, &slice_1, 4);
+        std::memcpy(buffer + 4, &slice_2, 4);
+    }
+
+    /**
+     * Straight RFC 1321 MD5, one block at a time
+     */
+    static void md5(char const *data, std::size_t size, unsigned char hash[16]) {
+        static const std::uint32_t shifts[64] = {
+            7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+            5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+            4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+            6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+        };
+        static const std::uint32_t sines[64] = {
+            0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+            0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+            0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+            0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+            0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+            0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+            0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+            0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+        };
+
+        std::vector<unsigned char> message(data, data + size);
+        message.push_back(0x80);
+        while(message.size() % 64 != 56) {
+            message.push_back(0);
+        }
+        std::uint64_t bits = static_cast<std::uint64_t>(size) * 8;
+        for(std::size_t i = 0; i < 8; i++) {
+            message.push_back(static_cast<unsigned char>(bits >> (i * 8)));
+        }
+
+        std::uint32_t state[4] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
+        for(std::size_t block = 0; block < message.size(); block += 64) {
+            std::uint32_t words[16];
+            for(std::size_t i = 0; i < 16; i++) {
+                words[i] = 0;
+                for(std::size_t j = 0; j < 4; j++) {
+                    words[i] |= static_cast<std::uint32_t>(message[block + i * 4 + j]) << (j * 8);
+                }
+            }
+
+            std::uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+            for(std::size_t i = 0; i < 64; i++) {
+                std::uint32_t f;
+                std::size_t g;
+                if(i < 16) {
+                    f = (b & c) | (~b & d);
+                    g = i;
+                }
+                else if(i < 32) {
+                    f = (d & b) | (~d & c);
+                    g = (5 * i + 1) % 16;
+                }
+                else if(i < 48) {
+                    f = b ^ c ^ d;
+                    g = (3 * i + 5) % 16;
+                }
+                else {
+                    f = c ^ (b | ~d);
+                    g = (7 * i) % 16;
+                }
+                f += a + sines[i] + words[g];
+                a = d;
+                d = c;
+                c = b;
+                b += (f << shifts[i]) | (f >> (32 - shifts[i]));
+            }
+
+            state[0] += a;
+            state[1] += b;
+            state[2] += c;
+            state[3] += d;
+        }
+
+        for(std::size_t i = 0; i < 16; i++) {
+            hash[i] = static_cast<unsigned char>(state[i / 4] >> ((i % 4) * 8));
+        }
+    }
+
+    static std::vector<char> encrypt_shader(std::vector<char> const &shader_data, Composer::Key const &key) {
+        static const char dec2hex[16 + 1] = "0123456789abcdef";
+
+        unsigned char hash[16];
+        md5(shader_data.data(), shader_data.size(), hash);
+
+        auto buffer = shader_data;
+        for(auto byte : hash) {
+            buffer.push_back(dec2hex[byte >> 4]);
+            buffer.push_back(dec2hex[byte & 15]);
+        }
+        buffer.push_back(0);
+
+        auto buffer_size = buffer.size();
+        for(std::size_t i = 0; i < buffer_size / 8; i++) {
+            encrypt_block(buffer.data() + i * 8, key);
+        }
+        if(buffer_size % 8) {
+            encrypt_block(buffer.data() + buffer_size - 8, key);
+        }
+
+        return buffer;
+    }
+}
+
+namespace {
+    std::mutex output_mutex;
+    std::atomic<std::size_t> failures(0);
+    std::atomic<std::size_t> checks(0);
+
+    /**
+     * Where a case comes from, printed with failures so they can be reproduced
+     */
+    struct Case {
+        std::string stage;
+        std::uint64_t seed;
+        std::size_t thread;
+        std::size_t iteration;
+    };
+
+    void check(bool passed, Case const &where, std::string const &what) {
+        checks++;
+        if(passed) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(output_mutex);
+        if(failures++ < 20) {
+            std::cerr << "MISMATCH [" << where.stage << "] seed " << where.seed << " thread " << where.thread << " iteration " << where.iteration << ": " << what << std::endl;
+        }
+    }
+
+    Composer::Key random_key(std::mt19937_64 &random) {
+        if(random() % 4 == 0) {
+            return Composer::default_key;
+        }
+        Composer::Key key;
+        for(auto &word : key.words) {
+            word = static_cast<std::uint32_t>(random());
+        }
+        return key;
+    }
+
+    void fill(std::mt19937_64 &random, char *data, std::size_t size) {
+        for(std::size_t i = 0; i < size; i++) {
+            data[i] = static_cast<char>(random());
+        }
+    }
+
+    /**
+     * Sizes biased toward the edges: every tail length near the minimum, then anything
+     */
+    std::size_t random_size(std::mt19937_64 &random, std::size_t iteration, std::size_t minimum, std::size_t maximum) {
+        if(iteration < 64) {
+            return minimum + iteration;
+        }
+        switch(random() % 4) {
+            case 0:
+                return minimum + random() % 64;
+            case 1:
+                return minimum + random() % 4096;
+            default:
+                return minimum + random() % (maximum - minimum + 1);
+        }
+    }
+
+    void check_cipher(Case where, std::mt19937_64 &random) {
+        auto key = random_key(random);
+        std::size_t block_count = where.iteration < 64 ? where.iteration : random() % 2048;
+        std::size_t alignment = random() % 64;
+
+        std::vector<char> storage(block_count * 8 + 64);
+        char *blocks = storage.data() + alignment;
+        fill(random, blocks, block_count * 8);
+
+        std::vector<char> expected(blocks, blocks + block_count * 8);
+        for(std::size_t i = 0; i < block_count; i++) {
+            Reference::encrypt_block(expected.data() + i * 8, key);
+        }
+        Composer::encrypt_blocks(blocks, block_count, key);
+        check(std::memcmp(blocks, expected.data(), expected.size()) == 0, where, "encrypt_blocks, " + std::to_string(block_count) + " blocks at +" + std::to_string(alignment));
+
+        for(std::size_t i = 0; i < block_count; i++) {
+            Reference::decrypt_block(expected.data() + i * 8, key);
+        }
+        Composer::decrypt_blocks(blocks, block_count, key);
+        check(std::memcmp(blocks, expected.data(), expected.size()) == 0, where, "decrypt_blocks, " + std::to_string(block_count) + " blocks at +" + std::to_string(alignment));
+
+        Composer::Key keys[Composer::key_lanes];
+        char lanes[Composer::key_lanes * 8 + 64];
+        char *lane_blocks = lanes + alignment;
+        fill(random, lane_blocks, Composer::key_lanes * 8);
+        std::vector<char> lane_expected(lane_blocks, lane_blocks + Composer::key_lanes * 8);
+        for(std::size_t lane = 0; lane < Composer::key_lanes; lane++) {
+            keys[lane] = random_key(random);
+            Reference::decrypt_block(lane_expected.data() + lane * 8, keys[lane]);
+        }
+        Composer::decrypt_blocks_with_keys(lane_blocks, keys);
+        check(std::memcmp(lane_blocks, lane_expected.data(), lane_expected.size()) == 0, where, "decrypt_blocks_with_keys at +" + std::to_string(alignment));
+    }
+
+    void check_md5(Case where, std::mt19937_64 &random) {
+        std::size_t size = where.iteration < 256 ? where.iteration : random_size(random, where.iteration, 0, 1 << 16);
+        std::size_t alignment = random() % 64;
+        std::vector<char> storage(size + 64);
+        char *data = storage.data() + alignment;
+        fill(random, data, size);
+
+        unsigned char expected[16];
+        Reference::md5(data, size, expected);
+
+        // Feed it in random pieces to cover the buffering paths
+        MD5 md5;
+        for(std::size_t offset = 0; offset < size;) {
+            std::size_t piece = std::min<std::size_t>(size - offset, random() % 3 == 0 ? random() % 200 : size);
+            md5.add(data + offset, piece);
+            offset += piece;
+        }
+        unsigned char hash[16];
+        md5.getHash(hash);
+        check(std::memcmp(hash, expected, sizeof(hash)) == 0, where, "MD5 of " + std::to_string(size) + " bytes at +" + std::to_string(alignment));
+    }
+
+    void check_format(Case where, std::mt19937_64 &random) {
+        auto key = random_key(random);
+        auto other_key = random_key(random);
+        std::size_t size = random_size(random, where.iteration, 8, 1 << 16);
+        std::size_t alignment = random() % 64;
+
+        std::vector<char> shader(size);
+        fill(random, shader.data(), size);
+        auto expected = Reference::encrypt_shader(shader, key);
+        auto size_text = std::to_string(size) + " bytes at +" + std::to_string(alignment);
+
+        std::vector<char> storage(size + Composer::trailer_size + 64);
+        char *buffer = storage.data() + alignment;
+        std::size_t encrypted_size;
+        auto result = Composer::try_encrypt_shader(shader.data(), size, buffer, encrypted_size, key);
+        check(result && encrypted_size == expected.size() && std::memcmp(buffer, expected.data(), expected.size()) == 0, where, "try_encrypt_shader, " + size_text);
+
+        std::size_t decrypted_size;
+        result = Composer::try_decrypt_shader(expected.data(), expected.size(), buffer, decrypted_size, key);
+        check(result && decrypted_size == size && std::memcmp(buffer, shader.data(), size) == 0, where, "try_decrypt_shader, " + size_text);
+
+        unsigned char fingerprint[16];
+        unsigned char expected_fingerprint[16];
+        Reference::md5(shader.data(), size, expected_fingerprint);
+        result = Composer::try_shader_fingerprint(expected.data(), expected.size(), fingerprint, key);
+        check(result && std::memcmp(fingerprint, expected_fingerprint, 16) == 0, where, "try_shader_fingerprint, " + size_text);
+
+        Composer::Key keys[11];
+        std::size_t key_index = random() % 11;
+        for(auto &candidate : keys) {
+            candidate = random_key(random);
+        }
+        keys[key_index] = key;
+        std::size_t detected;
+        check(Composer::detect_shader_key(expected.data(), expected.size(), keys, 11, detected) && std::memcmp(&keys[detected], &key, sizeof(key)) == 0, where, "detect_shader_key, " + size_text);
+
+        auto transcoded_expected = Reference::encrypt_shader(shader, other_key);
+        result = Composer::try_transcode_shader(expected.data(), expected.size(), buffer, key, other_key);
+        check(result && std::memcmp(buffer, transcoded_expected.data(), transcoded_expected.size()) == 0, where, "try_transcode_shader, " + size_text);
+    }
+
+    /**
+     * Resumable decryption: in place or not, with block budgets, cancellation and deadlines, on
+     * intact, corrupted and too small data; the outcome has to match try_decrypt_shader
+     */
+    void check_job(Case where, std::mt19937_64 &random) {
+        auto key = random_key(random);
+        std::size_t size = random_size(random, where.iteration, 8, 1 << 16);
+        std::vector<char> shader(size);
+        fill(random, shader.data(), size);
+        auto encrypted = Reference::encrypt_shader(shader, key);
+
+        switch(random() % 8) {
+            case 0:
+                encrypted[random() % encrypted.size()] ^= static_cast<char>(1 + random() % 255);
+                break;
+            case 1:
+                encrypted.resize(random() % Composer::trailer_size);
+                break;
+        }
+
+        std::vector<char> reference(encrypted.size() + 1);
+        std::size_t reference_size = 0;
+        auto expected = Composer::try_decrypt_shader(encrypted.data(), encrypted.size(), reference.data(), reference_size, key);
+
+        bool in_place = random() % 2 == 0;
+        std::size_t alignment = random() % 64;
+        std::vector<char> storage(encrypted.size() + 64);
+        char *output = storage.data() + alignment;
+        char const *input = encrypted.data();
+        if(in_place) {
+            std::memcpy(output, encrypted.data(), encrypted.size());
+            input = output;
+        }
+
+        std::size_t block_count = encrypted.size() / 8;
+        Composer::StepBudget budget;
+        budget.max_blocks = 1 + random() % (random() % 2 ? 16 : block_count + 1);
+        auto text = std::to_string(encrypted.size()) + " bytes" + (in_place ? " in place" : "") + ", steps of " + std::to_string(budget.max_blocks) + " blocks";
+
+        Composer::DecryptJob job(input, encrypted.size(), output, key);
+
+        // Cancelled after some steps, or with a deadline already passed
+        std::size_t cancel_after = static_cast<std::size_t>(-1);
+        bool expired = false;
+        switch(random() % 8) {
+            case 0:
+                cancel_after = random() % (block_count / budget.max_blocks + 1);
+                break;
+            case 1:
+                expired = true;
+                job.set_deadline(std::chrono::steady_clock::now() - std::chrono::milliseconds(1));
+                break;
+            case 2:
+                job.set_deadline(std::chrono::steady_clock::now() + std::chrono::hours(1));
+                break;
+        }
+
+        std::size_t steps = 0;
+        double progress = 0;
+        bool monotonic = true;
+        while(!job.finished()) {
+            if(steps == cancel_after) {
+                job.cancel();
+            }
+            job.step(budget);
+            steps++;
+            monotonic = monotonic && job.progress() >= progress && job.progress() <= 1;
+            progress = job.progress();
+            if(steps > block_count + 4) {
+                break;
+            }
+        }
+        check(job.finished() && monotonic, where, "DecryptJob steps, " + text);
+
+        // Data too small to be a shader fails before any step
+        if(encrypted.size() < Composer::trailer_size) {
+            check(steps == 0 && job.result().status == Composer::Status::data_too_small, where, "DecryptJob too small, " + text);
+        }
+        else if(expired) {
+            check(job.result().status == Composer::Status::deadline_exceeded, where, "DecryptJob past deadline, " + text);
+        }
+        else if(cancel_after < steps) {
+            check(job.result().status == Composer::Status::cancelled, where, "DecryptJob cancelled, " + text);
+        }
+        else if(!expected) {
+            check(job.result().status == expected.status, where, "DecryptJob failure, " + text);
+        }
+        else {
+            // Every step but the last is full, so the budget was honoured
+            bool output_ok = job.result() && job.output_size() == reference_size && std::memcmp(output, reference.data(), reference_size) == 0;
+            check(output_ok && job.progress() == 1 && steps >= block_count / budget.max_blocks, where, "DecryptJob, " + text);
+        }
+    }
+
+    std::vector<char> read_file(std::filesystem::path const &file) {
+        std::ifstream stream(file, std::ios_base::binary);
+        return std::vector<char>((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+    }
+
+    /**
+     * The file paths that have their own block handling: pipelined mode and split batches
+     */
+    void check_files(Case where, std::mt19937_64 &random, std::filesystem::path const &directory, Composer::WorkerPool &pool) {
+        auto key = random_key(random);
+        std::size_t size = random_size(random, where.iteration, 8, 1 << 18);
+        std::vector<char> shader(size);
+        fill(random, shader.data(), size);
+        auto expected = Reference::encrypt_shader(shader, key);
+        auto size_text = std::to_string(size) + " bytes";
+
+        auto name = std::to_string(where.thread) + "-" + std::to_string(where.iteration);
+        auto plain_file = directory / (name + ".bin");
+        auto encrypted_file = directory / (name + ".enc");
+        auto output_file = directory / (name + ".out");
+        std::ofstream(plain_file, std::ios_base::binary).write(shader.data(), size);
+        std::ofstream(encrypted_file, std::ios_base::binary).write(expected.data(), expected.size());
+
+        Composer::PipelineOptions pipeline;
+        pipeline.chunk_size = 64 * (1 + random() % 64);
+        pipeline.chunk_count = 2 + random() % 4;
+        auto pipeline_text = size_text + ", chunks of " + std::to_string(pipeline.chunk_size);
+
+        auto result = Composer::try_encrypt_shader_file(plain_file, output_file, pipeline, key);
+        check(result && read_file(output_file) == expected, where, "pipelined encrypt, " + pipeline_text);
+        result = Composer::try_decrypt_shader_file(encrypted_file, output_file, pipeline, key);
+        check(result && read_file(output_file) == shader, where, "pipelined decrypt, " + pipeline_text);
+
+        Composer::SchedulerOptions scheduler;
+        scheduler.split_size = 0;
+        scheduler.segment_size = 8 * (1 + random() % 512);
+        auto scheduler_text = size_text + ", segments of " + std::to_string(scheduler.segment_size);
+
+        std::vector<Composer::ShaderTask> tasks(1);
+        tasks[0] = { plain_file, output_file, size, {} };
+        Composer::run_shader_tasks(tasks, Composer::Operation::encrypt, pool, scheduler, key);
+        check(tasks[0].result && read_file(output_file) == expected, where, "split encrypt, " + scheduler_text);
+        tasks[0] = { encrypted_file, output_file, expected.size(), {} };
+        Composer::run_shader_tasks(tasks, Composer::Operation::decrypt, pool, scheduler, key);
+        check(tasks[0].result && read_file(output_file) == shader, where, "split decrypt, " + scheduler_text);
+
+        std::error_code ec;
+        std::filesystem::remove(plain_file, ec);
+        std::filesystem::remove(encrypted_file, ec);
+        std::filesystem::remove(output_file, ec);
+    }
+
+    Composer::Task<void> offload_encrypt(Composer::EventLoop &loop, Composer::WorkerPool &pool, Case where, std::vector<char> const &shader, std::vector<char> const &expected, Composer::Key key) {
+        auto encrypted = co_await Composer::offload(loop, pool, [&]() {
+            return Composer::encrypt_shader(shader, key);
+        });
+        check(encrypted == expected, where, "offload encrypt_shader, " + std::to_string(shader.size()) + " bytes");
+    }
+
+    Composer::Task<void> offload_files(Composer::EventLoop &loop, Composer::WorkerPool &pool, Case where, std::filesystem::path const &directory, std::vector<char> const &shader, std::vector<char> const &expected, Composer::Key key) {
+        auto size_text = std::to_string(shader.size()) + " bytes";
+        auto name = "async-" + std::to_string(where.thread) + "-" + std::to_string(where.iteration);
+        auto plain_file = directory / (name + ".bin");
+        auto encrypted_file = directory / (name + ".enc");
+        auto output_file = directory / (name + ".out");
+        std::ofstream(plain_file, std::ios_base::binary).write(shader.data(), shader.size());
+        std::ofstream(encrypted_file, std::ios_base::binary).write(expected.data(), expected.size());
+
+        auto result = co_await Composer::encrypt_shader_file_async(loop, pool, plain_file, output_file, key);
+        check(result && read_file(output_file) == expected, where, "encrypt_shader_file_async, " + size_text);
+        result = co_await Composer::decrypt_shader_file_async(loop, pool, encrypted_file, output_file, key);
+        check(result && read_file(output_file) == shader, where, "decrypt_shader_file_async, " + size_text);
+
+        std::vector<char> loaded;
+        result = co_await Composer::load_shader_file_async(loop, pool, encrypted_file, loaded, key);
+        check(result && loaded == shader, where, "load_shader_file_async, " + size_text);
+
+        std::error_code ec;
+        std::filesystem::remove(plain_file, ec);
+        std::filesystem::remove(encrypted_file, ec);
+        std::filesystem::remove(output_file, ec);
+    }
+
+    /**
+     * Coroutines offloading to the pool and resuming on a loop, which is destroyed as soon as
+     * run() returns while the pool threads may still be leaving the jobs that resumed it
+     */
+    void check_async(Case where, std::mt19937_64 &random, std::filesystem::path const &directory, Composer::WorkerPool &pool) {
+        auto key = random_key(random);
+        std::size_t size = random_size(random, where.iteration, 8, 1 << 16);
+        std::vector<char> shader(size);
+        fill(random, shader.data(), size);
+        auto expected = Reference::encrypt_shader(shader, key);
+
+        Composer::EventLoop loop;
+        std::size_t offload_count = random() % 4;
+        for(std::size_t i = 0; i < offload_count; i++) {
+            loop.spawn(offload_encrypt(loop, pool, where, shader, expected, key));
+        }
+        loop.run(offload_files(loop, pool, where, directory, shader, expected, key));
+    }
+
+    /**
+     * Queues of a pool on a fake two node topology: jobs run on the node they were submitted to
+     * unless its threads are busy, and then another node's threads take them
+     */
+    void check_numa_pool(Case where, Composer::NumaTopology const &topology) {
+        Composer::WorkerPool pool(2, topology);
+        check(pool.node_count() == 2, where, "pool of 2 threads on 2 nodes has 2 queues");
+
+        // Both on node 0, whose only thread can't run the second while the first waits for it
+        std::mutex mutex;
+        std::condition_variable changed;
+        bool second_ran = false;
+        std::size_t nodes[2] = { Composer::no_numa_node, Composer::no_numa_node };
+        pool.submit([&]() {
+            std::unique_lock<std::mutex> lock(mutex);
+            nodes[0] = Composer::current_numa_node();
+            changed.wait_for(lock, std::chrono::seconds(10), [&] { return second_ran; });
+        }, 0);
+        pool.submit([&]() {
+            std::lock_guard<std::mutex> lock(mutex);
+            nodes[1] = Composer::current_numa_node();
+            second_ran = true;
+            changed.notify_all();
+        }, 0);
+        pool.wait();
+        check(second_ran && (nodes[0] == 1 || nodes[1] == 1), where, "idle node steals from a busy one");
+
+        // Jobs for every node, and parallel_for over both
+        std::atomic<std::size_t> ran(0);
+        for(std::size_t i = 0; i < 64; i++) {
+            pool.submit([&]() {
+                ran++;
+            }, i);
+        }
+        pool.wait();
+        std::vector<std::atomic<int>> items(1000);
+        pool.parallel_for(items.size(), [&](std::size_t index) {
+            items[index]++;
+        });
+        check(ran == 64 && std::all_of(items.begin(), items.end(), [](std::atomic<int> const &item) { return item == 1; }), where, "jobs submitted per node and parallel_for all ran once");
+    }
+
+    /**
+     * Shaders for the cache checks, plain, encrypted and in files
+     */
+    struct CacheCorpus {
+        Composer::Key key;
+        std::vector<std::vector<char>> shaders;
+        std::vector<std::vector<char>> encrypted;
+        std::vector<std::filesystem::path> files;
+        std::size_t bytes = 0;
+    };
+
+    /** Shards of the caches checked, and the part of the corpus that fits in them */
+    constexpr const std::size_t cache_shards = 4;
+    constexpr const std::size_t cache_fraction = 4;
+
+    CacheCorpus make_cache_corpus(std::uint64_t seed, std::filesystem::path const &directory) {
+        std::mt19937_64 random(seed);
+        CacheCorpus corpus;
+        corpus.key = random_key(random);
+        for(std::size_t i = 0; i < 64; i++) {
+            std::vector<char> shader(8 + random() % 16384);
+            fill(random, shader.data(), shader.size());
+            corpus.encrypted.push_back(Reference::encrypt_shader(shader, corpus.key));
+            corpus.files.push_back(directory / ("cache-" + std::to_string(i) + ".enc"));
+            std::ofstream(corpus.files.back(), std::ios_base::binary).write(corpus.encrypted.back().data(), corpus.encrypted.back().size());
+            corpus.bytes += shader.size();
+            corpus.shaders.push_back(std::move(shader));
+        }
+        return corpus;
+    }
+
+    /**
+     * Look up a random shader in a cache shared by the threads, by data, by file, or corrupted
+     */
+    void check_cache(Case where, std::mt19937_64 &random, CacheCorpus const &corpus, Composer::ShaderCache &cache, std::atomic<std::uint64_t> &lookups) {
+        std::size_t index = random() % corpus.shaders.size();
+        auto const &shader = corpus.shaders[index];
+        auto const &encrypted = corpus.encrypted[index];
+        auto size_text = std::to_string(shader.size()) + " bytes";
+
+        Composer::SharedShader cached;
+        Composer::Result result;
+        lookups++;
+        switch(random() % 4) {
+            case 0:
+                result = cache.decrypt_file(corpus.files[index], cached, corpus.key);
+                check(result && *cached == shader, where, "cached decrypt_file, " + size_text);
+                break;
+            case 1: {
+                // Has to fail, and not be cached as the shader it was made from
+                auto corrupted = encrypted;
+                corrupted[random() % corrupted.size()] ^= static_cast<char>(1 + random() % 255);
+                result = cache.decrypt(corrupted.data(), corrupted.size(), cached, corpus.key);
+                check(!result, where, "cached decrypt of corrupted data, " + size_text);
+                break;
+            }
+            default:
+                result = cache.decrypt(encrypted.data(), encrypted.size(), cached, corpus.key);
+                check(result && *cached == shader, where, "cached decrypt, " + size_text);
+                break;
+        }
+    }
+
+    /**
+     * After the threads: hits once cached, evictions past the budget, and counters that add up
+     */
+    void check_cache_stats(Case where, CacheCorpus const &corpus, Composer::ShaderCache &cache, std::uint64_t lookups) {
+        std::size_t budget = corpus.bytes / cache_fraction;
+        for(std::size_t i = 0; i < corpus.shaders.size(); i++) {
+            auto const &encrypted = corpus.encrypted[i];
+            auto size_text = std::to_string(corpus.shaders[i].size()) + " bytes";
+
+            Composer::SharedShader first;
+            Composer::SharedShader second;
+            auto result = cache.decrypt(encrypted.data(), encrypted.size(), first, corpus.key);
+            auto hits = cache.stats().hits;
+            result = result ? cache.decrypt(encrypted.data(), encrypted.size(), second, corpus.key) : result;
+            lookups += 2;
+
+            if(corpus.shaders[i].size() <= budget / cache_shards) {
+                check(result && cache.stats().hits == hits + 1 && first == second, where, "cache hit after insert, " + size_text);
+            }
+            else {
+                check(result && *second == corpus.shaders[i], where, "uncached decrypt, " + size_text);
+            }
+        }
+
+        auto stats = cache.stats();
+        check(stats.hits + stats.misses == lookups, where, "cache hits and misses add up to " + std::to_string(lookups) + " lookups");
+        check(stats.bytes <= budget, where, "cache holds " + std::to_string(stats.bytes) + " bytes over a budget of " + std::to_string(budget));
+        check(stats.evictions > 0 && stats.entries + stats.evictions <= stats.misses, where, "cache entries and evictions within the misses");
+
+        cache.clear();
+        stats = cache.stats();
+        check(stats.entries == 0 && stats.bytes == 0, where, "cache empty after clear");
+    }
+
+    /**
+     * Files written in a burst into a watched tree, plain ones and atomic outputs of the library,
+     * some in a subdirectory created meanwhile: each is reported, and the temporary files outputs
+     * go through before their rename never are
+     */
+    void check_watch(Case where, std::mt19937_64 &random, std::filesystem::path const &directory) {
+        auto watched = directory / ("watch-" + std::to_string(where.thread) + "-" + std::to_string(where.iteration));
+        std::filesystem::create_directories(watched);
+
+        Composer::DirectoryWatcher watcher;
+        auto result = watcher.open(watched);
+        if(!result) {
+            check(false, where, "watch " + watched.string() + ": " + Composer::status_message(result.status));
+            return;
+        }
+
+        auto key = random_key(random);
+        std::size_t count = 1 + random() % 16;
+        auto debounce = std::chrono::milliseconds(random() % 2);
+        bool subdirectory = random() % 2;
+        std::set<std::filesystem::path> expected;
+        std::vector<std::vector<char>> shaders(count);
+        for(std::size_t i = 0; i < count; i++) {
+            auto parent = subdirectory && i >= count / 2 ? watched / "sub" : watched;
+            auto name = "f" + std::to_string(i);
+            expected.insert(parent / (name + ".bin"));
+            expected.insert(parent / (name + ".enc"));
+            shaders[i].resize(random_size(random, where.iteration, 8, 1 << 16));
+            fill(random, shaders[i].data(), shaders[i].size());
+        }
+
+        // Written last; events come in order, so once it is reported every other file was too
+        auto sentinel = watched / "done";
+        expected.insert(sentinel);
+
+        auto text = std::to_string(count) + " files, debounce " + std::to_string(debounce.count()) + " ms";
+        std::thread writer([&]() {
+            for(std::size_t i = 0; i < count; i++) {
+                auto parent = subdirectory && i >= count / 2 ? watched / "sub" : watched;
+                std::error_code ec;
+                std::filesystem::create_directories(parent, ec);
+
+                auto name = "f" + std::to_string(i);
+                std::ofstream(parent / (name + ".bin"), std::ios_base::binary).write(shaders[i].data(), shaders[i].size());
+                auto encrypted = Composer::try_encrypt_shader_file(parent / (name + ".bin"), parent / (name + ".enc"), key);
+                check(static_cast<bool>(encrypted), where, "encrypt into watched tree, " + text + ": " + Composer::status_message(encrypted.status));
+            }
+            std::ofstream(sentinel, std::ios_base::binary) << "done";
+        });
+
+        std::set<std::filesystem::path> seen;
+        std::vector<std::filesystem::path> files;
+        while(!seen.count(sentinel)) {
+            result = watcher.wait(files, debounce);
+            if(!result) {
+                check(false, where, "wait for files, " + text);
+                break;
+            }
+            for(auto const &file : files) {
+                auto name = file.filename().string();
+                check(name.size() < 4 || name.compare(name.size() - 4, 4, ".tmp") != 0, where, "temporary output reported: " + file.string() + ", " + text);
+                if(expected.count(file)) {
+                    seen.insert(file);
+                }
+                else {
+                    check(false, where, "unexpected file reported: " + file.string() + ", " + text);
+                }
+            }
+        }
+        writer.join();
+        check(seen == expected, where, "every file written reported, " + text);
+
+        watcher.close();
+        std::error_code ec;
+        std::filesystem::remove_all(watched, ec);
+    }
+
+    /**
+     * Run a check on several threads at once, splitting the iterations between them
+     */
+    template<typename Check>
+    void run_threads(std::string const &stage, std::uint64_t seed, std::size_t thread_count, std::size_t iterations, Check &&check) {
+        std::vector<std::thread> threads;
+        for(std::size_t thread = 0; thread < thread_count; thread++) {
+            threads.emplace_back([&, thread]() {
+                for(std::size_t iteration = thread; iteration < iterations; iteration += thread_count) {
+                    Case where = { stage, seed, thread, iteration };
+                    std::mt19937_64 random(seed ^ (iteration * 0x9E3779B97F4A7C15ULL));
+                    check(where, random);
+                }
+            });
+        }
+        for(auto &thread : threads) {
+            thread.join();
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    cmdline::parser options;
+    options.set_program_name("composer-conformance");
+    options.add<int>("iterations", 'i', "Random cases per check and configuration.", false, 2000);
+    options.add<unsigned long long>("seed", 's', "Seed of the random cases, 0 for a random one.", false, 0);
+    options.add<int>("threads", 't', "Highest thread count; checks run with 1, 2, 4... threads up to it.", false, 4);
+    options.add("help", 'h', "Print this message.");
+
+    options.parse_check(argc, argv);
+
+    std::uint64_t seed = options.get<unsigned long long>("seed");
+    if(seed == 0) {
+        seed = std::random_device()() | 1;
+    }
+    std::size_t iterations = static_cast<std::size_t>(std::max(options.get<int>("iterations"), 1));
+    std::size_t max_threads = static_cast<std::size_t>(std::max(options.get<int>("threads"), 1));
+
+    std::vector<std::size_t> thread_counts;
+    for(std::size_t count = 1; count < max_threads; count *= 2) {
+        thread_counts.push_back(count);
+    }
+    thread_counts.push_back(max_threads);
+
+    std::cout << "seed " << seed << std::endl;
+
+    auto directory = std::filesystem::temp_directory_path() / ("composer-conformance-" + std::to_string(seed));
+    std::filesystem::create_directories(directory);
+    Composer::WorkerPool pool(max_threads);
+
+    for(auto backend : { Composer::CipherBackend::scalar, Composer::CipherBackend::vector, Composer::CipherBackend::avx2 }) {
+        if(!Composer::set_cipher_backend(backend)) {
+            std::cout << "cipher " << Composer::cipher_backend_name(backend) << ": not supported, skipped" << std::endl;
+            continue;
+        }
+
+        auto before = failures.load();
+        for(auto thread_count : thread_counts) {
+            run_threads(std::string("cipher ") + Composer::cipher_backend_name(backend), seed, thread_count, iterations, check_cipher);
+            run_threads(std::string("format ") + Composer::cipher_backend_name(backend), seed, thread_count, iterations, check_format);
+            run_threads(std::string("job ") + Composer::cipher_backend_name(backend), seed, thread_count, iterations / 4 + 1, check_job);
+            run_threads(std::string("files ") + Composer::cipher_backend_name(backend), seed, thread_count, iterations / 20 + 1, [&](Case where, std::mt19937_64 &random) {
+                check_files(where, random, directory, pool);
+            });
+        }
+        std::cout << "cipher " << Composer::cipher_backend_name(backend) << ": " << (failures.load() == before ? "ok" : "FAILED") << std::endl;
+    }
+    Composer::set_cipher_backend(Composer::CipherBackend::automatic);
+
+    auto before_async = failures.load();
+    for(auto thread_count : thread_counts) {
+        run_threads("async", seed, thread_count, iterations / 10 + 1, [&](Case where, std::mt19937_64 &random) {
+            check_async(where, random, directory, pool);
+        });
+    }
+    std::cout << "async: " << (failures.load() == before_async ? "ok" : "FAILED") << std::endl;
+
+    // NUMA placement on a fake topology, so it is covered on machines with a single node too
+    auto before_numa = failures.load();
+    Composer::NumaTopology topology;
+    check(Composer::parse_numa_topology("0/0", topology) && topology.nodes.size() == 2, { "numa", seed, 0, 0 }, "parse fake topology 0/0");
+    check_numa_pool({ "numa", seed, 0, 0 }, topology);
+    {
+        Composer::WorkerPool numa_pool(std::max<std::size_t>(max_threads, 2), topology);
+        for(auto thread_count : thread_counts) {
+            run_threads("files numa", seed, thread_count, iterations / 20 + 1, [&](Case where, std::mt19937_64 &random) {
+                check_files(where, random, directory, numa_pool);
+            });
+        }
+    }
+    std::cout << "numa: " << (failures.load() == before_numa ? "ok" : "FAILED") << std::endl;
+
+    auto before_cache = failures.load();
+    auto cache_corpus = make_cache_corpus(seed, directory);
+    for(auto thread_count : thread_counts) {
+        Composer::ShaderCache cache(cache_corpus.bytes / cache_fraction, cache_shards);
+        std::atomic<std::uint64_t> lookups(0);
+        run_threads("cache", seed, thread_count, iterations, [&](Case where, std::mt19937_64 &random) {
+            check_cache(where, random, cache_corpus, cache, lookups);
+        });
+        check_cache_stats({ "cache stats", seed, thread_count, 0 }, cache_corpus, cache, lookups.load());
+    }
+    std::cout << "cache: " << (failures.load() == before_cache ? "ok" : "FAILED") << std::endl;
+
+    // Watch mode encrypts next to its inputs, into the tree it watches
+    Composer::DirectoryWatcher probe;
+    if(probe.open(directory).status == Composer::Status::not_supported) {
+        std::cout << "watch: not supported, skipped" << std::endl;
+    }
+    else {
+        probe.close();
+        auto before_watch = failures.load();
+        for(auto thread_count : thread_counts) {
+            run_threads("watch", seed, thread_count, iterations / 20 + 1, [&](Case where, std::mt19937_64 &random) {
+                check_watch(where, random, directory);
+            });
+        }
+        std::cout << "watch: " << (failures.load() == before_watch ? "ok" : "FAILED") << std::endl;
+    }
+
+    for(auto kernel : { MD5::Portable, MD5::Bmi, MD5::Avx512 }) {
+        if(!MD5::setKernel(kernel)) {
+            std::cout << "md5 " << Composer::md5_kernel_name(kernel) << ": not supported, skipped" << std::endl;
+            continue;
+        }
+
+        auto before = failures.load();
+        for(auto thread_count : thread_counts) {
+            run_threads(std::string("md5 ") + Composer::md5_kernel_name(kernel), seed, thread_count, iterations, check_md5);
+            run_threads(std::string("format md5 ") + Composer::md5_kernel_name(kernel), seed, thread_count, iterations / 4 + 1, check_format);
+        }
+        std::cout << "md5 " << Composer::md5_kernel_name(kernel) << ": " << (failures.load() == before ? "ok" : "FAILED") << std::endl;
+    }
+    MD5::setKernel(MD5::Auto);
+
+    std::error_code ec;
+    std::filesystem::remove_all(directory, ec);
+
+    std::cout << checks.load() << " checks, " << failures.load() << " mismatches" << std::endl;
+    return failures.load() ? 1 : 0;
+}
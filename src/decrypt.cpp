@@ -1,17 +1,59 @@
 // SPDX-License-Identifier: GPL-3.0-only
 
+#include <algorithm>
+#include <cstdint>
 #include <string>
+#include <vector>
 #include <iostream>
 #include <filesystem>
+#include <composer/buffer.hpp>
 #include <composer/file.hpp>
+#include <composer/profile.hpp>
+#include <composer/scheduler.hpp>
+#include <composer/tar.hpp>
+#include <composer/worker_pool.hpp>
+#include <composer/xtea.hpp>
 #include <cmdline/cmdline.h>
 
+/**
+ * Decrypt every file of a tar stream from stdin to stdout
+ */
+static int transform_tar(std::uint64_t max_memory, Composer::Key const &key) {
+    std::ios_base::sync_with_stdio(false);
+
+    Composer::WorkerPool pool(Composer::active_profile().thread_count);
+    Composer::TarStreamOptions tar_options;
+    tar_options.max_bytes_in_flight = max_memory;
+    Composer::TarStreamStats stats;
+
+    auto result = Composer::transform_tar_stream(std::cin, std::cout, Composer::Operation::decrypt, pool, tar_options, stats, key);
+    if(!result) {
+        std::cerr << "failed to decrypt tar stream";
+        if(!stats.failed_entry.empty()) {
+            std::cerr << " at " << stats.failed_entry;
+        }
+        std::cerr << ": " << Composer::status_message(result.status) << std::endl;
+        return 1;
+    }
+
+    // stdout carries the archive
+    std::cerr << "decrypted " << stats.files << " shader files in " << stats.entries << " tar entries" << std::endl;
+    return 0;
+}
+
 int main(int argc, char *argv[]) {
     cmdline::parser options;
     options.set_program_name("composer-decrypt");
     options.add<std::string>("output", 'o', "Decrypted shader output file.", false);
+    options.add("pipeline", 'p', "Overlap reading, decryption and writing (for large files).");
+    options.add<std::string>("alloc", 'a', "Buffer allocation policy: standard, prefault, thp or hugetlb.", false);
+    options.add<std::string>("key", 'k', "XTEA key as four hex words, e.g. 3fffef:e5:3fffffdd:7fc3.", false);
+    options.add<std::string>("keys", 'K', "Key table file; the key is detected from the end of the input.", false);
+    options.add("fingerprint", 'f', "Print the MD5 hash of the shader data of each input without decrypting it.");
+    options.add("tar", 't', "Decrypt every file of a tar stream from stdin to stdout.");
+    options.add<int>("max-memory", 'm', "Cap in MiB on the file data held in memory at once with --tar.", false, 256);
     options.add("help", 'h', "Print this message.");
-    options.footer("<input-file>");
+    options.footer("<input-file> [more input files with --fingerprint]");
 
     if(argc == 1) {
         std::cout << options.usage() << std::endl;
@@ -20,12 +62,47 @@ int main(int argc, char *argv[]) {
 
     options.parse_check(argc, argv);
 
+    // Machine profile from composer-tune, options given here override it
+    auto profile_result = Composer::load_profile();
+    if(!profile_result && profile_result.status != Composer::Status::file_not_found) {
+        std::cerr << "ignoring machine profile: " << Composer::status_message(profile_result.status) << std::endl;
+    }
+
     auto rest = options.rest();
-    if(rest.empty()) {
+    if(rest.empty() && !options.exist("tar")) {
         std::cout << "need option: input file path" << std::endl;
         std::exit(1);
     }
 
+    if(options.exist("alloc")) {
+        Composer::AllocationPolicy allocation_policy;
+        if(!Composer::parse_allocation_policy(options.get<std::string>("alloc"), allocation_policy)) {
+            std::cout << "invalid allocation policy: " << options.get<std::string>("alloc") << std::endl;
+            std::exit(1);
+        }
+        Composer::set_allocation_policy(allocation_policy);
+    }
+
+    Composer::Key key = Composer::default_key;
+    if(options.exist("key") && !Composer::parse_key(options.get<std::string>("key"), key)) {
+        std::cout << "invalid key: " << options.get<std::string>("key") << std::endl;
+        std::exit(1);
+    }
+
+    std::vector<Composer::Key> keys;
+    if(options.exist("keys") && !Composer::read_key_table(options.get<std::string>("keys"), keys)) {
+        std::cout << "invalid key table: " << options.get<std::string>("keys") << std::endl;
+        std::exit(1);
+    }
+
+    if(options.exist("tar")) {
+        if(!keys.empty()) {
+            std::cout << "--keys can't be used with --tar" << std::endl;
+            std::exit(1);
+        }
+        return transform_tar(static_cast<std::uint64_t>(std::max(options.get<int>("max-memory"), 1)) << 20, key);
+    }
+
     std::filesystem::path input_file = rest[0];
     std::filesystem::path output_file = input_file;
     output_file.replace_extension(".bin");
@@ -33,9 +110,59 @@ int main(int argc, char *argv[]) {
     if(options.exist("output")) {
         output_file = options.get<std::string>("output");
     }
-    
+
+    auto detect_key = [&](std::filesystem::path const &file) -> bool {
+        if(keys.empty()) {
+            return true;
+        }
+
+        std::size_t key_index;
+        auto result = Composer::try_detect_shader_file_key(file, keys.data(), keys.size(), key_index);
+        if(!result) {
+            std::cerr << file.string() << ": " << Composer::status_message(result.status) << std::endl;
+            return false;
+        }
+        key = keys[key_index];
+        if(!options.exist("fingerprint")) {
+            std::cout << "detected key #" << key_index << std::endl;
+        }
+        return true;
+    };
+
+    // Same output as md5sum on the decrypted files
+    if(options.exist("fingerprint")) {
+        int status = 0;
+        for(auto const &file : rest) {
+            unsigned char fingerprint[16];
+            Composer::Result result;
+            if(!detect_key(file) || !(result = Composer::try_shader_file_fingerprint(file, fingerprint, key))) {
+                if(!result) {
+                    std::cerr << file << ": " << Composer::status_message(result.status) << std::endl;
+                }
+                status = 1;
+                continue;
+            }
+
+            static const char dec2hex[16 + 1] = "0123456789abcdef";
+            for(auto byte : fingerprint) {
+                std::cout << dec2hex[byte >> 4] << dec2hex[byte & 15];
+            }
+            std::cout << "  " << file << std::endl;
+        }
+        return status;
+    }
+
+    if(!detect_key(input_file)) {
+        std::exit(1);
+    }
+
     try {
-        Composer::decrypt_shader_file(input_file, output_file);
+        if(options.exist("pipeline")) {
+            Composer::decrypt_shader_file(input_file, output_file, Composer::active_profile().pipeline, key);
+        }
+        else {
+            Composer::decrypt_shader_file(input_file, output_file, key);
+        }
     }
     catch(const std::runtime_error e) {
         std::cerr << e.what();
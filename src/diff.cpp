@@ -0,0 +1,149 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <cstring>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <filesystem>
+#include <composer/diff.hpp>
+#include <cmdline/cmdline.h>
+
+/**
+ * Print the changed ranges of a pair of files, returns true if they differ
+ */
+static bool diff_files(std::filesystem::path const &a_file, std::filesystem::path const &b_file, std::string const &name, bool quiet) {
+    std::vector<Composer::ByteRange> ranges;
+    auto result = Composer::try_diff_encrypted_shader_files(a_file, b_file, ranges);
+    if(!result) {
+        std::cerr << name << ": " << Composer::status_message(result.status);
+        if(result.error_number) {
+            std::cerr << " (" << std::strerror(result.error_number) << ")";
+        }
+        std::cerr << std::endl;
+        std::exit(2);
+    }
+
+    if(ranges.empty()) {
+        return false;
+    }
+
+    std::uint64_t changed = 0;
+    for(auto const &range : ranges) {
+        changed += range.size;
+    }
+    std::cout << name << ": " << changed << " bytes changed in " << ranges.size() << " ranges" << std::endl;
+
+    if(!quiet) {
+        for(auto const &range : ranges) {
+            std::cout << "  [" << range.offset << ", " << range.offset + range.size << ")" << std::endl;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Print why a path of the directories couldn't be looked at and exit, like diff_files
+ */
+[[noreturn]] static void walk_failed(std::filesystem::path const &path, std::error_code const &ec) {
+    std::cerr << path.string() << ": " << Composer::status_message(Composer::Status::read_failed) << " (" << ec.message() << ")" << std::endl;
+    std::exit(2);
+}
+
+/**
+ * Check if a regular file is at a path; a missing one isn't, and any other failure exits
+ */
+static bool regular_file_exists(std::filesystem::path const &path) {
+    std::error_code ec;
+    auto status = std::filesystem::status(path, ec);
+    if(ec && status.type() != std::filesystem::file_type::not_found) {
+        walk_failed(path, ec);
+    }
+    return std::filesystem::is_regular_file(status);
+}
+
+int main(int argc, char *argv[]) {
+    cmdline::parser options;
+    options.set_program_name("composer-diff");
+    options.add("quiet", 'q', "Only print which files changed.");
+    options.add("help", 'h', "Print this message.");
+    options.footer("<old-file-or-directory> <new-file-or-directory>");
+
+    if(argc == 1) {
+        std::cout << options.usage() << std::endl;
+        std::exit(0);
+    }
+
+    options.parse_check(argc, argv);
+
+    auto rest = options.rest();
+    if(rest.size() != 2) {
+        std::cout << "need options: two files or two directories" << std::endl;
+        std::exit(2);
+    }
+
+    std::filesystem::path a_path = rest[0];
+    std::filesystem::path b_path = rest[1];
+    bool quiet = options.exist("quiet");
+    bool differ = false;
+
+    // Anything that isn't two directories goes to diff_files, which reports what's wrong
+    std::error_code ec;
+    if(!std::filesystem::is_directory(a_path, ec) || !std::filesystem::is_directory(b_path, ec)) {
+        differ = diff_files(a_path, b_path, b_path.string(), quiet);
+    }
+    else {
+        // Pair files by their path relative to each directory; an unreadable subdirectory or a
+        // file removed meanwhile stops the walk, as a partial comparison would look like changes
+        std::filesystem::recursive_directory_iterator end;
+        std::filesystem::recursive_directory_iterator a_items(a_path, ec);
+        auto a_walked = a_path;
+        for(; !ec && a_items != end; a_items.increment(ec)) {
+            auto const &item = *a_items;
+            a_walked = item.path();
+            std::error_code item_ec;
+            bool regular = item.is_regular_file(item_ec);
+            if(item_ec) {
+                walk_failed(item.path(), item_ec);
+            }
+            if(!regular) {
+                continue;
+            }
+
+            auto name = item.path().lexically_relative(a_path);
+            if(!regular_file_exists(b_path / name)) {
+                std::cout << "only in " << a_path.string() << ": " << name.generic_string() << std::endl;
+                differ = true;
+                continue;
+            }
+            differ |= diff_files(item.path(), b_path / name, name.generic_string(), quiet);
+        }
+        if(ec) {
+            // The entry last reached, such as a directory that could not be opened
+            walk_failed(a_walked, ec);
+        }
+
+        std::filesystem::recursive_directory_iterator b_items(b_path, ec);
+        auto b_walked = b_path;
+        for(; !ec && b_items != end; b_items.increment(ec)) {
+            auto const &item = *b_items;
+            b_walked = item.path();
+            std::error_code item_ec;
+            bool regular = item.is_regular_file(item_ec);
+            if(item_ec) {
+                walk_failed(item.path(), item_ec);
+            }
+
+            auto name = item.path().lexically_relative(b_path);
+            if(regular && !regular_file_exists(a_path / name)) {
+                std::cout << "only in " << b_path.string() << ": " << name.generic_string() << std::endl;
+                differ = true;
+            }
+        }
+        if(ec) {
+            walk_failed(b_walked, ec);
+        }
+    }
+
+    return differ ? 1 : 0;
+}
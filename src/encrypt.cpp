@@ -1,15 +1,142 @@
 // SPDX-License-Identifier: GPL-3.0-only
 
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <cstdint>
 #include <string>
+#include <vector>
 #include <iostream>
 #include <filesystem>
+#include <functional>
+#include <unordered_map>
+#include <composer/buffer.hpp>
 #include <composer/file.hpp>
+#include <composer/profile.hpp>
+#include <composer/scheduler.hpp>
+#include <composer/tar.hpp>
+#include <composer/watch.hpp>
+#include <composer/worker_pool.hpp>
+#include <composer/xtea.hpp>
 #include <cmdline/cmdline.h>
 
+/**
+ * Encrypt files as they are written in a directory tree, until killed
+ */
+static int watch_directory(std::filesystem::path const &directory, std::chrono::milliseconds debounce, Composer::Key const &key) {
+    Composer::DirectoryWatcher watcher;
+    auto result = watcher.open(directory);
+    if(!result) {
+        std::cerr << "failed to watch " << directory << ": " << Composer::status_message(result.status);
+        if(result.error_number) {
+            std::cerr << " (" << std::strerror(result.error_number) << ")";
+        }
+        std::cerr << std::endl;
+        return 1;
+    }
+
+    Composer::WorkerPool pool(Composer::active_profile().thread_count);
+    std::mutex mutex;
+
+    // Files being encrypted, and whether they were written again meanwhile
+    std::unordered_map<std::string, bool> busy;
+
+    std::function<void(std::filesystem::path const &)> encrypt = [&](std::filesystem::path const &input_file) {
+        pool.submit([&, input_file]() {
+            // Each thread keeps its buffer, so steady state encryption doesn't allocate
+            thread_local Composer::Buffer buffer;
+
+            auto start = std::chrono::steady_clock::now();
+            auto output_file = input_file;
+            output_file.replace_extension(".enc");
+            auto result = Composer::try_encrypt_shader_file(input_file, output_file, buffer, key);
+            auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if(result) {
+                std::cout << "encrypted shader file: " << output_file << " (" << elapsed.count() << " ms)" << std::endl;
+            }
+            else {
+                std::cerr << "failed to encrypt " << input_file << ": " << Composer::status_message(result.status) << std::endl;
+            }
+
+            auto entry = busy.find(input_file.string());
+            if(entry->second) {
+                entry->second = false;
+                encrypt(input_file);
+            }
+            else {
+                busy.erase(entry);
+            }
+        });
+    };
+
+    std::cout << "watching " << directory << std::endl;
+
+    std::vector<std::filesystem::path> files;
+    while(true) {
+        result = watcher.wait(files, debounce);
+        if(!result) {
+            std::cerr << "failed to watch " << directory << ": " << Composer::status_message(result.status) << std::endl;
+            return 1;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        for(auto const &file : files) {
+            // Skip our own output
+            if(file.extension() == ".enc") {
+                continue;
+            }
+
+            auto [entry, inserted] = busy.emplace(file.string(), false);
+            if(inserted) {
+                encrypt(file);
+            }
+            else {
+                entry->second = true;
+            }
+        }
+    }
+}
+
+/**
+ * Encrypt every file of a tar stream from stdin to stdout
+ */
+static int transform_tar(std::uint64_t max_memory, Composer::Key const &key) {
+    std::ios_base::sync_with_stdio(false);
+
+    Composer::WorkerPool pool(Composer::active_profile().thread_count);
+    Composer::TarStreamOptions tar_options;
+    tar_options.max_bytes_in_flight = max_memory;
+    Composer::TarStreamStats stats;
+
+    auto result = Composer::transform_tar_stream(std::cin, std::cout, Composer::Operation::encrypt, pool, tar_options, stats, key);
+    if(!result) {
+        std::cerr << "failed to encrypt tar stream";
+        if(!stats.failed_entry.empty()) {
+            std::cerr << " at " << stats.failed_entry;
+        }
+        std::cerr << ": " << Composer::status_message(result.status) << std::endl;
+        return 1;
+    }
+
+    // stdout carries the archive
+    std::cerr << "encrypted " << stats.files << " shader files in " << stats.entries << " tar entries" << std::endl;
+    return 0;
+}
+
 int main(int argc, char *argv[]) {
     cmdline::parser options;
     options.set_program_name("composer-encrypt");
     options.add<std::string>("output", 'o', "Encrypted shader output file.", false);
+    options.add("pipeline", 'p', "Overlap reading, encryption and writing (for large files).");
+    options.add<std::string>("alloc", 'a', "Buffer allocation policy: standard, prefault, thp or hugetlb.", false);
+    options.add<std::string>("key", 'k', "XTEA key as four hex words, e.g. 3fffef:e5:3fffffdd:7fc3.", false);
+    options.add<std::string>("watch", 'w', "Encrypt files written in a directory as they change, next to them.", false);
+    options.add<int>("debounce", 'd', "Milliseconds without changes ending a burst in watch mode.", false, 2);
+    options.add("tar", 't', "Encrypt every file of a tar stream from stdin to stdout.");
+    options.add<int>("max-memory", 'm', "Cap in MiB on the file data held in memory at once with --tar.", false, 256);
     options.add("help", 'h', "Print this message.");
     options.footer("<input-file>");
 
@@ -20,12 +147,41 @@ int main(int argc, char *argv[]) {
 
     options.parse_check(argc, argv);
 
+    // Machine profile from composer-tune, options given here override it
+    auto profile_result = Composer::load_profile();
+    if(!profile_result && profile_result.status != Composer::Status::file_not_found) {
+        std::cerr << "ignoring machine profile: " << Composer::status_message(profile_result.status) << std::endl;
+    }
+
     auto rest = options.rest();
-    if(rest.empty()) {
+    if(rest.empty() && !options.exist("watch") && !options.exist("tar")) {
         std::cout << "need option: input file path" << std::endl;
         std::exit(1);
     }
 
+    if(options.exist("alloc")) {
+        Composer::AllocationPolicy allocation_policy;
+        if(!Composer::parse_allocation_policy(options.get<std::string>("alloc"), allocation_policy)) {
+            std::cout << "invalid allocation policy: " << options.get<std::string>("alloc") << std::endl;
+            std::exit(1);
+        }
+        Composer::set_allocation_policy(allocation_policy);
+    }
+
+    Composer::Key key = Composer::default_key;
+    if(options.exist("key") && !Composer::parse_key(options.get<std::string>("key"), key)) {
+        std::cout << "invalid key: " << options.get<std::string>("key") << std::endl;
+        std::exit(1);
+    }
+
+    if(options.exist("watch")) {
+        return watch_directory(options.get<std::string>("watch"), std::chrono::milliseconds(std::max(options.get<int>("debounce"), 0)), key);
+    }
+
+    if(options.exist("tar")) {
+        return transform_tar(static_cast<std::uint64_t>(std::max(options.get<int>("max-memory"), 1)) << 20, key);
+    }
+
     std::filesystem::path input_file = rest[0];
     std::filesystem::path output_file = input_file;
     output_file.replace_extension(".enc");
@@ -35,7 +191,12 @@ int main(int argc, char *argv[]) {
     }
     
     try {
-        Composer::encrypt_shader_file(input_file, output_file);
+        if(options.exist("pipeline")) {
+            Composer::encrypt_shader_file(input_file, output_file, Composer::active_profile().pipeline, key);
+        }
+        else {
+            Composer::encrypt_shader_file(input_file, output_file, key);
+        }
     }
     catch(const std::runtime_error e) {
         std::cerr << e.what();
@@ -6,6 +6,12 @@
 
 #include <hash-library/md5.h>
 
+#include <atomic>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#endif
+
 #ifndef _MSC_VER
 #ifndef __MINGW32__
 #include <endian.h>
@@ -78,133 +84,362 @@ namespace
            (x << 24);
   }
 #endif
-}
 
 
-/// process 64 bytes
-void MD5::processBlock(const void* data)
-{
-  // get last hash
-  uint32_t a = m_hash[0];
-  uint32_t b = m_hash[1];
-  uint32_t c = m_hash[2];
-  uint32_t d = m_hash[3];
+  /// process 64 bytes, portable implementation
+  void processBlockPortable(uint32_t* hash, const void* data)
+  {
+    // get last hash
+    uint32_t a = hash[0];
+    uint32_t b = hash[1];
+    uint32_t c = hash[2];
+    uint32_t d = hash[3];
 
-  // data represented as 16x 32-bit words
-  const uint32_t* words = (uint32_t*) data;
+    // data represented as 16x 32-bit words
+    const uint32_t* words = (uint32_t*) data;
 
-  // computations are little endian, swap data if necessary
+    // computations are little endian, swap data if necessary
 #if defined(__BYTE_ORDER) && (__BYTE_ORDER != 0) && (__BYTE_ORDER == __BIG_ENDIAN)
 #define LITTLEENDIAN(x) swap(x)
 #else
 #define LITTLEENDIAN(x) (x)
 #endif
 
-  // first round
-  uint32_t word0  = LITTLEENDIAN(words[ 0]);
-  a = rotate(a + f1(b,c,d) + word0  + 0xd76aa478,  7) + b;
-  uint32_t word1  = LITTLEENDIAN(words[ 1]);
-  d = rotate(d + f1(a,b,c) + word1  + 0xe8c7b756, 12) + a;
-  uint32_t word2  = LITTLEENDIAN(words[ 2]);
-  c = rotate(c + f1(d,a,b) + word2  + 0x242070db, 17) + d;
-  uint32_t word3  = LITTLEENDIAN(words[ 3]);
-  b = rotate(b + f1(c,d,a) + word3  + 0xc1bdceee, 22) + c;
-
-  uint32_t word4  = LITTLEENDIAN(words[ 4]);
-  a = rotate(a + f1(b,c,d) + word4  + 0xf57c0faf,  7) + b;
-  uint32_t word5  = LITTLEENDIAN(words[ 5]);
-  d = rotate(d + f1(a,b,c) + word5  + 0x4787c62a, 12) + a;
-  uint32_t word6  = LITTLEENDIAN(words[ 6]);
-  c = rotate(c + f1(d,a,b) + word6  + 0xa8304613, 17) + d;
-  uint32_t word7  = LITTLEENDIAN(words[ 7]);
-  b = rotate(b + f1(c,d,a) + word7  + 0xfd469501, 22) + c;
-
-  uint32_t word8  = LITTLEENDIAN(words[ 8]);
-  a = rotate(a + f1(b,c,d) + word8  + 0x698098d8,  7) + b;
-  uint32_t word9  = LITTLEENDIAN(words[ 9]);
-  d = rotate(d + f1(a,b,c) + word9  + 0x8b44f7af, 12) + a;
-  uint32_t word10 = LITTLEENDIAN(words[10]);
-  c = rotate(c + f1(d,a,b) + word10 + 0xffff5bb1, 17) + d;
-  uint32_t word11 = LITTLEENDIAN(words[11]);
-  b = rotate(b + f1(c,d,a) + word11 + 0x895cd7be, 22) + c;
-
-  uint32_t word12 = LITTLEENDIAN(words[12]);
-  a = rotate(a + f1(b,c,d) + word12 + 0x6b901122,  7) + b;
-  uint32_t word13 = LITTLEENDIAN(words[13]);
-  d = rotate(d + f1(a,b,c) + word13 + 0xfd987193, 12) + a;
-  uint32_t word14 = LITTLEENDIAN(words[14]);
-  c = rotate(c + f1(d,a,b) + word14 + 0xa679438e, 17) + d;
-  uint32_t word15 = LITTLEENDIAN(words[15]);
-  b = rotate(b + f1(c,d,a) + word15 + 0x49b40821, 22) + c;
-
-  // second round
-  a = rotate(a + f2(b,c,d) + word1  + 0xf61e2562,  5) + b;
-  d = rotate(d + f2(a,b,c) + word6  + 0xc040b340,  9) + a;
-  c = rotate(c + f2(d,a,b) + word11 + 0x265e5a51, 14) + d;
-  b = rotate(b + f2(c,d,a) + word0  + 0xe9b6c7aa, 20) + c;
-
-  a = rotate(a + f2(b,c,d) + word5  + 0xd62f105d,  5) + b;
-  d = rotate(d + f2(a,b,c) + word10 + 0x02441453,  9) + a;
-  c = rotate(c + f2(d,a,b) + word15 + 0xd8a1e681, 14) + d;
-  b = rotate(b + f2(c,d,a) + word4  + 0xe7d3fbc8, 20) + c;
-
-  a = rotate(a + f2(b,c,d) + word9  + 0x21e1cde6,  5) + b;
-  d = rotate(d + f2(a,b,c) + word14 + 0xc33707d6,  9) + a;
-  c = rotate(c + f2(d,a,b) + word3  + 0xf4d50d87, 14) + d;
-  b = rotate(b + f2(c,d,a) + word8  + 0x455a14ed, 20) + c;
-
-  a = rotate(a + f2(b,c,d) + word13 + 0xa9e3e905,  5) + b;
-  d = rotate(d + f2(a,b,c) + word2  + 0xfcefa3f8,  9) + a;
-  c = rotate(c + f2(d,a,b) + word7  + 0x676f02d9, 14) + d;
-  b = rotate(b + f2(c,d,a) + word12 + 0x8d2a4c8a, 20) + c;
-
-  // third round
-  a = rotate(a + f3(b,c,d) + word5  + 0xfffa3942,  4) + b;
-  d = rotate(d + f3(a,b,c) + word8  + 0x8771f681, 11) + a;
-  c = rotate(c + f3(d,a,b) + word11 + 0x6d9d6122, 16) + d;
-  b = rotate(b + f3(c,d,a) + word14 + 0xfde5380c, 23) + c;
-
-  a = rotate(a + f3(b,c,d) + word1  + 0xa4beea44,  4) + b;
-  d = rotate(d + f3(a,b,c) + word4  + 0x4bdecfa9, 11) + a;
-  c = rotate(c + f3(d,a,b) + word7  + 0xf6bb4b60, 16) + d;
-  b = rotate(b + f3(c,d,a) + word10 + 0xbebfbc70, 23) + c;
-
-  a = rotate(a + f3(b,c,d) + word13 + 0x289b7ec6,  4) + b;
-  d = rotate(d + f3(a,b,c) + word0  + 0xeaa127fa, 11) + a;
-  c = rotate(c + f3(d,a,b) + word3  + 0xd4ef3085, 16) + d;
-  b = rotate(b + f3(c,d,a) + word6  + 0x04881d05, 23) + c;
-
-  a = rotate(a + f3(b,c,d) + word9  + 0xd9d4d039,  4) + b;
-  d = rotate(d + f3(a,b,c) + word12 + 0xe6db99e5, 11) + a;
-  c = rotate(c + f3(d,a,b) + word15 + 0x1fa27cf8, 16) + d;
-  b = rotate(b + f3(c,d,a) + word2  + 0xc4ac5665, 23) + c;
-
-  // fourth round
-  a = rotate(a + f4(b,c,d) + word0  + 0xf4292244,  6) + b;
-  d = rotate(d + f4(a,b,c) + word7  + 0x432aff97, 10) + a;
-  c = rotate(c + f4(d,a,b) + word14 + 0xab9423a7, 15) + d;
-  b = rotate(b + f4(c,d,a) + word5  + 0xfc93a039, 21) + c;
-
-  a = rotate(a + f4(b,c,d) + word12 + 0x655b59c3,  6) + b;
-  d = rotate(d + f4(a,b,c) + word3  + 0x8f0ccc92, 10) + a;
-  c = rotate(c + f4(d,a,b) + word10 + 0xffeff47d, 15) + d;
-  b = rotate(b + f4(c,d,a) + word1  + 0x85845dd1, 21) + c;
-
-  a = rotate(a + f4(b,c,d) + word8  + 0x6fa87e4f,  6) + b;
-  d = rotate(d + f4(a,b,c) + word15 + 0xfe2ce6e0, 10) + a;
-  c = rotate(c + f4(d,a,b) + word6  + 0xa3014314, 15) + d;
-  b = rotate(b + f4(c,d,a) + word13 + 0x4e0811a1, 21) + c;
-
-  a = rotate(a + f4(b,c,d) + word4  + 0xf7537e82,  6) + b;
-  d = rotate(d + f4(a,b,c) + word11 + 0xbd3af235, 10) + a;
-  c = rotate(c + f4(d,a,b) + word2  + 0x2ad7d2bb, 15) + d;
-  b = rotate(b + f4(c,d,a) + word9  + 0xeb86d391, 21) + c;
-
-  // update hash
-  m_hash[0] += a;
-  m_hash[1] += b;
-  m_hash[2] += c;
-  m_hash[3] += d;
+    // first round
+    uint32_t word0  = LITTLEENDIAN(words[ 0]);
+    a = rotate(a + f1(b,c,d) + word0  + 0xd76aa478,  7) + b;
+    uint32_t word1  = LITTLEENDIAN(words[ 1]);
+    d = rotate(d + f1(a,b,c) + word1  + 0xe8c7b756, 12) + a;
+    uint32_t word2  = LITTLEENDIAN(words[ 2]);
+    c = rotate(c + f1(d,a,b) + word2  + 0x242070db, 17) + d;
+    uint32_t word3  = LITTLEENDIAN(words[ 3]);
+    b = rotate(b + f1(c,d,a) + word3  + 0xc1bdceee, 22) + c;
+
+    uint32_t word4  = LITTLEENDIAN(words[ 4]);
+    a = rotate(a + f1(b,c,d) + word4  + 0xf57c0faf,  7) + b;
+    uint32_t word5  = LITTLEENDIAN(words[ 5]);
+    d = rotate(d + f1(a,b,c) + word5  + 0x4787c62a, 12) + a;
+    uint32_t word6  = LITTLEENDIAN(words[ 6]);
+    c = rotate(c + f1(d,a,b) + word6  + 0xa8304613, 17) + d;
+    uint32_t word7  = LITTLEENDIAN(words[ 7]);
+    b = rotate(b + f1(c,d,a) + word7  + 0xfd469501, 22) + c;
+
+    uint32_t word8  = LITTLEENDIAN(words[ 8]);
+    a = rotate(a + f1(b,c,d) + word8  + 0x698098d8,  7) + b;
+    uint32_t word9  = LITTLEENDIAN(words[ 9]);
+    d = rotate(d + f1(a,b,c) + word9  + 0x8b44f7af, 12) + a;
+    uint32_t word10 = LITTLEENDIAN(words[10]);
+    c = rotate(c + f1(d,a,b) + word10 + 0xffff5bb1, 17) + d;
+    uint32_t word11 = LITTLEENDIAN(words[11]);
+    b = rotate(b + f1(c,d,a) + word11 + 0x895cd7be, 22) + c;
+
+    uint32_t word12 = LITTLEENDIAN(words[12]);
+    a = rotate(a + f1(b,c,d) + word12 + 0x6b901122,  7) + b;
+    uint32_t word13 = LITTLEENDIAN(words[13]);
+    d = rotate(d + f1(a,b,c) + word13 + 0xfd987193, 12) + a;
+    uint32_t word14 = LITTLEENDIAN(words[14]);
+    c = rotate(c + f1(d,a,b) + word14 + 0xa679438e, 17) + d;
+    uint32_t word15 = LITTLEENDIAN(words[15]);
+    b = rotate(b + f1(c,d,a) + word15 + 0x49b40821, 22) + c;
+
+    // second round
+    a = rotate(a + f2(b,c,d) + word1  + 0xf61e2562,  5) + b;
+    d = rotate(d + f2(a,b,c) + word6  + 0xc040b340,  9) + a;
+    c = rotate(c + f2(d,a,b) + word11 + 0x265e5a51, 14) + d;
+    b = rotate(b + f2(c,d,a) + word0  + 0xe9b6c7aa, 20) + c;
+
+    a = rotate(a + f2(b,c,d) + word5  + 0xd62f105d,  5) + b;
+    d = rotate(d + f2(a,b,c) + word10 + 0x02441453,  9) + a;
+    c = rotate(c + f2(d,a,b) + word15 + 0xd8a1e681, 14) + d;
+    b = rotate(b + f2(c,d,a) + word4  + 0xe7d3fbc8, 20) + c;
+
+    a = rotate(a + f2(b,c,d) + word9  + 0x21e1cde6,  5) + b;
+    d = rotate(d + f2(a,b,c) + word14 + 0xc33707d6,  9) + a;
+    c = rotate(c + f2(d,a,b) + word3  + 0xf4d50d87, 14) + d;
+    b = rotate(b + f2(c,d,a) + word8  + 0x455a14ed, 20) + c;
+
+    a = rotate(a + f2(b,c,d) + word13 + 0xa9e3e905,  5) + b;
+    d = rotate(d + f2(a,b,c) + word2  + 0xfcefa3f8,  9) + a;
+    c = rotate(c + f2(d,a,b) + word7  + 0x676f02d9, 14) + d;
+    b = rotate(b + f2(c,d,a) + word12 + 0x8d2a4c8a, 20) + c;
+
+    // third round
+    a = rotate(a + f3(b,c,d) + word5  + 0xfffa3942,  4) + b;
+    d = rotate(d + f3(a,b,c) + word8  + 0x8771f681, 11) + a;
+    c = rotate(c + f3(d,a,b) + word11 + 0x6d9d6122, 16) + d;
+    b = rotate(b + f3(c,d,a) + word14 + 0xfde5380c, 23) + c;
+
+    a = rotate(a + f3(b,c,d) + word1  + 0xa4beea44,  4) + b;
+    d = rotate(d + f3(a,b,c) + word4  + 0x4bdecfa9, 11) + a;
+    c = rotate(c + f3(d,a,b) + word7  + 0xf6bb4b60, 16) + d;
+    b = rotate(b + f3(c,d,a) + word10 + 0xbebfbc70, 23) + c;
+
+    a = rotate(a + f3(b,c,d) + word13 + 0x289b7ec6,  4) + b;
+    d = rotate(d + f3(a,b,c) + word0  + 0xeaa127fa, 11) + a;
+    c = rotate(c + f3(d,a,b) + word3  + 0xd4ef3085, 16) + d;
+    b = rotate(b + f3(c,d,a) + word6  + 0x04881d05, 23) + c;
+
+    a = rotate(a + f3(b,c,d) + word9  + 0xd9d4d039,  4) + b;
+    d = rotate(d + f3(a,b,c) + word12 + 0xe6db99e5, 11) + a;
+    c = rotate(c + f3(d,a,b) + word15 + 0x1fa27cf8, 16) + d;
+    b = rotate(b + f3(c,d,a) + word2  + 0xc4ac5665, 23) + c;
+
+    // fourth round
+    a = rotate(a + f4(b,c,d) + word0  + 0xf4292244,  6) + b;
+    d = rotate(d + f4(a,b,c) + word7  + 0x432aff97, 10) + a;
+    c = rotate(c + f4(d,a,b) + word14 + 0xab9423a7, 15) + d;
+    b = rotate(b + f4(c,d,a) + word5  + 0xfc93a039, 21) + c;
+
+    a = rotate(a + f4(b,c,d) + word12 + 0x655b59c3,  6) + b;
+    d = rotate(d + f4(a,b,c) + word3  + 0x8f0ccc92, 10) + a;
+    c = rotate(c + f4(d,a,b) + word10 + 0xffeff47d, 15) + d;
+    b = rotate(b + f4(c,d,a) + word1  + 0x85845dd1, 21) + c;
+
+    a = rotate(a + f4(b,c,d) + word8  + 0x6fa87e4f,  6) + b;
+    d = rotate(d + f4(a,b,c) + word15 + 0xfe2ce6e0, 10) + a;
+    c = rotate(c + f4(d,a,b) + word6  + 0xa3014314, 15) + d;
+    b = rotate(b + f4(c,d,a) + word13 + 0x4e0811a1, 21) + c;
+
+    a = rotate(a + f4(b,c,d) + word4  + 0xf7537e82,  6) + b;
+    d = rotate(d + f4(a,b,c) + word11 + 0xbd3af235, 10) + a;
+    c = rotate(c + f4(d,a,b) + word2  + 0x2ad7d2bb, 15) + d;
+    b = rotate(b + f4(c,d,a) + word9  + 0xeb86d391, 21) + c;
+
+    // update hash
+    hash[0] += a;
+    hash[1] += b;
+    hash[2] += c;
+    hash[3] += d;
+  }
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define MD5_X86_KERNELS
+
+  // the round functions rewritten to shorten the dependency chain on b, which is always the latest result:
+  // f1 = (d & ~b) + (b & c), both terms in parallel (andn)
+  // f2 = (c & ~d) + (b & d), first term doesn't depend on b at all
+  // f3 = b ^ (c ^ d), c ^ d doesn't depend on b
+  // f4 = ~c ^ (~b & d), same as c ^ (b | ~d) but with a single andn on the critical path
+#define MD5_F1(a,b,c,d,x,r) a = rotate(a + (x) + (d & ~b) + (b & c), r) + b
+#define MD5_F2(a,b,c,d,x,r) a = rotate(a + (x) + (c & ~d) + (b & d), r) + b
+#define MD5_F3(a,b,c,d,x,r) a = rotate(a + (x) + (b ^ (c ^ d)), r) + b
+#define MD5_F4(a,b,c,d,x,r) a = rotate(a + (x) + (~c ^ (~b & d)), r) + b
+
+  /// process 64 bytes, BMI1 implementation
+  __attribute__((target("bmi")))
+  void processBlockBmi(uint32_t* hash, const void* data)
+  {
+    uint32_t a = hash[0];
+    uint32_t b = hash[1];
+    uint32_t c = hash[2];
+    uint32_t d = hash[3];
+
+    const uint32_t* w = (const uint32_t*) data;
+
+    MD5_F1(a,b,c,d, w[ 0] + 0xd76aa478,  7); MD5_F1(d,a,b,c, w[ 1] + 0xe8c7b756, 12);
+    MD5_F1(c,d,a,b, w[ 2] + 0x242070db, 17); MD5_F1(b,c,d,a, w[ 3] + 0xc1bdceee, 22);
+    MD5_F1(a,b,c,d, w[ 4] + 0xf57c0faf,  7); MD5_F1(d,a,b,c, w[ 5] + 0x4787c62a, 12);
+    MD5_F1(c,d,a,b, w[ 6] + 0xa8304613, 17); MD5_F1(b,c,d,a, w[ 7] + 0xfd469501, 22);
+    MD5_F1(a,b,c,d, w[ 8] + 0x698098d8,  7); MD5_F1(d,a,b,c, w[ 9] + 0x8b44f7af, 12);
+    MD5_F1(c,d,a,b, w[10] + 0xffff5bb1, 17); MD5_F1(b,c,d,a, w[11] + 0x895cd7be, 22);
+    MD5_F1(a,b,c,d, w[12] + 0x6b901122,  7); MD5_F1(d,a,b,c, w[13] + 0xfd987193, 12);
+    MD5_F1(c,d,a,b, w[14] + 0xa679438e, 17); MD5_F1(b,c,d,a, w[15] + 0x49b40821, 22);
+
+    MD5_F2(a,b,c,d, w[ 1] + 0xf61e2562,  5); MD5_F2(d,a,b,c, w[ 6] + 0xc040b340,  9);
+    MD5_F2(c,d,a,b, w[11] + 0x265e5a51, 14); MD5_F2(b,c,d,a, w[ 0] + 0xe9b6c7aa, 20);
+    MD5_F2(a,b,c,d, w[ 5] + 0xd62f105d,  5); MD5_F2(d,a,b,c, w[10] + 0x02441453,  9);
+    MD5_F2(c,d,a,b, w[15] + 0xd8a1e681, 14); MD5_F2(b,c,d,a, w[ 4] + 0xe7d3fbc8, 20);
+    MD5_F2(a,b,c,d, w[ 9] + 0x21e1cde6,  5); MD5_F2(d,a,b,c, w[14] + 0xc33707d6,  9);
+    MD5_F2(c,d,a,b, w[ 3] + 0xf4d50d87, 14); MD5_F2(b,c,d,a, w[ 8] + 0x455a14ed, 20);
+    MD5_F2(a,b,c,d, w[13] + 0xa9e3e905,  5); MD5_F2(d,a,b,c, w[ 2] + 0xfcefa3f8,  9);
+    MD5_F2(c,d,a,b, w[ 7] + 0x676f02d9, 14); MD5_F2(b,c,d,a, w[12] + 0x8d2a4c8a, 20);
+
+    MD5_F3(a,b,c,d, w[ 5] + 0xfffa3942,  4); MD5_F3(d,a,b,c, w[ 8] + 0x8771f681, 11);
+    MD5_F3(c,d,a,b, w[11] + 0x6d9d6122, 16); MD5_F3(b,c,d,a, w[14] + 0xfde5380c, 23);
+    MD5_F3(a,b,c,d, w[ 1] + 0xa4beea44,  4); MD5_F3(d,a,b,c, w[ 4] + 0x4bdecfa9, 11);
+    MD5_F3(c,d,a,b, w[ 7] + 0xf6bb4b60, 16); MD5_F3(b,c,d,a, w[10] + 0xbebfbc70, 23);
+    MD5_F3(a,b,c,d, w[13] + 0x289b7ec6,  4); MD5_F3(d,a,b,c, w[ 0] + 0xeaa127fa, 11);
+    MD5_F3(c,d,a,b, w[ 3] + 0xd4ef3085, 16); MD5_F3(b,c,d,a, w[ 6] + 0x04881d05, 23);
+    MD5_F3(a,b,c,d, w[ 9] + 0xd9d4d039,  4); MD5_F3(d,a,b,c, w[12] + 0xe6db99e5, 11);
+    MD5_F3(c,d,a,b, w[15] + 0x1fa27cf8, 16); MD5_F3(b,c,d,a, w[ 2] + 0xc4ac5665, 23);
+
+    MD5_F4(a,b,c,d, w[ 0] + 0xf4292244,  6); MD5_F4(d,a,b,c, w[ 7] + 0x432aff97, 10);
+    MD5_F4(c,d,a,b, w[14] + 0xab9423a7, 15); MD5_F4(b,c,d,a, w[ 5] + 0xfc93a039, 21);
+    MD5_F4(a,b,c,d, w[12] + 0x655b59c3,  6); MD5_F4(d,a,b,c, w[ 3] + 0x8f0ccc92, 10);
+    MD5_F4(c,d,a,b, w[10] + 0xffeff47d, 15); MD5_F4(b,c,d,a, w[ 1] + 0x85845dd1, 21);
+    MD5_F4(a,b,c,d, w[ 8] + 0x6fa87e4f,  6); MD5_F4(d,a,b,c, w[15] + 0xfe2ce6e0, 10);
+    MD5_F4(c,d,a,b, w[ 6] + 0xa3014314, 15); MD5_F4(b,c,d,a, w[13] + 0x4e0811a1, 21);
+    MD5_F4(a,b,c,d, w[ 4] + 0xf7537e82,  6); MD5_F4(d,a,b,c, w[11] + 0xbd3af235, 10);
+    MD5_F4(c,d,a,b, w[ 2] + 0x2ad7d2bb, 15); MD5_F4(b,c,d,a, w[ 9] + 0xeb86d391, 21);
+
+    hash[0] += a;
+    hash[1] += b;
+    hash[2] += c;
+    hash[3] += d;
+  }
+
+#undef MD5_F1
+#undef MD5_F2
+#undef MD5_F3
+#undef MD5_F4
+
+  // with AVX-512 every round function is a single vpternlogd and the rotation a single vprold,
+  // the state lives in the lowest lane of an xmm register, word + constant is added off the critical path
+#define MD5_T(imm,a,b,c,d,x,r) a = _mm_add_epi32(_mm_rol_epi32(_mm_add_epi32(_mm_add_epi32(a, _mm_cvtsi32_si128((int)(x))), _mm_ternarylogic_epi32(b, c, d, imm)), r), b)
+#define MD5_F1(a,b,c,d,x,r) MD5_T(0xCA,a,b,c,d,x,r)
+#define MD5_F2(a,b,c,d,x,r) MD5_T(0xE4,a,b,c,d,x,r)
+#define MD5_F3(a,b,c,d,x,r) MD5_T(0x96,a,b,c,d,x,r)
+#define MD5_F4(a,b,c,d,x,r) MD5_T(0x39,a,b,c,d,x,r)
+
+  /// process 64 bytes, AVX-512 implementation
+  __attribute__((target("avx512f,avx512vl")))
+  void processBlockAvx512(uint32_t* hash, const void* data)
+  {
+    __m128i a = _mm_cvtsi32_si128((int) hash[0]);
+    __m128i b = _mm_cvtsi32_si128((int) hash[1]);
+    __m128i c = _mm_cvtsi32_si128((int) hash[2]);
+    __m128i d = _mm_cvtsi32_si128((int) hash[3]);
+
+    const uint32_t* w = (const uint32_t*) data;
+
+    MD5_F1(a,b,c,d, w[ 0] + 0xd76aa478,  7); MD5_F1(d,a,b,c, w[ 1] + 0xe8c7b756, 12);
+    MD5_F1(c,d,a,b, w[ 2] + 0x242070db, 17); MD5_F1(b,c,d,a, w[ 3] + 0xc1bdceee, 22);
+    MD5_F1(a,b,c,d, w[ 4] + 0xf57c0faf,  7); MD5_F1(d,a,b,c, w[ 5] + 0x4787c62a, 12);
+    MD5_F1(c,d,a,b, w[ 6] + 0xa8304613, 17); MD5_F1(b,c,d,a, w[ 7] + 0xfd469501, 22);
+    MD5_F1(a,b,c,d, w[ 8] + 0x698098d8,  7); MD5_F1(d,a,b,c, w[ 9] + 0x8b44f7af, 12);
+    MD5_F1(c,d,a,b, w[10] + 0xffff5bb1, 17); MD5_F1(b,c,d,a, w[11] + 0x895cd7be, 22);
+    MD5_F1(a,b,c,d, w[12] + 0x6b901122,  7); MD5_F1(d,a,b,c, w[13] + 0xfd987193, 12);
+    MD5_F1(c,d,a,b, w[14] + 0xa679438e, 17); MD5_F1(b,c,d,a, w[15] + 0x49b40821, 22);
+
+    MD5_F2(a,b,c,d, w[ 1] + 0xf61e2562,  5); MD5_F2(d,a,b,c, w[ 6] + 0xc040b340,  9);
+    MD5_F2(c,d,a,b, w[11] + 0x265e5a51, 14); MD5_F2(b,c,d,a, w[ 0] + 0xe9b6c7aa, 20);
+    MD5_F2(a,b,c,d, w[ 5] + 0xd62f105d,  5); MD5_F2(d,a,b,c, w[10] + 0x02441453,  9);
+    MD5_F2(c,d,a,b, w[15] + 0xd8a1e681, 14); MD5_F2(b,c,d,a, w[ 4] + 0xe7d3fbc8, 20);
+    MD5_F2(a,b,c,d, w[ 9] + 0x21e1cde6,  5); MD5_F2(d,a,b,c, w[14] + 0xc33707d6,  9);
+    MD5_F2(c,d,a,b, w[ 3] + 0xf4d50d87, 14); MD5_F2(b,c,d,a, w[ 8] + 0x455a14ed, 20);
+    MD5_F2(a,b,c,d, w[13] + 0xa9e3e905,  5); MD5_F2(d,a,b,c, w[ 2] + 0xfcefa3f8,  9);
+    MD5_F2(c,d,a,b, w[ 7] + 0x676f02d9, 14); MD5_F2(b,c,d,a, w[12] + 0x8d2a4c8a, 20);
+
+    MD5_F3(a,b,c,d, w[ 5] + 0xfffa3942,  4); MD5_F3(d,a,b,c, w[ 8] + 0x8771f681, 11);
+    MD5_F3(c,d,a,b, w[11] + 0x6d9d6122, 16); MD5_F3(b,c,d,a, w[14] + 0xfde5380c, 23);
+    MD5_F3(a,b,c,d, w[ 1] + 0xa4beea44,  4); MD5_F3(d,a,b,c, w[ 4] + 0x4bdecfa9, 11);
+    MD5_F3(c,d,a,b, w[ 7] + 0xf6bb4b60, 16); MD5_F3(b,c,d,a, w[10] + 0xbebfbc70, 23);
+    MD5_F3(a,b,c,d, w[13] + 0x289b7ec6,  4); MD5_F3(d,a,b,c, w[ 0] + 0xeaa127fa, 11);
+    MD5_F3(c,d,a,b, w[ 3] + 0xd4ef3085, 16); MD5_F3(b,c,d,a, w[ 6] + 0x04881d05, 23);
+    MD5_F3(a,b,c,d, w[ 9] + 0xd9d4d039,  4); MD5_F3(d,a,b,c, w[12] + 0xe6db99e5, 11);
+    MD5_F3(c,d,a,b, w[15] + 0x1fa27cf8, 16); MD5_F3(b,c,d,a, w[ 2] + 0xc4ac5665, 23);
+
+    MD5_F4(a,b,c,d, w[ 0] + 0xf4292244,  6); MD5_F4(d,a,b,c, w[ 7] + 0x432aff97, 10);
+    MD5_F4(c,d,a,b, w[14] + 0xab9423a7, 15); MD5_F4(b,c,d,a, w[ 5] + 0xfc93a039, 21);
+    MD5_F4(a,b,c,d, w[12] + 0x655b59c3,  6); MD5_F4(d,a,b,c, w[ 3] + 0x8f0ccc92, 10);
+    MD5_F4(c,d,a,b, w[10] + 0xffeff47d, 15); MD5_F4(b,c,d,a, w[ 1] + 0x85845dd1, 21);
+    MD5_F4(a,b,c,d, w[ 8] + 0x6fa87e4f,  6); MD5_F4(d,a,b,c, w[15] + 0xfe2ce6e0, 10);
+    MD5_F4(c,d,a,b, w[ 6] + 0xa3014314, 15); MD5_F4(b,c,d,a, w[13] + 0x4e0811a1, 21);
+    MD5_F4(a,b,c,d, w[ 4] + 0xf7537e82,  6); MD5_F4(d,a,b,c, w[11] + 0xbd3af235, 10);
+    MD5_F4(c,d,a,b, w[ 2] + 0x2ad7d2bb, 15); MD5_F4(b,c,d,a, w[ 9] + 0xeb86d391, 21);
+
+    hash[0] += (uint32_t) _mm_cvtsi128_si32(a);
+    hash[1] += (uint32_t) _mm_cvtsi128_si32(b);
+    hash[2] += (uint32_t) _mm_cvtsi128_si32(c);
+    hash[3] += (uint32_t) _mm_cvtsi128_si32(d);
+  }
+
+#undef MD5_T
+#undef MD5_F1
+#undef MD5_F2
+#undef MD5_F3
+#undef MD5_F4
+
+#endif
+
+  typedef void (*ProcessBlockFunction)(uint32_t* hash, const void* data);
+
+  ProcessBlockFunction kernelFunction(MD5::Kernel kernel)
+  {
+    switch (kernel)
+    {
+#ifdef MD5_X86_KERNELS
+    case MD5::Bmi:    return processBlockBmi;
+    case MD5::Avx512: return processBlockAvx512;
+#endif
+    case MD5::Portable: return processBlockPortable;
+    default:            return 0;
+    }
+  }
+
+  MD5::Kernel bestKernel()
+  {
+    // the xmm round trip of each word eats most of what vpternlogd saves,
+    // so the scalar andn version wins on current cores, Avx512 must be requested explicitly
+    if (MD5::isSupported(MD5::Bmi))
+      return MD5::Bmi;
+    return MD5::Portable;
+  }
+
+  void processBlockResolve(uint32_t* hash, const void* data);
+
+  /// selected compression function, resolved on first use
+  std::atomic<ProcessBlockFunction> currentFunction(processBlockResolve);
+  std::atomic<MD5::Kernel>          currentKernel(MD5::Auto);
+
+  void processBlockResolve(uint32_t* hash, const void* data)
+  {
+    MD5::setKernel(MD5::Auto);
+    currentFunction.load(std::memory_order_relaxed)(hash, data);
+  }
+}
+
+
+/// true if the CPU can run this compression function
+bool MD5::isSupported(Kernel kernel)
+{
+  switch (kernel)
+  {
+  case Auto:
+  case Portable:
+    return true;
+#ifdef MD5_X86_KERNELS
+  case Bmi:
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("bmi");
+  case Avx512:
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl");
+#endif
+  default:
+    return false;
+  }
+}
+
+
+/// select compression function for all instances, false if the CPU can't run it
+bool MD5::setKernel(Kernel kernel)
+{
+  if (!isSupported(kernel))
+    return false;
+
+  if (kernel == Auto)
+    kernel = bestKernel();
+
+  currentKernel.store(kernel, std::memory_order_relaxed);
+  currentFunction.store(kernelFunction(kernel), std::memory_order_relaxed);
+  return true;
+}
+
+
+/// compression function currently in use (never Auto)
+MD5::Kernel MD5::getKernel()
+{
+  if (currentKernel.load(std::memory_order_relaxed) == Auto)
+    setKernel(Auto);
+  return currentKernel.load(std::memory_order_relaxed);
+}
+
+
+/// process 64 bytes
+void MD5::processBlock(const void* data)
+{
+  currentFunction.load(std::memory_order_relaxed)(m_hash, data);
 }
 
 
@@ -0,0 +1,445 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <iomanip>
+#include <iostream>
+#include <filesystem>
+#include <composer/batch.hpp>
+#include <composer/buffer.hpp>
+#include <composer/encrypt.hpp>
+#include <composer/file.hpp>
+#include <composer/profile.hpp>
+#include <composer/xtea.hpp>
+#include <cmdline/cmdline.h>
+
+/**
+ * Latency histogram in the HdrHistogram layout: exact below 2048, then 1024 linear sub-buckets per
+ * power of two, so every recorded value keeps three significant digits
+ */
+class LatencyHistogram {
+public:
+    /** Values are clamped to this, about 73 minutes in nanoseconds */
+    static constexpr const std::uint64_t highest_value = (std::uint64_t(1) << 42) - 1;
+
+    LatencyHistogram() : counts(index_of(highest_value) + 1) {}
+
+    void record(std::uint64_t value) noexcept {
+        value = std::min(value, highest_value);
+        this->counts[index_of(value)]++;
+        this->total++;
+        this->sum += value;
+        this->maximum = std::max(this->maximum, value);
+    }
+
+    void merge(LatencyHistogram const &other) noexcept {
+        for(std::size_t i = 0; i < this->counts.size(); i++) {
+            this->counts[i] += other.counts[i];
+        }
+        this->total += other.total;
+        this->sum += other.sum;
+        this->maximum = std::max(this->maximum, other.maximum);
+    }
+
+    /**
+     * Get the highest value equivalent to the one at a percentile
+     */
+    std::uint64_t value_at_percentile(double percentile) const noexcept {
+        if(this->total == 0) {
+            return 0;
+        }
+
+        auto wanted = static_cast<std::uint64_t>(std::ceil(percentile / 100.0 * static_cast<double>(this->total)));
+        wanted = std::max<std::uint64_t>(wanted, 1);
+        std::uint64_t seen = 0;
+        for(std::size_t i = 0; i < this->counts.size(); i++) {
+            seen += this->counts[i];
+            if(seen >= wanted) {
+                return std::min(highest_equivalent(i), this->maximum);
+            }
+        }
+        return this->maximum;
+    }
+
+    std::uint64_t count() const noexcept {
+        return this->total;
+    }
+
+    std::uint64_t max() const noexcept {
+        return this->maximum;
+    }
+
+    double mean() const noexcept {
+        return this->total ? static_cast<double>(this->sum) / static_cast<double>(this->total) : 0.0;
+    }
+
+    /**
+     * Write the percentile distribution in the HdrHistogram text format, values in microseconds
+     */
+    void write_percentiles(std::ostream &stream) const {
+        stream << std::setw(12) << "Value" << " " << std::setw(14) << "Percentile" << " " << std::setw(10) << "TotalCount" << " " << std::setw(14) << "1/(1-Percentile)" << "\n\n";
+        stream << std::fixed;
+
+        // Halve the distance to 100% every 5 steps, like HdrHistogram's default output
+        for(double tail = 1.0; tail > 1e-6 && this->total; tail /= 2) {
+            for(int step = 0; step < 5; step++) {
+                double percentile = 100.0 * (1.0 - tail + tail * step / 10.0);
+                auto value = this->value_at_percentile(percentile);
+                stream << std::setprecision(3) << std::setw(12) << value / 1000.0 << " " << std::setprecision(12) << std::setw(14) << percentile / 100.0 << " " << std::setw(10) << this->count_up_to(value) << " " << std::setprecision(2) << std::setw(14) << 1.0 / (1.0 - percentile / 100.0) << "\n";
+            }
+        }
+
+        stream << std::setprecision(3) << std::setw(12) << this->maximum / 1000.0 << " " << std::setprecision(12) << std::setw(14) << 1.0 << " " << std::setw(10) << this->total << "\n";
+        stream << "#[Mean    = " << std::setprecision(3) << std::setw(12) << this->mean() / 1000.0 << ", Max     = " << std::setw(12) << this->maximum / 1000.0 << "]\n";
+        stream << "#[Total count    = " << std::setw(12) << this->total << "]\n";
+    }
+
+private:
+    static constexpr const unsigned sub_bucket_bits = 11;
+    static constexpr const std::uint64_t sub_bucket_count = std::uint64_t(1) << sub_bucket_bits;
+    static constexpr const std::uint64_t sub_bucket_half = sub_bucket_count / 2;
+
+    static unsigned magnitude(std::uint64_t value) noexcept {
+        unsigned bits = 0;
+        while(value >>= 1) {
+            bits++;
+        }
+        return bits;
+    }
+
+    static std::size_t index_of(std::uint64_t value) noexcept {
+        if(value < sub_bucket_count) {
+            return static_cast<std::size_t>(value);
+        }
+        auto exponent = magnitude(value);
+        auto shift = exponent - (sub_bucket_bits - 1);
+        auto sub_bucket = value >> shift;
+        return static_cast<std::size_t>(sub_bucket_count + (exponent - sub_bucket_bits) * sub_bucket_half + (sub_bucket - sub_bucket_half));
+    }
+
+    static std::uint64_t highest_equivalent(std::size_t index) noexcept {
+        if(index < sub_bucket_count) {
+            return index;
+        }
+        auto bucket = (index - sub_bucket_count) / sub_bucket_half;
+        auto sub_bucket = (index - sub_bucket_count) % sub_bucket_half + sub_bucket_half;
+        auto shift = bucket + 1;
+        return ((sub_bucket + 1) << shift) - 1;
+    }
+
+    std::uint64_t count_up_to(std::uint64_t value) const noexcept {
+        std::uint64_t seen = 0;
+        auto last = index_of(std::min(value, highest_value));
+        for(std::size_t i = 0; i <= last; i++) {
+            seen += this->counts[i];
+        }
+        return seen;
+    }
+
+    std::vector<std::uint64_t> counts;
+    std::uint64_t total = 0;
+    std::uint64_t sum = 0;
+    std::uint64_t maximum = 0;
+};
+
+/**
+ * Make shader-like data: a pixel shader version token, then instruction and register tokens drawn
+ * from a small set, so it has the entropy and structure of compiled D3D bytecode
+ */
+static std::vector<char> synthetic_shader(std::size_t size, std::mt19937_64 &random) {
+    static const std::uint32_t opcodes[] = { 0x0001, 0x0002, 0x0004, 0x0005, 0x0008, 0x0009, 0x0042, 0x0051, 0x001F, 0x0012 };
+    std::vector<char> data(size);
+    std::size_t words = size / 4;
+    for(std::size_t i = 0; i < words; i++) {
+        std::uint32_t token;
+        if(i == 0) {
+            token = 0xFFFF0300;
+        }
+        else if(i + 1 == words) {
+            token = 0x0000FFFF;
+        }
+        else if(random() % 4 == 0) {
+            token = opcodes[random() % (sizeof(opcodes) / sizeof(*opcodes))] | static_cast<std::uint32_t>(random() % 4) << 24;
+        }
+        else {
+            // Destination or source register: type, number and swizzle
+            token = 0x80000000 | static_cast<std::uint32_t>(random() % 4) << 28 | 0x00E40000 | static_cast<std::uint32_t>(random() % 32);
+        }
+        for(int byte = 0; byte < 4; byte++) {
+            data[i * 4 + byte] = static_cast<char>(token >> (8 * byte));
+        }
+    }
+    for(std::size_t i = words * 4; i < size; i++) {
+        data[i] = 0;
+    }
+    return data;
+}
+
+/**
+ * Draw shader sizes: log-normal around the median, like a game's shader set, at least 64 bytes
+ */
+static std::vector<std::size_t> synthetic_sizes(std::size_t count, std::size_t median, std::mt19937_64 &random) {
+    std::lognormal_distribution<double> distribution(std::log(static_cast<double>(median)), 1.0);
+    std::vector<std::size_t> sizes(count);
+    for(auto &size : sizes) {
+        size = static_cast<std::size_t>(std::clamp(distribution(random), 64.0, 64.0 * 1024 * 1024));
+    }
+    return sizes;
+}
+
+static bool write_corpus_file(std::filesystem::path const &file, std::vector<char> const &data) {
+    std::ofstream stream(file, std::ios_base::binary);
+    stream.write(data.data(), static_cast<std::streamsize>(data.size()));
+    stream.close();
+    return static_cast<bool>(stream);
+}
+
+static bool read_corpus_file(std::filesystem::path const &file, std::vector<char> &data) {
+    std::ifstream stream(file, std::ios_base::binary);
+    data.assign(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+    return !stream.bad();
+}
+
+static void print_size(std::uint64_t bytes) {
+    if(bytes >= (1 << 20)) {
+        std::cout << bytes / 1048576.0 << " MiB";
+    }
+    else {
+        std::cout << bytes / 1024.0 << " KiB";
+    }
+}
+
+int main(int argc, char *argv[]) {
+    cmdline::parser options;
+    options.set_program_name("composer-loadgen");
+    options.add<std::string>("workload", 'w', "Operation to load: encrypt, decrypt (in memory), encrypt-file or decrypt-file.", false, "encrypt");
+    options.add<int>("threads", 't', "Threads issuing operations.", false, 1);
+    options.add<double>("rate", 'r', "Operations per second over all threads, 0 for closed loop (next one as soon as one is done).", false, 0);
+    options.add<double>("duration", 'd', "Seconds to run.", false, 10);
+    options.add<std::string>("corpus", 'c', "Directory of plaintext shaders to use instead of a synthetic corpus.", false);
+    options.add<std::string>("generate", 'g', "Write a synthetic corpus to this directory and exit.", false);
+    options.add<int>("count", 'n', "Files of the synthetic corpus.", false, 500);
+    options.add<int>("median", 'm', "Median size in KiB of the synthetic files (log-normal).", false, 8);
+    options.add<int>("seed", 's', "Seed of the synthetic corpus and the file choice.", false, 1);
+    options.add<std::string>("histogram", 'H', "Write the latency distribution (HdrHistogram percentile format, microseconds).", false);
+    options.add<std::string>("key", 'k', "XTEA key as four hex words, e.g. 3fffef:e5:3fffffdd:7fc3.", false);
+    options.add("help", 'h', "Print this message.");
+
+    options.parse_check(argc, argv);
+
+    // Machine profile from composer-tune, so the load runs with the tuned kernels
+    auto profile_result = Composer::load_profile();
+    if(!profile_result && profile_result.status != Composer::Status::file_not_found) {
+        std::cerr << "ignoring machine profile: " << Composer::status_message(profile_result.status) << std::endl;
+    }
+
+    Composer::Key key = Composer::default_key;
+    if(options.exist("key") && !Composer::parse_key(options.get<std::string>("key"), key)) {
+        std::cout << "invalid key: " << options.get<std::string>("key") << std::endl;
+        std::exit(1);
+    }
+
+    auto workload = options.get<std::string>("workload");
+    bool encrypt = workload == "encrypt" || workload == "encrypt-file";
+    bool files = workload == "encrypt-file" || workload == "decrypt-file";
+    if(!encrypt && workload != "decrypt" && workload != "decrypt-file") {
+        std::cout << "invalid workload: " << workload << std::endl;
+        std::exit(1);
+    }
+
+    std::size_t thread_count = static_cast<std::size_t>(std::max(options.get<int>("threads"), 1));
+    double rate = std::max(options.get<double>("rate"), 0.0);
+    auto duration = std::chrono::duration<double>(std::max(options.get<double>("duration"), 0.1));
+    std::mt19937_64 random(static_cast<std::uint64_t>(options.get<int>("seed")));
+
+    // Plaintext corpus, in memory
+    std::vector<std::vector<char>> corpus;
+    if(options.exist("corpus")) {
+        std::vector<Composer::BatchFile> listing;
+        auto result = Composer::list_batch_files(options.get<std::string>("corpus"), listing);
+        if(!result) {
+            std::cerr << "failed to list " << options.get<std::string>("corpus") << ": " << Composer::status_message(result.status) << std::endl;
+            std::exit(1);
+        }
+        for(auto const &file : listing) {
+            std::vector<char> data;
+            if(file.size >= 8 && read_corpus_file(std::filesystem::path(options.get<std::string>("corpus")) / file.path, data)) {
+                corpus.push_back(std::move(data));
+            }
+        }
+    }
+    else {
+        auto count = static_cast<std::size_t>(std::max(options.get<int>("count"), 1));
+        auto median = static_cast<std::size_t>(std::max(options.get<int>("median"), 1)) << 10;
+        for(auto size : synthetic_sizes(count, median, random)) {
+            corpus.push_back(synthetic_shader(size, random));
+        }
+    }
+    if(corpus.empty()) {
+        std::cout << "no shader files of at least 8 bytes in the corpus" << std::endl;
+        std::exit(1);
+    }
+
+    if(options.exist("generate")) {
+        std::filesystem::path directory = options.get<std::string>("generate");
+        std::error_code ec;
+        std::filesystem::create_directories(directory, ec);
+        for(std::size_t i = 0; i < corpus.size(); i++) {
+            auto file = directory / (std::to_string(i) + ".bin");
+            if(!write_corpus_file(file, corpus[i])) {
+                std::cerr << "failed to write " << file << std::endl;
+                std::exit(1);
+            }
+        }
+        std::cout << "wrote " << corpus.size() << " shader files to " << directory << std::endl;
+        return 0;
+    }
+
+    // Inputs of the operation: plaintext to encrypt, encrypted to decrypt
+    std::vector<std::vector<char>> inputs;
+    std::uint64_t corpus_bytes = 0;
+    for(auto &data : corpus) {
+        corpus_bytes += data.size();
+        inputs.push_back(encrypt ? std::move(data) : Composer::encrypt_shader(data, key));
+    }
+    corpus.clear();
+
+    std::vector<std::size_t> sorted_sizes;
+    for(auto const &input : inputs) {
+        sorted_sizes.push_back(input.size());
+    }
+    std::sort(sorted_sizes.begin(), sorted_sizes.end());
+
+    // File workloads read the inputs from a scratch directory and write one output per thread
+    std::filesystem::path directory = std::filesystem::temp_directory_path() / ("composer-loadgen-" + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()));
+    std::vector<std::filesystem::path> input_files;
+    if(files) {
+        std::error_code ec;
+        std::filesystem::create_directories(directory, ec);
+        for(std::size_t i = 0; i < inputs.size(); i++) {
+            input_files.push_back(directory / (std::to_string(i) + (encrypt ? ".bin" : ".enc")));
+            if(!write_corpus_file(input_files.back(), inputs[i])) {
+                std::cerr << "failed to write " << input_files.back() << std::endl;
+                std::filesystem::remove_all(directory, ec);
+                std::exit(1);
+            }
+        }
+    }
+
+    std::vector<LatencyHistogram> histograms(thread_count);
+    std::vector<std::uint64_t> bytes(thread_count);
+    std::vector<std::uint64_t> failures(thread_count);
+
+    auto start = std::chrono::steady_clock::now();
+    auto end = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(duration);
+    auto seed = random();
+    std::vector<std::thread> threads;
+    for(std::size_t t = 0; t < thread_count; t++) {
+        threads.emplace_back([&, t]() {
+            std::mt19937_64 thread_random(seed + t);
+            Composer::Buffer buffer;
+            auto output_file = directory / ("output-" + std::to_string(t));
+
+            for(std::uint64_t operation = 0;; operation++) {
+                // With a fixed rate, latency counts from when the operation should have started,
+                // so falling behind shows up instead of being hidden (coordinated omission)
+                auto intended = std::chrono::steady_clock::now();
+                if(rate > 0) {
+                    intended = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>((operation * thread_count + t) / rate));
+                    if(intended >= end) {
+                        break;
+                    }
+                    std::this_thread::sleep_until(intended);
+                }
+                else if(intended >= end) {
+                    break;
+                }
+
+                auto index = static_cast<std::size_t>(thread_random() % inputs.size());
+                auto const &input = inputs[index];
+                Composer::Result result;
+                if(files) {
+                    result = encrypt ? Composer::try_encrypt_shader_file(input_files[index], output_file, buffer, key) : Composer::try_decrypt_shader_file(input_files[index], output_file, buffer, key);
+                }
+                else if(!buffer.reserve(input.size() + Composer::trailer_size)) {
+                    result = { Composer::Status::out_of_memory };
+                }
+                else {
+                    std::size_t output_size;
+                    result = encrypt ? Composer::try_encrypt_shader(input.data(), input.size(), buffer.data(), output_size, key) : Composer::try_decrypt_shader(input.data(), input.size(), buffer.data(), output_size, key);
+                }
+
+                auto done = std::chrono::steady_clock::now();
+                histograms[t].record(static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(done - intended).count()));
+                bytes[t] += input.size();
+                if(!result) {
+                    failures[t]++;
+                }
+            }
+        });
+    }
+    for(auto &thread : threads) {
+        thread.join();
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if(files) {
+        std::error_code ec;
+        std::filesystem::remove_all(directory, ec);
+    }
+
+    LatencyHistogram histogram;
+    std::uint64_t total_bytes = 0;
+    std::uint64_t total_failures = 0;
+    for(std::size_t t = 0; t < thread_count; t++) {
+        histogram.merge(histograms[t]);
+        total_bytes += bytes[t];
+        total_failures += failures[t];
+    }
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "workload     " << workload << ", " << thread_count << (thread_count == 1 ? " thread, " : " threads, ");
+    if(rate > 0) {
+        std::cout << rate << " ops/s";
+    }
+    else {
+        std::cout << "closed loop";
+    }
+    std::cout << ", " << elapsed << " s" << std::endl;
+
+    std::cout << "corpus       " << inputs.size() << " files, ";
+    print_size(corpus_bytes);
+    std::cout << ", median ";
+    print_size(sorted_sizes[sorted_sizes.size() / 2]);
+    std::cout << ", max ";
+    print_size(sorted_sizes.back());
+    std::cout << std::endl;
+
+    std::cout << "operations   " << histogram.count() << " (" << histogram.count() / elapsed << "/s), " << total_failures << " failed" << std::endl;
+    std::cout << "throughput   " << total_bytes / elapsed / 1e6 << " MB/s" << std::endl;
+    std::cout << "latency us   " << std::setprecision(1);
+    for(double percentile : { 50.0, 90.0, 99.0, 99.9 }) {
+        std::cout << "p" << std::setprecision(percentile == 99.9 ? 1 : 0) << percentile << " " << std::setprecision(1) << histogram.value_at_percentile(percentile) / 1000.0 << "  ";
+    }
+    std::cout << "max " << histogram.max() / 1000.0 << std::endl;
+
+    if(options.exist("histogram")) {
+        std::ofstream stream(options.get<std::string>("histogram"));
+        histogram.write_percentiles(stream);
+        stream.close();
+        if(!stream) {
+            std::cerr << "failed to write " << options.get<std::string>("histogram") << std::endl;
+            return 1;
+        }
+    }
+
+    return total_failures ? 1 : 0;
+}
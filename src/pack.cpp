@@ -0,0 +1,182 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <filesystem>
+#include <composer/mapped_file.hpp>
+#include <composer/pack.hpp>
+#include <composer/profile.hpp>
+#include <cmdline/cmdline.h>
+
+static void fail(std::string const &message, Composer::Result result) {
+    std::cerr << message << ": " << Composer::status_message(result.status);
+    if(result.error_number) {
+        std::cerr << " (" << std::strerror(result.error_number) << ")";
+    }
+    std::cerr << std::endl;
+    std::exit(1);
+}
+
+static int create_pack(std::filesystem::path const &pack_file, std::vector<std::string> const &inputs, bool encrypted) {
+    // Directories contribute their files named relative to the directory
+    std::vector<std::pair<std::string, std::filesystem::path>> files;
+    for(auto const &input : inputs) {
+        std::filesystem::path input_path = input;
+        if(std::filesystem::is_directory(input_path)) {
+            for(auto const &item : std::filesystem::recursive_directory_iterator(input_path)) {
+                if(item.is_regular_file()) {
+                    files.emplace_back(std::filesystem::relative(item.path(), input_path).generic_string(), item.path());
+                }
+            }
+        }
+        else {
+            files.emplace_back(input_path.filename().generic_string(), input_path);
+        }
+    }
+
+    Composer::PackWriter writer;
+    auto result = writer.open(pack_file);
+    if(!result) {
+        fail("failed to create " + pack_file.string(), result);
+    }
+
+    for(auto const &[name, path] : files) {
+        Composer::MappedFile file;
+        result = file.open(path);
+        if(!result) {
+            fail("failed to read " + path.string(), result);
+        }
+
+        if(encrypted) {
+            result = writer.add_encrypted_shader(name, file.data(), file.size());
+        }
+        else {
+            result = writer.add_shader(name, file.data(), file.size());
+        }
+        if(!result) {
+            fail("failed to add " + path.string(), result);
+        }
+    }
+
+    result = writer.finish();
+    if(!result) {
+        fail("failed to write " + pack_file.string(), result);
+    }
+
+    std::cout << "packed " << files.size() << " shader files: " << pack_file << std::endl;
+    return 0;
+}
+
+static int list_pack(Composer::PackReader const &reader) {
+    for(std::size_t i = 0; i < reader.entry_count(); i++) {
+        auto entry = reader.entry(i);
+        std::cout << entry.size << "\t" << entry.name << std::endl;
+    }
+    return 0;
+}
+
+static int extract_pack(Composer::PackReader const &reader, std::filesystem::path const &output_directory, std::vector<std::string> const &names) {
+    auto extract = [&](Composer::PackEntry const &entry) {
+        std::filesystem::path name = std::string(entry.name);
+        for(auto const &component : name) {
+            if(name.is_absolute() || component == "..") {
+                std::cerr << "refusing to extract " << name << std::endl;
+                std::exit(1);
+            }
+        }
+
+        std::vector<char> buffer(entry.size);
+        std::size_t size;
+        auto result = reader.try_decrypt(entry, buffer.data(), size);
+        if(!result) {
+            fail("failed to decrypt " + name.string(), result);
+        }
+
+        auto output_file = output_directory / name;
+        std::filesystem::create_directories(output_file.parent_path());
+        std::ofstream file(output_file, std::ios_base::out | std::ios_base::binary);
+        file.write(buffer.data(), size);
+        if(!file) {
+            std::cerr << "failed to write " << output_file << std::endl;
+            std::exit(1);
+        }
+    };
+
+    if(names.empty()) {
+        for(std::size_t i = 0; i < reader.entry_count(); i++) {
+            extract(reader.entry(i));
+        }
+    }
+    else {
+        for(auto const &name : names) {
+            Composer::PackEntry entry;
+            if(!reader.find(name, entry)) {
+                std::cerr << "no such entry: " << name << std::endl;
+                std::exit(1);
+            }
+            extract(entry);
+        }
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    cmdline::parser options;
+    options.set_program_name("composer-pack");
+    options.add<std::string>("output", 'o', "Output directory for extract.", false, ".");
+    options.add("encrypted", 'e', "Inputs for create are already encrypted.");
+    options.add("help", 'h', "Print this message.");
+    options.footer("<create|extract|list> <pack-file> [inputs or entry names...]");
+
+    if(argc == 1) {
+        std::cout << options.usage() << std::endl;
+        std::exit(0);
+    }
+
+    options.parse_check(argc, argv);
+
+    // Machine profile from composer-tune, options given here override it
+    auto profile_result = Composer::load_profile();
+    if(!profile_result && profile_result.status != Composer::Status::file_not_found) {
+        std::cerr << "ignoring machine profile: " << Composer::status_message(profile_result.status) << std::endl;
+    }
+
+    auto rest = options.rest();
+    if(rest.size() < 2) {
+        std::cout << "need option: command and pack file path" << std::endl;
+        std::exit(1);
+    }
+
+    auto command = rest[0];
+    std::filesystem::path pack_file = rest[1];
+    std::vector<std::string> arguments(rest.begin() + 2, rest.end());
+
+    if(command == "create") {
+        if(arguments.empty()) {
+            std::cout << "need option: input files" << std::endl;
+            std::exit(1);
+        }
+        return create_pack(pack_file, arguments, options.exist("encrypted"));
+    }
+
+    if(command != "extract" && command != "list") {
+        std::cout << "unknown command: " << command << std::endl;
+        std::exit(1);
+    }
+
+    Composer::PackReader reader;
+    auto result = reader.open(pack_file);
+    if(!result) {
+        fail("failed to open " + pack_file.string(), result);
+    }
+
+    if(command == "list") {
+        return list_pack(reader);
+    }
+
+    return extract_pack(reader, options.get<std::string>("output"), arguments);
+}
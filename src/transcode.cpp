@@ -0,0 +1,114 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <filesystem>
+#include <composer/buffer.hpp>
+#include <composer/file.hpp>
+#include <composer/profile.hpp>
+#include <composer/xtea.hpp>
+#include <cmdline/cmdline.h>
+
+static Composer::Key get_key(cmdline::parser const &options, std::string const &name) {
+    Composer::Key key = Composer::default_key;
+    if(options.exist(name) && !Composer::parse_key(options.get<std::string>(name), key)) {
+        std::cout << "invalid key: " << options.get<std::string>(name) << std::endl;
+        std::exit(1);
+    }
+    return key;
+}
+
+int main(int argc, char *argv[]) {
+    cmdline::parser options;
+    options.set_program_name("composer-transcode");
+    options.add<std::string>("output", 'o', "Re-encrypted shader output file.", false);
+    options.add<std::string>("from-key", 'f', "Key the input is encrypted with, as four hex words.", false);
+    options.add<std::string>("from-keys", 'F', "Key table file; the input key is detected from the end of the input.", false);
+    options.add<std::string>("to-key", 't', "Key to encrypt the output with, as four hex words.", false);
+    options.add<std::string>("alloc", 'a', "Buffer allocation policy: standard, prefault, thp or hugetlb.", false);
+    options.add("help", 'h', "Print this message.");
+    options.footer("<input-file>");
+
+    if(argc == 1) {
+        std::cout << options.usage() << std::endl;
+        std::exit(0);
+    }
+
+    options.parse_check(argc, argv);
+
+    // Machine profile from composer-tune, options given here override it
+    auto profile_result = Composer::load_profile();
+    if(!profile_result && profile_result.status != Composer::Status::file_not_found) {
+        std::cerr << "ignoring machine profile: " << Composer::status_message(profile_result.status) << std::endl;
+    }
+
+    auto rest = options.rest();
+    if(rest.empty()) {
+        std::cout << "need option: input file path" << std::endl;
+        std::exit(1);
+    }
+
+    std::filesystem::path input_file = rest[0];
+    std::filesystem::path output_file = input_file;
+    if(options.exist("output")) {
+        output_file = options.get<std::string>("output");
+    }
+
+    if(options.exist("alloc")) {
+        Composer::AllocationPolicy allocation_policy;
+        if(!Composer::parse_allocation_policy(options.get<std::string>("alloc"), allocation_policy)) {
+            std::cout << "invalid allocation policy: " << options.get<std::string>("alloc") << std::endl;
+            std::exit(1);
+        }
+        Composer::set_allocation_policy(allocation_policy);
+    }
+
+    Composer::Key from_key = get_key(options, "from-key");
+    Composer::Key to_key = get_key(options, "to-key");
+
+    if(options.exist("from-keys")) {
+        std::vector<Composer::Key> keys;
+        if(!Composer::read_key_table(options.get<std::string>("from-keys"), keys)) {
+            std::cout << "invalid key table: " << options.get<std::string>("from-keys") << std::endl;
+            std::exit(1);
+        }
+
+        std::size_t key_index;
+        auto result = Composer::try_detect_shader_file_key(input_file, keys.data(), keys.size(), key_index);
+        if(!result) {
+            std::cerr << Composer::status_message(result.status) << std::endl;
+            std::exit(1);
+        }
+        from_key = keys[key_index];
+        std::cout << "detected key #" << key_index << std::endl;
+    }
+
+    // Writing over the input while it's being read would lose it on failure
+    std::error_code ec;
+    bool in_place = std::filesystem::equivalent(input_file, output_file, ec);
+    std::filesystem::path target_file = output_file;
+    if(in_place) {
+        output_file += ".tmp";
+    }
+
+    try {
+        Composer::transcode_shader_file(input_file, output_file, from_key, to_key);
+    }
+    catch(const std::runtime_error &e) {
+        std::cerr << e.what();
+        std::exit(1);
+    }
+
+    if(in_place) {
+        std::filesystem::rename(output_file, target_file, ec);
+        if(ec) {
+            std::cerr << ec.message() << std::endl;
+            std::exit(1);
+        }
+    }
+
+    std::cout << "transcoded shader file: " << target_file << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,347 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <iomanip>
+#include <iostream>
+#include <filesystem>
+#include <composer/buffer.hpp>
+#include <composer/file.hpp>
+#include <composer/profile.hpp>
+#include <composer/scheduler.hpp>
+#include <composer/worker_pool.hpp>
+#include <composer/xtea.hpp>
+#include <hash-library/md5.h>
+#include <cmdline/cmdline.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/**
+ * Run an operation a few times and keep the best time, in seconds; negative if it fails
+ */
+template<typename Operation>
+static double best_time(std::size_t repeat, Operation &&operation) {
+    double best = -1;
+    for(std::size_t i = 0; i < repeat; i++) {
+        auto start = std::chrono::steady_clock::now();
+        if(!operation()) {
+            return -1;
+        }
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if(best < 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    return best;
+}
+
+static void print_rate(std::string const &what, std::string const &choice, std::uint64_t bytes, double seconds, std::string const &note = std::string()) {
+    std::cout << std::left << std::setw(10) << what << std::setw(20) << choice;
+    if(seconds < 0) {
+        std::cout << "failed" << std::endl;
+    }
+    else {
+        std::cout << std::right << std::fixed << std::setprecision(1) << std::setw(10) << bytes / seconds / 1e6 << " MB/s" << note << std::endl;
+    }
+}
+
+/**
+ * Page faults of the process and data TLB misses of the calling thread and the threads it starts,
+ * over a stretch of code
+ */
+class FaultCounter {
+public:
+    FaultCounter() {
+#ifdef __linux__
+        perf_event_attr attr = {};
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_CACHE_DTLB | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+        attr.disabled = 1;
+        attr.inherit = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        // Unavailable in most VMs and with a strict perf_event_paranoid; faults are still counted
+        this->tlb = static_cast<int>(::syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+    }
+
+    FaultCounter(FaultCounter const &) = delete;
+    FaultCounter &operator=(FaultCounter const &) = delete;
+
+    ~FaultCounter() {
+#ifdef __linux__
+        if(this->tlb >= 0) {
+            ::close(this->tlb);
+        }
+#endif
+    }
+
+    void start() {
+        this->faults = count_faults();
+#ifdef __linux__
+        if(this->tlb >= 0) {
+            ::ioctl(this->tlb, PERF_EVENT_IOC_RESET, 0);
+            ::ioctl(this->tlb, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    /**
+     * Describe the counts since start, per run
+     */
+    std::string stop(std::size_t runs) {
+        std::string text = "  " + std::to_string((count_faults() - this->faults) / runs) + " faults";
+#ifdef __linux__
+        std::uint64_t misses;
+        if(this->tlb >= 0 && ::ioctl(this->tlb, PERF_EVENT_IOC_DISABLE, 0) == 0 && ::read(this->tlb, &misses, sizeof(misses)) == sizeof(misses)) {
+            return text + "  " + std::to_string(misses / runs) + " dTLB misses";
+        }
+#endif
+        return text;
+    }
+
+private:
+    static std::uint64_t count_faults() {
+#ifdef __linux__
+        rusage usage;
+        if(::getrusage(RUSAGE_SELF, &usage) == 0) {
+            return static_cast<std::uint64_t>(usage.ru_minflt) + static_cast<std::uint64_t>(usage.ru_majflt);
+        }
+#endif
+        return 0;
+    }
+
+    std::uint64_t faults = 0;
+    int tlb = -1;
+};
+
+static bool write_sample(std::filesystem::path const &file, std::vector<char> const &data, std::size_t size) {
+    std::ofstream stream(file, std::ios_base::binary);
+    stream.write(data.data(), size);
+    stream.close();
+    return static_cast<bool>(stream);
+}
+
+int main(int argc, char *argv[]) {
+    cmdline::parser options;
+    options.set_program_name("composer-tune");
+    options.add<std::string>("output", 'o', "Profile file to write, by default the one the tools load.", false);
+    options.add<std::string>("directory", 'd', "Scratch directory for the I/O benchmarks, on the disk to tune for.", false);
+    options.add<int>("size", 's', "Size in MiB of the sample data.", false, 64);
+    options.add<int>("repeat", 'r', "Runs of each benchmark; the best one counts.", false, 3);
+    options.add("dry-run", 'n', "Print the profile without writing it.");
+    options.add("help", 'h', "Print this message.");
+
+    options.parse_check(argc, argv);
+
+    std::filesystem::path profile_file = options.exist("output") ? std::filesystem::path(options.get<std::string>("output")) : Composer::default_profile_path();
+    if(profile_file.empty() && !options.exist("dry-run")) {
+        std::cout << "need option: output (no default profile path)" << std::endl;
+        std::exit(1);
+    }
+
+    std::size_t sample_size = static_cast<std::size_t>(std::max(options.get<int>("size"), 1)) << 20;
+    std::size_t repeat = static_cast<std::size_t>(std::max(options.get<int>("repeat"), 1));
+
+    auto directory = (options.exist("directory") ? std::filesystem::path(options.get<std::string>("directory")) : std::filesystem::temp_directory_path()) / "composer-tune";
+    std::error_code ec;
+    std::filesystem::create_directories(directory, ec);
+    if(ec) {
+        std::cerr << "failed to create " << directory << ": " << ec.message() << std::endl;
+        std::exit(1);
+    }
+
+    std::vector<char> data(sample_size);
+    std::mt19937_64 random(sample_size);
+    for(auto &byte : data) {
+        byte = static_cast<char>(random());
+    }
+
+    Composer::Profile profile;
+
+    // Cipher backends, on a copy of the sample so it stays plain
+    std::vector<char> blocks = data;
+    double best = -1;
+    for(auto backend : { Composer::CipherBackend::scalar, Composer::CipherBackend::vector, Composer::CipherBackend::avx2 }) {
+        if(!Composer::set_cipher_backend(backend)) {
+            continue;
+        }
+        double seconds = best_time(repeat, [&]() {
+            Composer::encrypt_blocks(blocks.data(), blocks.size() / 8, Composer::default_key);
+            return true;
+        });
+        print_rate("cipher", Composer::cipher_backend_name(backend), sample_size, seconds);
+        if(best < 0 || seconds < best) {
+            best = seconds;
+            profile.cipher_backend = backend;
+        }
+    }
+    Composer::set_cipher_backend(profile.cipher_backend);
+
+    // MD5 kernels
+    best = -1;
+    for(auto kernel : { MD5::Portable, MD5::Bmi, MD5::Avx512 }) {
+        if(!MD5::setKernel(kernel)) {
+            continue;
+        }
+        double seconds = best_time(repeat, [&]() {
+            unsigned char hash[MD5::HashBytes];
+            MD5 md5;
+            md5.add(data.data(), data.size());
+            md5.getHash(hash);
+            return true;
+        });
+        print_rate("md5", Composer::md5_kernel_name(kernel), sample_size, seconds);
+        if(best < 0 || seconds < best) {
+            best = seconds;
+            profile.md5_kernel = kernel;
+        }
+    }
+    MD5::setKernel(profile.md5_kernel);
+
+    auto sample_file = directory / "sample.bin";
+    auto output_file = directory / "sample.enc";
+    if(!write_sample(sample_file, data, sample_size)) {
+        std::cerr << "failed to write " << sample_file << std::endl;
+        std::exit(1);
+    }
+
+    // Allocation policies, each run allocating its buffer like a one-shot tool does, with the page
+    // faults and TLB misses that the policies are meant to save
+    best = -1;
+    FaultCounter fault_counter;
+    for(auto policy : { Composer::AllocationPolicy::standard, Composer::AllocationPolicy::prefault, Composer::AllocationPolicy::transparent_huge_pages, Composer::AllocationPolicy::huge_pages }) {
+        Composer::set_allocation_policy(policy);
+        fault_counter.start();
+        double seconds = best_time(repeat, [&]() {
+            return static_cast<bool>(Composer::try_encrypt_shader_file(sample_file, output_file));
+        });
+        print_rate("alloc", Composer::allocation_policy_name(policy), sample_size, seconds, fault_counter.stop(repeat));
+        if(seconds >= 0 && (best < 0 || seconds < best)) {
+            best = seconds;
+            profile.allocation_policy = policy;
+        }
+    }
+    Composer::set_allocation_policy(profile.allocation_policy);
+
+    // Pipeline chunking
+    best = -1;
+    for(std::size_t chunk_size : { std::size_t(256) << 10, std::size_t(1) << 20, std::size_t(4) << 20 }) {
+        for(std::size_t chunk_count : { 2, 4, 8 }) {
+            Composer::PipelineOptions pipeline;
+            pipeline.chunk_size = chunk_size;
+            pipeline.chunk_count = chunk_count;
+            double seconds = best_time(repeat, [&]() {
+                return static_cast<bool>(Composer::try_encrypt_shader_file(sample_file, output_file, pipeline));
+            });
+            print_rate("pipeline", std::to_string(chunk_size >> 10) + " KiB x " + std::to_string(chunk_count), sample_size, seconds);
+            if(seconds >= 0 && (best < 0 || seconds < best)) {
+                best = seconds;
+                profile.pipeline = pipeline;
+            }
+        }
+    }
+
+    // Smallest file size from which the pipelined mode keeps winning
+    std::vector<std::size_t> sizes;
+    for(std::size_t size = std::size_t(1) << 20; size < sample_size; size *= 4) {
+        sizes.push_back(size);
+    }
+    sizes.push_back(sample_size);
+
+    profile.pipeline_threshold = 0;
+    for(auto size = sizes.rbegin(); size != sizes.rend(); size++) {
+        if(!write_sample(sample_file, data, *size)) {
+            std::cerr << "failed to write " << sample_file << std::endl;
+            std::exit(1);
+        }
+        double whole = best_time(repeat, [&]() {
+            return static_cast<bool>(Composer::try_encrypt_shader_file(sample_file, output_file));
+        });
+        double pipelined = best_time(repeat, [&]() {
+            return static_cast<bool>(Composer::try_encrypt_shader_file(sample_file, output_file, profile.pipeline));
+        });
+        print_rate("whole", std::to_string(*size >> 20) + " MiB", *size, whole);
+        print_rate("pipelined", std::to_string(*size >> 20) + " MiB", *size, pipelined);
+        if(pipelined < 0 || (whole >= 0 && pipelined >= whole)) {
+            break;
+        }
+        profile.pipeline_threshold = *size;
+    }
+    std::filesystem::remove(sample_file, ec);
+    std::filesystem::remove(output_file, ec);
+
+    // Worker threads, over many small files like a batch
+    constexpr std::size_t file_count = 32;
+    std::size_t file_size = std::max<std::size_t>(sample_size / file_count, 8);
+    std::vector<Composer::ShaderTask> tasks;
+    for(std::size_t i = 0; i < file_count; i++) {
+        auto input_file = directory / (std::to_string(i) + ".bin");
+        if(!write_sample(input_file, data, file_size)) {
+            std::cerr << "failed to write " << input_file << std::endl;
+            std::exit(1);
+        }
+        auto output_file = input_file;
+        output_file.replace_extension(".enc");
+        tasks.push_back({ input_file, output_file, file_size, {} });
+    }
+
+    std::size_t hardware_threads = std::max<std::size_t>(std::thread::hardware_concurrency(), 1);
+    std::vector<std::size_t> thread_counts;
+    for(std::size_t count = 1; count < hardware_threads; count *= 2) {
+        thread_counts.push_back(count);
+    }
+    thread_counts.push_back(hardware_threads);
+
+    best = -1;
+    for(auto thread_count : thread_counts) {
+        Composer::WorkerPool pool(thread_count);
+        double seconds = best_time(repeat, [&]() {
+            return Composer::run_shader_tasks(tasks, Composer::Operation::encrypt, pool);
+        });
+        print_rate("threads", std::to_string(thread_count), file_size * file_count, seconds);
+
+        // More threads have to pay for themselves
+        if(seconds >= 0 && (best < 0 || seconds < best * 0.95)) {
+            best = seconds;
+            profile.thread_count = thread_count;
+        }
+    }
+    std::filesystem::remove_all(directory, ec);
+
+    std::cout << std::endl;
+    std::cout << "cipher              " << Composer::cipher_backend_name(profile.cipher_backend) << std::endl;
+    std::cout << "md5                 " << Composer::md5_kernel_name(profile.md5_kernel) << std::endl;
+    std::cout << "alloc               " << Composer::allocation_policy_name(profile.allocation_policy) << std::endl;
+    std::cout << "pipeline-threshold  " << profile.pipeline_threshold << std::endl;
+    std::cout << "chunk-size          " << profile.pipeline.chunk_size << std::endl;
+    std::cout << "chunk-count         " << profile.pipeline.chunk_count << std::endl;
+    std::cout << "threads             " << profile.thread_count << std::endl;
+
+    if(options.exist("dry-run")) {
+        return 0;
+    }
+
+    auto result = Composer::write_profile(profile_file, profile);
+    if(!result) {
+        std::cerr << "failed to write " << profile_file << ": " << Composer::status_message(result.status) << std::endl;
+        std::exit(1);
+    }
+    std::cout << "wrote profile: " << profile_file << std::endl;
+
+    return 0;
+}